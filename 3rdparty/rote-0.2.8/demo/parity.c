@@ -0,0 +1,141 @@
+/* Feeds a terminal a pseudo-random mix of text, control characters and
+ * escape sequences, either in whole writes or cut into pieces of 1 to 4
+ * bytes, then prints its screen, its cursor and a hash of the rows that
+ * scrolled off. The parser must not care how the stream was cut, and two
+ * revisions of rote must agree on every seed:
+ *
+ *    make parity                      the working tree against HEAD
+ *    make parity PARITY_REF=<rev>     ... against another revision
+ *
+ * The mix leaves out what changed meaning on purpose with the VT500
+ * parser (OSC strings, charset designations, private and intermediate
+ * CSI bytes) and since (UTF-8, extended SGR colors, the alternate screen,
+ * tabs at the last column), so that revisions from before those changes
+ * compare too. Revisions from before the text and attribute planes are
+ * compared on their screen only; the Makefile builds them with ROTE_CELLS.
+ *
+ *    demo/parity SEED [split]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rote.h"
+
+#define STEPS 20000
+
+#ifdef ROTE_CELLS
+#define CELL_TEXT(rt, i, j) ((rt)->cells[i][j].ch)
+#define CELL_ATTR(rt, i, j) ((rt)->cells[i][j].attr)
+#else
+#define CELL_TEXT(rt, i, j) ((rt)->lines[i].text[j])
+#define CELL_ATTR(rt, i, j) ((rt)->lines[i].attr[j])
+
+static unsigned long scrolled;
+
+static void hash_row(RoteTerm *rt, const RoteRow *row, void *data) {
+   int j;
+   for (j = 0; j < rt->cols; j++)
+      scrolled = scrolled * 131 + (unsigned char) row->text[j] * 7 +
+                 row->attr[j];
+}
+#endif
+
+/* the piece lengths come from their own generator, so that a split run
+ * writes the same stream as a whole one */
+static unsigned split_state;
+
+static int piece_length(void) {
+   split_state = split_state * 1103515245 + 12345;
+   return 1 + (split_state >> 16) % 4;
+}
+
+static char pick_char(void) {
+   int c = rand() % 100;
+   if (c < 90) return 32 + rand() % 95;
+   c = c < 97 ? 1 + rand() % 26 : 127;
+   /* no ESC, CAN, SUB, shifts or tabs inside text */
+   return c == 0x1b || c == 0x18 || c == 0x1a || c == 0x0e || c == 0x0f ||
+          c == '\t' ? 'x' : c;
+}
+
+static int pick_sgr(void) {
+   int p = rand() % 50;
+   return p == 38 || p == 48 ? 0 : p;
+}
+
+static void next_chunk(char *buf) {
+   int r = rand() % 26, len, i, mode;
+
+   switch (r) {
+      case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+         len = 1 + rand() % 100;
+         for (i = 0; i < len; i++) buf[i] = pick_char();
+         buf[len] = 0;
+         break;
+      case 8: case 9: strcpy(buf, "\n"); break;
+      case 10: sprintf(buf, "\x1b[%dL", rand() % 30); break;
+      case 11: sprintf(buf, "\x1b[%dM", rand() % 30); break;
+      case 12: sprintf(buf, "\x1b[%d;%dr", rand() % 25, rand() % 25); break;
+      case 13: sprintf(buf, "\x1b[%d;%dH", rand() % 26, rand() % 40); break;
+      case 14: strcpy(buf, "\x1bM"); break;
+      case 15: sprintf(buf, "\x1b[%d;%d;%dm", rand() % 9, 30 + rand() % 8,
+                       40 + rand() % 8); break;
+      case 16: sprintf(buf, "\x1b[%dJ", rand() % 3); break;
+      case 17: sprintf(buf, "\x1b[%dK", rand() % 3); break;
+      case 18: sprintf(buf, "\x1b[%d@", rand() % 45); break;
+      case 19: sprintf(buf, "\x1b[%dP", rand() % 45); break;
+      case 20: sprintf(buf, "\x1b[%dX", rand() % 45); break;
+      case 22:
+         mode = rand() % 2000;
+         if (mode == 47 || (mode >= 1047 && mode <= 1049)) mode = 1;
+         sprintf(buf, "\x1b[?%dh", mode);
+         break;
+      case 23:  /* a control character inside a CSI sequence */
+         sprintf(buf, "\x1b[%d\n%dH", 1 + rand() % 20, 1 + rand() % 30);
+         break;
+      case 24: sprintf(buf, "\x1b[%dm\x1b[%dm", pick_sgr(), pick_sgr()); break;
+      default: strcpy(buf, "\r"); break;
+   }
+}
+
+int main(int argc, char **argv) {
+   RoteTerm *rt;
+   char buf[128];
+   int split, len, k, i, j, n;
+
+   if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "split"))) {
+      fprintf(stderr, "usage: %s SEED [split]\n", argv[0]);
+      return 2;
+   }
+   srand(atoi(argv[1]));
+   split_state = atoi(argv[1]);
+   split = argc == 3;
+
+   rt = rote_vt_create(24, 37);
+#ifndef ROTE_CELLS
+   rote_vt_install_scroll_handler(rt, hash_row, NULL);
+#endif
+
+   for (k = 0; k < STEPS; k++) {
+      next_chunk(buf);
+      len = strlen(buf);
+      for (i = 0; i < len; i += n) {
+         n = split ? piece_length() : len;
+         if (n > len - i) n = len - i;
+         rote_vt_inject(rt, buf + i, n);
+      }
+   }
+
+   for (i = 0; i < rt->rows; i++) {
+      for (j = 0; j < rt->cols; j++)
+         printf("%c%02x", CELL_TEXT(rt, i, j), CELL_ATTR(rt, i, j));
+      printf("\n");
+   }
+   printf("cursor %d %d attr %02x\n", rt->crow, rt->ccol, rt->curattr);
+#ifndef ROTE_CELLS
+   printf("scrolled %lu\n", scrolled);
+#endif
+   rote_vt_destroy(rt);
+   return 0;
+}
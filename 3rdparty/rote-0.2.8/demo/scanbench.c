@@ -0,0 +1,203 @@
+/* Times scans over 500 screens of 40 x 140, as omnitty runs them over the
+ * snapshots of its machines, with the cells in two layouts:
+ *
+ *    cells   {character, attribute} pairs, as rote kept them before the
+ *            text and attribute planes;
+ *    planes  the text of each row on its own, as rote's snapshots keep it.
+ *
+ * The screens come from rote terminals fed random words. Each scan runs
+ * 30 times per layout; the best time is printed, with whether both
+ * layouts found the same result.
+ *
+ * To compile, from rote's directory:
+ *    make scanbench
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rote.h"
+
+#define SCREENS 500
+#define ROWS    40
+#define COLS    140
+#define RUNS    30
+
+typedef struct {
+   unsigned char ch, attr;
+} Cell;
+
+static Cell cells[SCREENS][ROWS][COLS];
+static RoteSnapshot *snaps[SCREENS];
+
+static const char needle[] = "qzxv";
+
+static double now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_screens(void) {
+   char line[COLS + 3];
+   int s, r, c, len;
+
+   srand(1);
+   for (s = 0; s < SCREENS; s++) {
+      RoteTerm *rt = rote_vt_create(ROWS, COLS);
+      for (r = 0; r < ROWS; r++) {
+         /* lowercase words, shorter than the row */
+         len = rand() % COLS;
+         for (c = 0; c < len; c++)
+            line[c] = rand() % 6 ? 'a' + rand() % 26 : ' ';
+         strcpy(line + len, r < ROWS - 1 ? "\r\n" : "");
+         rote_vt_inject(rt, line, strlen(line));
+      }
+      snaps[s] = rote_vt_take_snapshot(rt);
+      for (r = 0; r < ROWS; r++)
+         for (c = 0; c < COLS; c++) {
+            cells[s][r][c].ch = snaps[s]->lines[r]->text[c];
+            cells[s][r][c].attr = snaps[s]->lines[r]->attr[c];
+         }
+      rote_vt_destroy(rt);
+   }
+}
+
+static const char *text(int s, int r) {
+   return snaps[s]->lines[r]->text;
+}
+
+static unsigned long search_cells(void) {
+   unsigned long n = 0;
+   int s, r, c, k;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++)
+         for (c = 0; c + (int) sizeof(needle) - 1 <= COLS; c++) {
+            for (k = 0; needle[k] && cells[s][r][c + k].ch == needle[k]; k++);
+            if (!needle[k]) n++;
+         }
+   return n;
+}
+
+static unsigned long search_planes(void) {
+   unsigned long n = 0;
+   const char *t, *p;
+   int s, r;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++) {
+         t = text(s, r);
+         for (p = t; (p = memmem(p, COLS - (p - t), needle,
+                                 sizeof(needle) - 1)); p++)
+            n++;
+      }
+   return n;
+}
+
+/* a character that no row holds, so every row is scanned to its end */
+static unsigned long find_cells(void) {
+   unsigned long n = 0;
+   int s, r, c;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++)
+         for (c = 0; c < COLS; c++)
+            if (cells[s][r][c].ch == '#') { n += c; break; }
+   return n;
+}
+
+static unsigned long find_planes(void) {
+   unsigned long n = 0;
+   const char *p;
+   int s, r;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++)
+         if ((p = memchr(text(s, r), '#', COLS))) n += p - text(s, r);
+   return n;
+}
+
+static unsigned long hash_cells(void) {
+   unsigned long h = 0, x;
+   int s, r, c;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++) {
+         x = 1469598103934665603UL;
+         for (c = 0; c < COLS; c++)
+            x = (x ^ cells[s][r][c].ch) * 1099511628211UL;
+         h += x;
+      }
+   return h;
+}
+
+static unsigned long hash_planes(void) {
+   unsigned long h = 0, x;
+   const unsigned char *t;
+   int s, r, c;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++) {
+         t = (const unsigned char*) text(s, r);
+         x = 1469598103934665603UL;
+         for (c = 0; c < COLS; c++) x = (x ^ t[c]) * 1099511628211UL;
+         h += x;
+      }
+   return h;
+}
+
+static unsigned long trim_cells(void) {
+   unsigned long n = 0;
+   int s, r, c;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++) {
+         for (c = COLS; c > 0 && cells[s][r][c - 1].ch == ' '; c--);
+         n += c;
+      }
+   return n;
+}
+
+static unsigned long trim_planes(void) {
+   unsigned long n = 0;
+   const char *t;
+   int s, r, c;
+   for (s = 0; s < SCREENS; s++)
+      for (r = 0; r < ROWS; r++) {
+         t = text(s, r);
+         for (c = COLS; c > 0 && t[c - 1] == ' '; c--);
+         n += c;
+      }
+   return n;
+}
+
+static void bench(const char *name, unsigned long (*on_cells)(void),
+                  unsigned long (*on_planes)(void)) {
+   double best_cells = 1e9, best_planes = 1e9, t;
+   unsigned long found_cells = 0, found_planes = 0;
+   int i;
+
+   for (i = 0; i < RUNS; i++) {
+      t = now();
+      found_cells = on_cells();
+      t = now() - t;
+      if (t < best_cells) best_cells = t;
+
+      t = now();
+      found_planes = on_planes();
+      t = now() - t;
+      if (t < best_planes) best_planes = t;
+   }
+   printf("%-20s cells %7.0f us   planes %7.0f us   x%.1f   %s\n", name,
+          best_cells * 1e6, best_planes * 1e6, best_cells / best_planes,
+          found_cells == found_planes ? "same" : "DIFFERENT");
+}
+
+int main(void) {
+   int s;
+
+   make_screens();
+   bench("substring search", search_cells, search_planes);
+   bench("memchr for a char", find_cells, find_planes);
+   bench("FNV-1a text hash", hash_cells, hash_planes);
+   bench("trim blanks", trim_cells, trim_planes);
+
+   for (s = 0; s < SCREENS; s++) rote_snapshot_unref(snaps[s]);
+   return 0;
+}
@@ -25,7 +25,6 @@ Copyright (c) 2004 Bruno T. C. de Oliveira
 #include <string.h>
 
 static void cursor_line_down(RoteTerm *rt) {
-   int i;
    rt->crow++;
    rt->curpos_dirty = true;
    if (rt->crow <= rt->pd->scrollbottom) return;
@@ -33,87 +32,424 @@ static void cursor_line_down(RoteTerm *rt) {
    /* must scroll the scrolling region up by 1 line, and put cursor on 
     * last line of it */
    rt->crow = rt->pd->scrollbottom;
-   
-   for (i = rt->pd->scrolltop; i < rt->pd->scrollbottom; i++) {
-      rt->line_dirty[i] = true;
-      memcpy(rt->cells[i], rt->cells[i+1], sizeof(RoteCell) * rt->cols);
-   }
-      
-   rt->line_dirty[rt->pd->scrollbottom] = true;
-
-   /* clear last row of the scrolling region */
-   for (i = 0; i < rt->cols; i++) {
-      rt->cells[rt->pd->scrollbottom][i].ch = 0x20;
-      rt->cells[rt->pd->scrollbottom][i].attr = 0x70;
-   }
-
+   /* the alternate screen keeps no history */
+   if (rt->pd->scrolltop == 0 && !rt->pd->altscreen && rt->pd->scroll_handler)
+      (*rt->pd->scroll_handler)(rt, &rt->lines[0], rt->pd->scroll_data);
+   rote_vt_rotate_rows(rt, rt->pd->scrolltop, rt->pd->scrollbottom, 1,
+                       0x70, 0);
 }
 
 static void cursor_line_up(RoteTerm *rt) {
-   int i;
    rt->crow--;
    rt->curpos_dirty = true;
    if (rt->crow >= rt->pd->scrolltop) return;
 
-   /* must scroll the scrolling region up by 1 line, and put cursor on 
+   /* must scroll the scrolling region down by 1 line, and put cursor on 
     * first line of it */
    rt->crow = rt->pd->scrolltop;
-   
-   for (i = rt->pd->scrollbottom; i > rt->pd->scrolltop; i--) {
-      rt->line_dirty[i] = true;
-      memcpy(rt->cells[i], rt->cells[i-1], sizeof(RoteCell) * rt->cols);
-   }
-      
-   rt->line_dirty[rt->pd->scrolltop] = true;
-
-   /* clear first row of the scrolling region */
-   for (i = 0; i < rt->cols; i++) {
-      rt->cells[rt->pd->scrolltop][i].ch = 0x20;
-      rt->cells[rt->pd->scrolltop][i].attr = 0x70;
-   }
-
+   rote_vt_rotate_rows(rt, rt->pd->scrolltop, rt->pd->scrollbottom, -1,
+                       0x70, 0);
 }
 
 static inline void put_normal_char(RoteTerm *rt, char c) {
+   RoteRow *row;
    if (rt->ccol >= rt->cols) {
       rt->ccol = 0;
       cursor_line_down(rt);
    }
 
-   rt->cells[rt->crow][rt->ccol].ch = c;
-   rt->cells[rt->crow][rt->ccol].attr = rt->curattr;
+   row = &rt->lines[rt->crow];
+   if (row->glyph) rote_vt_split_wide(rt, row, rt->ccol, 1);
+   row->text[rt->ccol] = c;
+   row->attr[rt->ccol] = rt->curattr;
+   if (row->xattr) row->xattr[rt->ccol] = rt->pd->curxattr;
+   rote_vt_damage(rt, rt->crow, rt->ccol, rt->ccol);
    rt->ccol++;
 
-   rt->line_dirty[rt->crow] = true;
    rt->curpos_dirty = true;
 }
 
-static inline void put_graphmode_char(RoteTerm *rt, char c) {
-   char nc;
-   /* do some very pitiful translation to regular ascii chars */
-   switch (c) {
-      case 'j': case 'k': case 'l': case 'm': case 'n': case 't': 
-                                    case 'u': case 'v': case 'w':
-         nc = '+'; break;
-      case 'x':
-         nc = '|'; break;
-      default:
-         nc = '%';
+/* Same as put_normal_char for each of the len printable bytes of data,
+ * but a line at a time */
+static void put_normal_run(RoteTerm *rt, const char *data, int len) {
+   int n;
+   while (len > 0) {
+      if (rt->ccol >= rt->cols) {
+         rt->ccol = 0;
+         cursor_line_down(rt);
+      }
+
+      n = rt->cols - rt->ccol;
+      if (n > len) n = len;
+      rote_vt_store_cells(rt, &rt->lines[rt->crow], rt->ccol, data, n,
+                          rt->curattr, rt->pd->curxattr);
+      rt->ccol += n;
+      data += n;
+      len -= n;
+   }
+   rt->curpos_dirty = true;
+}
+
+/* Puts glyph n, which is width columns wide, at the cursor. The glyph
+ * plane must be there. */
+static void put_glyph(RoteTerm *rt, unsigned short n, int width) {
+   RoteRow *row;
+   if (width > rt->cols) width = rt->cols;
+   if (rt->ccol + width > rt->cols) {
+      /* a wide glyph isn't split at the end of the line either */
+      rt->ccol = 0;
+      cursor_line_down(rt);
+   }
+
+   row = &rt->lines[rt->crow];
+   rote_vt_split_wide(rt, row, rt->ccol, width);
+   row->text[rt->ccol] = ROTE_CELL_GLYPH;
+   row->attr[rt->ccol] = rt->curattr;
+   row->glyph[rt->ccol] = n;
+   if (row->xattr) row->xattr[rt->ccol] = rt->pd->curxattr;
+   if (width == 2) {
+      row->text[rt->ccol + 1] = ROTE_CELL_WIDE_TAIL;
+      row->attr[rt->ccol + 1] = rt->curattr;
+      row->glyph[rt->ccol + 1] = n;
+      if (row->xattr) row->xattr[rt->ccol + 1] = rt->pd->curxattr;
+   }
+   rote_vt_damage(rt, rt->crow, rt->ccol, rt->ccol + width - 1);
+   rt->ccol += width;
+
+   rt->curpos_dirty = true;
+}
+
+/* Returns the column of the cell left of the cursor, the first of the
+ * two for a wide glyph, or -1 at the start of the line */
+static int previous_cell(RoteTerm *rt) {
+   int col = (rt->ccol < rt->cols ? rt->ccol : rt->cols) - 1;
+   if (col > 0 &&
+       (unsigned char) rt->lines[rt->crow].text[col] == ROTE_CELL_WIDE_TAIL)
+      col--;
+   return col;
+}
+
+/* Whether the glyph left of the cursor ends with a zero width joiner,
+ * which makes the next character part of it */
+static bool after_joiner(RoteTerm *rt) {
+   static const char zwj[] = "\xE2\x80\x8D";
+   int col = previous_cell(rt), len;
+   const char *utf8;
+   if (col < 0 || (unsigned char) rt->lines[rt->crow].text[col] != ROTE_CELL_GLYPH)
+      return false;
+
+   utf8 = rote_vt_get_glyph(rt, rt->lines[rt->crow].glyph[col])->utf8;
+   len = strlen(utf8);
+   return len >= 3 && !memcmp(utf8 + len - 3, zwj, 3);
+}
+
+/* Adds the code point to the character or glyph left of the cursor, as
+ * a combining mark; returns false if there's none */
+static bool join_previous(RoteTerm *rt, unsigned int cp) {
+   char utf8[ROTE_GLYPH_BYTES + 4];
+   int col = previous_cell(rt), len, width = 1;
+   RoteRow *row = &rt->lines[rt->crow];
+   const RoteGlyph *g;
+   unsigned char ch;
+   if (col < 0) return false;
+
+   ch = row->text[col];
+   if (ch == ROTE_CELL_GLYPH) {
+      g = rote_vt_get_glyph(rt, row->glyph[col]);
+      len = strlen(g->utf8);
+      memcpy(utf8, g->utf8, len);
+      width = g->width;
+   }
+   else if (ch == ROTE_CELL_WIDE_TAIL) return false;
+   else {
+      utf8[0] = ch;
+      len = 1;
    }
 
-   put_normal_char(rt, nc);
+   /* a cluster too long for a glyph keeps what it had */
+   len += rote_utf8_encode(cp, utf8 + len);
+   if (len >= ROTE_GLYPH_BYTES) return true;
+   rote_vt_alloc_glyphs(rt);
+   if (!rt->pd->screen.glyphbuf) return true;
+
+   row->text[col] = ROTE_CELL_GLYPH;
+   row->glyph[col] = rote_vt_intern_glyph(rt, utf8, len, width);
+   rote_vt_damage(rt, rt->crow, col, col + width - 1);
+   return true;
 }
 
-static inline void new_escape_sequence(RoteTerm *rt) {
-   rt->pd->escaped = true;
-   rt->pd->esbuf_len = 0;
-   rt->pd->esbuf[0] = '\0';
+static void put_codepoint(RoteTerm *rt, unsigned int cp) {
+   char utf8[4];
+   int width;
+   if (cp < 0x80) {
+      put_normal_char(rt, cp);
+      return;
+   }
+
+   width = rote_wcwidth(cp);
+   if (width < 0) return;  /* C1 controls aren't acted upon */
+   if ((width == 0 || after_joiner(rt)) && join_previous(rt, cp)) return;
+   if (width == 0) return;  /* nothing to combine with */
+
+   rote_vt_alloc_glyphs(rt);
+   if (!rt->pd->screen.glyphbuf) {
+      put_normal_char(rt, '?');
+      return;
+   }
+   put_glyph(rt, rote_vt_intern_glyph(rt, utf8, rote_utf8_encode(cp, utf8), width),
+             width);
 }
 
-static inline void cancel_escape_sequence(RoteTerm *rt) {
-   rt->pd->escaped = false;
-   rt->pd->esbuf_len = 0;
-   rt->pd->esbuf[0] = '\0';
+/* DEC special graphics, the characters that 0x5F - 0x7E stand for in
+ * graphical character mode */
+static const unsigned short dec_graphics[] = {
+   0x0020, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,
+   0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,
+   0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,
+   0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7
+};
+
+static inline void put_graphmode_char(RoteTerm *rt, char c) {
+   if (c >= 0x5F && c <= 0x7E) put_codepoint(rt, dec_graphics[c - 0x5F]);
+   else                        put_normal_char(rt, c);
+}
+
+/* Escape sequences are parsed by the state machine of the DEC VT500
+ * series (see vt100.net/emu/dec_ansi_parser): each byte falls in one of
+ * the classes below, and the pair (state, class) gives the next state and
+ * the action to take, straight from a table. Parameters are accumulated
+ * as their digits arrive, so nothing is re-scanned. Bytes from 0x80 up are
+ * not C1 controls here: in the ground state they're decoded as UTF-8. */
+
+/* byte classes */
+enum {
+   BC_C0,      /* C0 controls, executed */
+   BC_BEL,     /* 0x07, also ends an OSC string */
+   BC_CAN,     /* 0x18 and 0x1A, abort a sequence */
+   BC_ESC,     /* 0x1B */
+   BC_INT,     /* intermediates, 0x20 - 0x2F */
+   BC_DIG,     /* 0 - 9 */
+   BC_COL,     /* : */
+   BC_SEM,     /* ; */
+   BC_PRV,     /* private markers, < = > ? */
+   BC_FIN,     /* other finals, 0x40 - 0x7E */
+   BC_CSI,     /* [ */
+   BC_OSC,     /* ] */
+   BC_DCS,     /* P */
+   BC_STR,     /* X ^ _, introducing SOS, PM and APC */
+   BC_DEL,     /* 0x7F */
+   BC_CONT,    /* 0x80 - 0xBF, UTF-8 continuation bytes */
+   BC_HIGH,    /* 0xC0 - 0xFF */
+   BC_COUNT
+};
+
+/* parser states */
+enum {
+   ST_GROUND,
+   ST_ESCAPE,
+   ST_ESCAPE_INT,
+   ST_CSI_ENTRY,
+   ST_CSI_PARAM,
+   ST_CSI_INT,
+   ST_CSI_IGNORE,
+   ST_OSC,     /* OSC string, ends with BEL or ST */
+   ST_DCS,     /* DCS string, ends with ST */
+   ST_SOS,     /* SOS, PM or APC string, ends with ST */
+   ST_UTF8,    /* inside a UTF-8 sequence */
+   ST_COUNT
+};
+
+/* actions */
+enum {
+   AC_NONE,
+   AC_PRINT,
+   AC_EXECUTE,
+   AC_CLEAR,         /* start a new sequence */
+   AC_COLLECT,       /* private marker or intermediate */
+   AC_PARAM,         /* digit or separator */
+   AC_ESC_DISPATCH,
+   AC_CSI_DISPATCH,
+   AC_UTF8,          /* a byte of a UTF-8 sequence */
+   AC_UTF8_CUT       /* a byte that cuts a UTF-8 sequence short */
+};
+
+#define C BC_C0
+#define I BC_INT
+#define D BC_DIG
+#define F BC_FIN
+static const unsigned char byte_class[128] = {
+   C, C, C, C, C, C, C, BC_BEL, C, C, C, C, C, C, C, C,
+   C, C, C, C, C, C, C, C, BC_CAN, C, BC_CAN, BC_ESC, C, C, C, C,
+   I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+   D, D, D, D, D, D, D, D, D, D, BC_COL, BC_SEM,
+                                       BC_PRV, BC_PRV, BC_PRV, BC_PRV,
+   F, F, F, F, F, F, F, F, F, F, F, F, F, F, F, F,
+   BC_DCS, F, F, F, F, F, F, F, BC_STR, F, F, BC_CSI,
+                                       F, BC_OSC, BC_STR, BC_STR,
+   F, F, F, F, F, F, F, F, F, F, F, F, F, F, F, F,
+   F, F, F, F, F, F, F, F, F, F, F, F, F, F, F, BC_DEL
+};
+#undef C
+#undef I
+#undef D
+#undef F
+
+#define BYTE_CLASS(c) ((c) < 0x80 ? byte_class[c] : (c) < 0xC0 ? BC_CONT : BC_HIGH)
+
+/* an entry holds the action in the high nibble, the next state in the
+ * low one */
+#define T(action, state) ((AC_##action) << 4 | (ST_##state))
+#define ACTION(entry) ((entry) >> 4)
+#define NEXT_STATE(entry) ((entry) & 0x0F)
+
+/* rows are padded from BC_COUNT to a power of 2, for a cheap index */
+#define TRANSITION_ROW 32
+
+static const unsigned char transitions[ST_COUNT][TRANSITION_ROW] = {
+   /* ST_GROUND */ {
+      /* C0  */ T(EXECUTE, GROUND),       /* BEL */ T(EXECUTE, GROUND),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(PRINT, GROUND),         /* DIG */ T(PRINT, GROUND),
+      /* COL */ T(PRINT, GROUND),         /* SEM */ T(PRINT, GROUND),
+      /* PRV */ T(PRINT, GROUND),         /* FIN */ T(PRINT, GROUND),
+      /* CSI */ T(PRINT, GROUND),         /* OSC */ T(PRINT, GROUND),
+      /* DCS */ T(PRINT, GROUND),         /* STR */ T(PRINT, GROUND),
+      /* DEL */ T(PRINT, GROUND),         /* CONT */ T(UTF8, GROUND),
+      /* HIGH */ T(UTF8, GROUND) },
+   /* ST_ESCAPE */ {
+      /* C0  */ T(EXECUTE, ESCAPE),       /* BEL */ T(EXECUTE, ESCAPE),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(COLLECT, ESCAPE_INT),   /* DIG */ T(ESC_DISPATCH, GROUND),
+      /* COL */ T(ESC_DISPATCH, GROUND),  /* SEM */ T(ESC_DISPATCH, GROUND),
+      /* PRV */ T(ESC_DISPATCH, GROUND),  /* FIN */ T(ESC_DISPATCH, GROUND),
+      /* CSI */ T(CLEAR, CSI_ENTRY),      /* OSC */ T(NONE, OSC),
+      /* DCS */ T(NONE, DCS),             /* STR */ T(NONE, SOS),
+      /* DEL */ T(NONE, ESCAPE),          /* CONT */ T(NONE, ESCAPE),
+      /* HIGH */ T(NONE, ESCAPE) },
+   /* ST_ESCAPE_INT */ {
+      /* C0  */ T(EXECUTE, ESCAPE_INT),   /* BEL */ T(EXECUTE, ESCAPE_INT),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(COLLECT, ESCAPE_INT),   /* DIG */ T(ESC_DISPATCH, GROUND),
+      /* COL */ T(ESC_DISPATCH, GROUND),  /* SEM */ T(ESC_DISPATCH, GROUND),
+      /* PRV */ T(ESC_DISPATCH, GROUND),  /* FIN */ T(ESC_DISPATCH, GROUND),
+      /* CSI */ T(ESC_DISPATCH, GROUND),  /* OSC */ T(ESC_DISPATCH, GROUND),
+      /* DCS */ T(ESC_DISPATCH, GROUND),  /* STR */ T(ESC_DISPATCH, GROUND),
+      /* DEL */ T(NONE, ESCAPE_INT),      /* CONT */ T(NONE, ESCAPE_INT),
+      /* HIGH */ T(NONE, ESCAPE_INT) },
+   /* ST_CSI_ENTRY */ {
+      /* C0  */ T(EXECUTE, CSI_ENTRY),    /* BEL */ T(EXECUTE, CSI_ENTRY),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(COLLECT, CSI_INT),      /* DIG */ T(PARAM, CSI_PARAM),
+      /* COL */ T(NONE, CSI_IGNORE),      /* SEM */ T(PARAM, CSI_PARAM),
+      /* PRV */ T(COLLECT, CSI_PARAM),    /* FIN */ T(CSI_DISPATCH, GROUND),
+      /* CSI */ T(CSI_DISPATCH, GROUND),  /* OSC */ T(CSI_DISPATCH, GROUND),
+      /* DCS */ T(CSI_DISPATCH, GROUND),  /* STR */ T(CSI_DISPATCH, GROUND),
+      /* DEL */ T(NONE, CSI_ENTRY),       /* CONT */ T(NONE, CSI_IGNORE),
+      /* HIGH */ T(NONE, CSI_IGNORE) },
+   /* ST_CSI_PARAM */ {
+      /* C0  */ T(EXECUTE, CSI_PARAM),    /* BEL */ T(EXECUTE, CSI_PARAM),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(COLLECT, CSI_INT),      /* DIG */ T(PARAM, CSI_PARAM),
+      /* COL */ T(NONE, CSI_IGNORE),      /* SEM */ T(PARAM, CSI_PARAM),
+      /* PRV */ T(NONE, CSI_IGNORE),      /* FIN */ T(CSI_DISPATCH, GROUND),
+      /* CSI */ T(CSI_DISPATCH, GROUND),  /* OSC */ T(CSI_DISPATCH, GROUND),
+      /* DCS */ T(CSI_DISPATCH, GROUND),  /* STR */ T(CSI_DISPATCH, GROUND),
+      /* DEL */ T(NONE, CSI_PARAM),       /* CONT */ T(NONE, CSI_IGNORE),
+      /* HIGH */ T(NONE, CSI_IGNORE) },
+   /* ST_CSI_INT */ {
+      /* C0  */ T(EXECUTE, CSI_INT),      /* BEL */ T(EXECUTE, CSI_INT),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(COLLECT, CSI_INT),      /* DIG */ T(NONE, CSI_IGNORE),
+      /* COL */ T(NONE, CSI_IGNORE),      /* SEM */ T(NONE, CSI_IGNORE),
+      /* PRV */ T(NONE, CSI_IGNORE),      /* FIN */ T(CSI_DISPATCH, GROUND),
+      /* CSI */ T(CSI_DISPATCH, GROUND),  /* OSC */ T(CSI_DISPATCH, GROUND),
+      /* DCS */ T(CSI_DISPATCH, GROUND),  /* STR */ T(CSI_DISPATCH, GROUND),
+      /* DEL */ T(NONE, CSI_INT),         /* CONT */ T(NONE, CSI_IGNORE),
+      /* HIGH */ T(NONE, CSI_IGNORE) },
+   /* ST_CSI_IGNORE */ {
+      /* C0  */ T(EXECUTE, CSI_IGNORE),   /* BEL */ T(EXECUTE, CSI_IGNORE),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(NONE, CSI_IGNORE),      /* DIG */ T(NONE, CSI_IGNORE),
+      /* COL */ T(NONE, CSI_IGNORE),      /* SEM */ T(NONE, CSI_IGNORE),
+      /* PRV */ T(NONE, CSI_IGNORE),      /* FIN */ T(NONE, GROUND),
+      /* CSI */ T(NONE, GROUND),          /* OSC */ T(NONE, GROUND),
+      /* DCS */ T(NONE, GROUND),          /* STR */ T(NONE, GROUND),
+      /* DEL */ T(NONE, CSI_IGNORE),      /* CONT */ T(NONE, CSI_IGNORE),
+      /* HIGH */ T(NONE, CSI_IGNORE) },
+   /* ST_OSC: the string is dropped */ {
+      /* C0  */ T(NONE, OSC),             /* BEL */ T(NONE, GROUND),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(NONE, OSC),             /* DIG */ T(NONE, OSC),
+      /* COL */ T(NONE, OSC),             /* SEM */ T(NONE, OSC),
+      /* PRV */ T(NONE, OSC),             /* FIN */ T(NONE, OSC),
+      /* CSI */ T(NONE, OSC),             /* OSC */ T(NONE, OSC),
+      /* DCS */ T(NONE, OSC),             /* STR */ T(NONE, OSC),
+      /* DEL */ T(NONE, OSC),             /* CONT */ T(NONE, OSC),
+      /* HIGH */ T(NONE, OSC) },
+   /* ST_DCS: the string is dropped */ {
+      /* C0  */ T(NONE, DCS),             /* BEL */ T(NONE, DCS),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(NONE, DCS),             /* DIG */ T(NONE, DCS),
+      /* COL */ T(NONE, DCS),             /* SEM */ T(NONE, DCS),
+      /* PRV */ T(NONE, DCS),             /* FIN */ T(NONE, DCS),
+      /* CSI */ T(NONE, DCS),             /* OSC */ T(NONE, DCS),
+      /* DCS */ T(NONE, DCS),             /* STR */ T(NONE, DCS),
+      /* DEL */ T(NONE, DCS),             /* CONT */ T(NONE, DCS),
+      /* HIGH */ T(NONE, DCS) },
+   /* ST_SOS: the string is dropped */ {
+      /* C0  */ T(NONE, SOS),             /* BEL */ T(NONE, SOS),
+      /* CAN */ T(NONE, GROUND),          /* ESC */ T(CLEAR, ESCAPE),
+      /* INT */ T(NONE, SOS),             /* DIG */ T(NONE, SOS),
+      /* COL */ T(NONE, SOS),             /* SEM */ T(NONE, SOS),
+      /* PRV */ T(NONE, SOS),             /* FIN */ T(NONE, SOS),
+      /* CSI */ T(NONE, SOS),             /* OSC */ T(NONE, SOS),
+      /* DCS */ T(NONE, SOS),             /* STR */ T(NONE, SOS),
+      /* DEL */ T(NONE, SOS),             /* CONT */ T(NONE, SOS),
+      /* HIGH */ T(NONE, SOS) },
+   /* ST_UTF8: the sequence is replaced, then the byte parsed in ground */ {
+      /* C0  */ T(UTF8_CUT, GROUND),      /* BEL */ T(UTF8_CUT, GROUND),
+      /* CAN */ T(UTF8_CUT, GROUND),      /* ESC */ T(UTF8_CUT, GROUND),
+      /* INT */ T(UTF8_CUT, GROUND),      /* DIG */ T(UTF8_CUT, GROUND),
+      /* COL */ T(UTF8_CUT, GROUND),      /* SEM */ T(UTF8_CUT, GROUND),
+      /* PRV */ T(UTF8_CUT, GROUND),      /* FIN */ T(UTF8_CUT, GROUND),
+      /* CSI */ T(UTF8_CUT, GROUND),      /* OSC */ T(UTF8_CUT, GROUND),
+      /* DCS */ T(UTF8_CUT, GROUND),      /* STR */ T(UTF8_CUT, GROUND),
+      /* DEL */ T(UTF8_CUT, GROUND),      /* CONT */ T(UTF8, UTF8),
+      /* HIGH */ T(UTF8_CUT, GROUND) }
+};
+#undef T
+
+/* Decodes the UTF-8 sequences of the bytes from 0x80 up, the parser being
+ * in ST_UTF8 until a sequence is complete. Whatever isn't well-formed
+ * UTF-8, overlong forms and surrogates included, is shown as U+FFFD. */
+static void put_utf8_byte(RoteTerm *rt, unsigned char c) {
+   RoteTermPrivate *pd = rt->pd;
+   unsigned int cp;
+
+   if (pd->state == ST_UTF8) {
+      /* c is a continuation byte, the others cut the sequence short */
+      pd->utf8_cp = pd->utf8_cp << 6 | (c & 0x3F);
+      if (--pd->utf8_left) return;
+
+      pd->state = ST_GROUND;
+      cp = pd->utf8_cp;
+      if (cp < pd->utf8_min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+         cp = 0xFFFD;
+      put_codepoint(rt, cp);
+      return;
+   }
+
+   if (c >= 0xC2 && c <= 0xDF)
+      pd->utf8_cp = c & 0x1F, pd->utf8_left = 1, pd->utf8_min = 0x80;
+   else if (c >= 0xE0 && c <= 0xEF)
+      pd->utf8_cp = c & 0x0F, pd->utf8_left = 2, pd->utf8_min = 0x800;
+   else if (c >= 0xF0 && c <= 0xF4)
+      pd->utf8_cp = c & 0x07, pd->utf8_left = 3, pd->utf8_min = 0x10000;
+   else {
+      put_codepoint(rt, 0xFFFD);  /* stray continuation byte, or invalid */
+      return;
+   }
+   pd->state = ST_UTF8;
 }
 
 static void handle_control_char(RoteTerm *rt, char c) {
@@ -128,10 +464,8 @@ static void handle_control_char(RoteTerm *rt, char c) {
          rt->curpos_dirty = true;
          break;
       case '\t': /* tab */
-         while (rt->ccol % 8) put_normal_char(rt, ' ');
-         break;
-      case '\x1B': /* begin escape sequence (aborting previous one if any) */
-         new_escape_sequence(rt);
+         while (rt->ccol % 8 && rt->ccol < rt->cols - 1)
+            put_normal_char(rt, ' ');
          break;
       case '\x0E': /* enter graphical character mode */
          rt->pd->graphmode = true;
@@ -139,13 +473,6 @@ static void handle_control_char(RoteTerm *rt, char c) {
       case '\x0F': /* exit graphical character mode */
          rt->pd->graphmode = false;
          break;
-      case '\x9B': /* CSI character. Equivalent to ESC [ */
-         new_escape_sequence(rt);
-         rt->pd->esbuf[rt->pd->esbuf_len++] = '[';
-         break;
-      case '\x18': case '\x1A': /* these interrupt escape sequences */
-         cancel_escape_sequence(rt);
-         break;
       case '\a': /* bell */
          /* do nothing for now... maybe a visual bell would be nice? */
          break;
@@ -157,110 +484,143 @@ static void handle_control_char(RoteTerm *rt, char c) {
    }
 }
 
-static inline bool is_valid_csi_ender(char c) {
-   return (c >= 'a' && c <= 'z') ||
-          (c >= 'A' && c <= 'Z') ||
-          c == '@' || c == '`';
+static inline void clear_sequence(RoteTerm *rt) {
+   rt->pd->csiparam_count = 0;
+   rt->pd->csiprivate = 0;
+   rt->pd->intermediate = 0;
 }
 
-static void try_interpret_escape_seq(RoteTerm *rt) {
-   char firstchar = rt->pd->esbuf[0];
-   char lastchar  = rt->pd->esbuf[rt->pd->esbuf_len-1];
-
-   if (!firstchar) return;  /* too early to do anything */
-
-   if (rt->pd->handler) {
-      /* call custom handler */
-      #ifdef DEBUG
-      fprintf(stderr, "Calling custom handler for ES <%s>.\n", rt->pd->esbuf);
-      #endif
+static inline void collect(RoteTerm *rt, char c) {
+   if (c >= 0x3C) rt->pd->csiprivate = c;
+   else if (!rt->pd->intermediate) rt->pd->intermediate = c;
+}
 
-      int answer = (*(rt->pd->handler))(rt, rt->pd->esbuf);
-      if (answer == ROTE_HANDLERESULT_OK) {
-         /* successfully handled */
-         #ifdef DEBUG
-         fprintf(stderr, "Handler returned OK. Done with escape sequence.\n");
-         #endif
+static inline void param(RoteTerm *rt, char c) {
+   RoteTermPrivate *pd = rt->pd;
+   int *p;
 
-         cancel_escape_sequence(rt);
-         return;
-      }
-      else if (answer == ROTE_HANDLERESULT_NOTYET) {
-         /* handler might handle it when more characters are appended to 
-          * it. So for now we don't interpret it */
-         #ifdef DEBUG
-         fprintf(stderr, "Handler returned NOTYET. Waiting for more chars.\n");
-         #endif
-
-         return;
-      }
-   
-      /* If we got here then answer == ROTE_HANDLERESULT_NOWAY */
-      /* handler said it can't handle that escape sequence,
-       * but we can still try handling it ourselves, so 
-       * we proceed normally. */
-      #ifdef DEBUG
-      fprintf(stderr, "Handler returned NOWAY. Trying our handlers.\n");
-      #endif
+   if (pd->csiparam_count == 0) pd->csiparam[pd->csiparam_count++] = 0;
+   if (c == ';') {
+      if (pd->csiparam_count <= MAX_CSI_ES_PARAMS) pd->csiparam_count++;
+      pd->csiparam[pd->csiparam_count - 1] = 0;
+      return;
    }
 
+   /* large enough for any sensible parameter, yet never overflows */
+   p = &pd->csiparam[pd->csiparam_count - 1];
+   if (*p < 100000) *p = *p * 10 + (c - '0');
+}
+
+static void esc_dispatch(RoteTerm *rt, char c) {
    /* interpret ESC-M as reverse line-feed */
-   if (firstchar == 'M') {
+   if (c == 'M' && !rt->pd->intermediate) {
       cursor_line_up(rt);
-      cancel_escape_sequence(rt);
       return;
    }
 
-   if (firstchar != '[' && firstchar != ']') {
-      /* unrecognized escape sequence. Let's forget about it. */
-      #ifdef DEBUG
-      fprintf(stderr, "Unrecognized ES: <%s>\n", rt->pd->esbuf);
-      #endif
+   #ifdef DEBUG
+   fprintf(stderr, "Unrecognized ES: <%c%c>\n",
+                   rt->pd->intermediate ? rt->pd->intermediate : ' ', c);
+   #endif
+}
 
-      cancel_escape_sequence(rt);
-      return;
+static inline void parse_byte(RoteTerm *rt, unsigned char c) {
+   unsigned char entry = transitions[rt->pd->state][BYTE_CLASS(c)];
+   rt->pd->state = NEXT_STATE(entry);
+
+   switch (ACTION(entry)) {
+      case AC_NONE:
+         break;
+      case AC_PRINT:
+         if (rt->pd->graphmode) put_graphmode_char(rt, c);
+         else                   put_normal_char(rt, c);
+         break;
+      case AC_EXECUTE:
+         handle_control_char(rt, c);
+         break;
+      case AC_CLEAR:
+         clear_sequence(rt);
+         if (c == 0x1B && rt->pd->handler) {
+            /* the custom handler gets to see the sequence first */
+            rt->pd->handler_seq = true;
+            rt->pd->esbuf_len = 0;
+            rt->pd->esbuf[0] = '\0';
+         }
+         break;
+      case AC_COLLECT:
+         collect(rt, c);
+         break;
+      case AC_PARAM:
+         param(rt, c);
+         break;
+      case AC_ESC_DISPATCH:
+         esc_dispatch(rt, c);
+         break;
+      case AC_CSI_DISPATCH:
+         rote_es_interpret_csi(rt, c);
+         break;
+      case AC_UTF8:
+         put_utf8_byte(rt, c);
+         break;
+      case AC_UTF8_CUT:
+         put_codepoint(rt, 0xFFFD);
+         parse_byte(rt, c);
+         break;
    }
+}
 
-   if (firstchar == '[' && is_valid_csi_ender(lastchar)) {
-      /* we have a csi escape sequence: interpret it */
-      rote_es_interpret_csi(rt);
-      cancel_escape_sequence(rt);
+/* While a custom handler is installed, the bytes of each escape sequence
+ * are gathered in esbuf and offered to it as they come, as documented in
+ * rote.h. If it can't handle the sequence, they are parsed as usual. */
+static void handler_byte(RoteTerm *rt, char c) {
+   RoteTermPrivate *pd = rt->pd;
+   int answer, i;
+
+   if (c == '\x18' || c == '\x1A' || c == '\x1B') {
+      /* abort or restart the sequence */
+      pd->handler_seq = false;
+      parse_byte(rt, c);
+      return;
+   }
+   if (c >= 0 && c <= 31) {
+      handle_control_char(rt, c);
+      return;
    }
-   else if (firstchar == ']' && lastchar == '\a') {
-      /* we have an xterm escape sequence: interpret it */
 
-      /* rote_es_interpret_xterm_es(rt);     -- TODO!*/
-      #ifdef DEBUG
-      fprintf(stderr, "Ignored XTerm ES.\n");
-      #endif
-      cancel_escape_sequence(rt);
+   pd->esbuf[pd->esbuf_len] = c;
+   pd->esbuf[++pd->esbuf_len] = 0;
+
+   answer = (*pd->handler)(rt, pd->esbuf);
+   if (answer == ROTE_HANDLERESULT_OK) {
+      pd->handler_seq = false;
+      pd->state = ST_GROUND;
+      return;
    }
+   if (answer == ROTE_HANDLERESULT_NOTYET && pd->esbuf_len < ESEQ_BUF_SIZE - 1)
+      return;
 
-   /* if the escape sequence took up all available space and could
-    * not yet be parsed, abort it */
-   if (rt->pd->esbuf_len + 1 >= ESEQ_BUF_SIZE) cancel_escape_sequence(rt);
+   /* the handler gave up on it, or it doesn't fit in esbuf anymore */
+   pd->handler_seq = false;
+   for (i = 0; i < pd->esbuf_len; i++) parse_byte(rt, pd->esbuf[i]);
 }
-   
+
 void rote_vt_inject(RoteTerm *rt, const char *data, int len) {
-   int i;
+   int i, run;
    for (i = 0; i < len; i++, data++) {
-      if (*data == 0) continue;  /* completely ignore NUL */
-      if (*data >= 1 && *data <= 31) {
-         handle_control_char(rt, *data);
-         continue;
+      if (rt->pd->state == ST_GROUND && !rt->pd->graphmode &&
+          (unsigned char) *data > 31) {
+         /* plain text, the bulk of most output: copy the whole run of
+          * printable ASCII up to the next control char or UTF-8 */
+         run = rote_vt_scan_printable(data, len - i);
+         if (run > 0) {
+            put_normal_run(rt, data, run);
+            i += run - 1;
+            data += run - 1;
+            continue;
+         }
       }
 
-      if (rt->pd->escaped && rt->pd->esbuf_len < ESEQ_BUF_SIZE) {
-         /* append character to ongoing escape sequence */
-         rt->pd->esbuf[rt->pd->esbuf_len] = *data;
-         rt->pd->esbuf[++rt->pd->esbuf_len] = 0;
-
-         try_interpret_escape_seq(rt);
-      }
-      else if (rt->pd->graphmode)
-         put_graphmode_char(rt, *data);
-      else
-         put_normal_char(rt, *data);
+      if (rt->pd->handler_seq) handler_byte(rt, *data);
+      else                     parse_byte(rt, (unsigned char) *data);
    }
 }
-
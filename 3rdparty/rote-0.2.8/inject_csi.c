@@ -24,7 +24,6 @@ Copyright (c) 2004 Bruno T. C. de Oliveira
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_CSI_ES_PARAMS 32
    
 static inline void clamp_cursor_to_bounds(RoteTerm *rt) {
    if (rt->crow < 0) rt->curpos_dirty = true, rt->crow = 0;
@@ -37,13 +36,59 @@ static inline void clamp_cursor_to_bounds(RoteTerm *rt) {
       rt->curpos_dirty = true, rt->ccol = rt->cols - 1;
 }
 
+/* Sets the foreground, or the background, to an extended color. The 8
+ * basic ones stay in the attribute alone. */
+static void set_color(RoteTerm *rt, bool fg, unsigned int color) {
+   int basic = rote_color_basic(color);
+   if (!ROTE_COLOR_IS_RGB(color) && ROTE_COLOR_INDEX(color) < 8) color = 0;
+
+   if (fg) {
+      ROTE_ATTR_MOD_FG(rt->curattr, basic);
+      rt->pd->curfg = color;
+   }
+   else {
+      ROTE_ATTR_MOD_BG(rt->curattr, basic);
+      rt->pd->curbg = color;
+   }
+}
+
+/* Reads the color that follows parameter i, a 38 or a 48, either 5;n or
+ * 2;r;g;b. Returns the number of parameters it took, and sets *color to
+ * 0 if they didn't make a color. */
+static int read_color(int param[], int pcount, int i, unsigned int *color) {
+   int k;
+   *color = 0;
+   if (i + 1 >= pcount) return 0;
+
+   if (param[i + 1] == 5) {
+      if (i + 2 >= pcount) return 1;
+      if (param[i + 2] <= 255) *color = ROTE_COLOR_INDEXED(param[i + 2]);
+      return 2;
+   }
+   if (param[i + 1] == 2) {
+      if (i + 4 >= pcount) return pcount - 1 - i;
+      for (k = 2; k <= 4; k++) if (param[i + k] > 255) return 4;
+      *color = ROTE_COLOR_RGB(param[i + 2], param[i + 3], param[i + 4]);
+      return 4;
+   }
+   return 1;
+}
+
+/* resets the attribute and its extended colors */
+static inline void reset_attr(RoteTerm *rt, unsigned char attr) {
+   rt->curattr = attr;
+   rt->pd->curfg = rt->pd->curbg = 0;
+}
+
 /* interprets a 'set attribute' (SGR) CSI escape sequence */
 static void interpret_csi_SGR(RoteTerm *rt, int param[], int pcount) {
    int i;
+   unsigned int color;
 
    if (pcount == 0) {
       /* special case: reset attributes */
-      rt->curattr = 0x70;
+      reset_attr(rt, 0x70);
+      rt->pd->curxattr = 0;
       return;
    }
 
@@ -69,8 +114,10 @@ static void interpret_csi_SGR(RoteTerm *rt, int param[], int pcount) {
 // 25 	Blinking off
 // 27 	Negative image off
 // 28 	Invisible image off
+// and from xterm, 38;5;n and 48;5;n for the 256 color palette, 38;2;r;g;b
+// and 48;2;r;g;b for direct colors, 90-97 and 100-107 for bright colors
 
-      if (param[i] == 0) rt->curattr = 0x70;
+      if (param[i] == 0) reset_attr(rt, 0x70);
       else if (param[i] == 1 || param[i] == 2 || param[i] == 4)  /* set bold */
          ROTE_ATTR_MOD_BOLD(rt->curattr,1);
       else if (param[i] == 5)  /* set blink */
@@ -80,23 +127,46 @@ static void interpret_csi_SGR(RoteTerm *rt, int param[], int pcount) {
 	int bg = ROTE_ATTR_BG(rt->curattr);
 	ROTE_ATTR_MOD_FG(rt->curattr, bg);
 	ROTE_ATTR_MOD_BG(rt->curattr, fg);
+	color = rt->pd->curfg;
+	rt->pd->curfg = rt->pd->curbg;
+	rt->pd->curbg = color;
       }
-      else if (param[i] == 8) rt->curattr = 0x0;    /* invisible */
+      else if (param[i] == 8) reset_attr(rt, 0x0);    /* invisible */
       else if (param[i] == 22 || param[i] == 24) /* bold off */
         ROTE_ATTR_MOD_BOLD(rt->curattr,0);
       else if (param[i] == 25) /* blink off */
         ROTE_ATTR_MOD_BLINK(rt->curattr,0);
       else if (param[i] == 28) /* invisible off */
-        rt->curattr = 0x70;
-      else if (param[i] >= 30 && param[i] <= 37)    /* set fg */
+        reset_attr(rt, 0x70);
+      else if (param[i] >= 30 && param[i] <= 37) {  /* set fg */
          ROTE_ATTR_MOD_FG(rt->curattr, param[i] - 30);
-      else if (param[i] >= 40 && param[i] <= 47)    /* set bg */
+         rt->pd->curfg = 0;
+      }
+      else if (param[i] >= 40 && param[i] <= 47) {  /* set bg */
          ROTE_ATTR_MOD_BG(rt->curattr, param[i] - 40);
-      else if (param[i] == 39)  /* reset foreground to default */
+         rt->pd->curbg = 0;
+      }
+      else if (param[i] >= 90 && param[i] <= 97)    /* set bright fg */
+         set_color(rt, true, ROTE_COLOR_INDEXED(param[i] - 90 + 8));
+      else if (param[i] >= 100 && param[i] <= 107)  /* set bright bg */
+         set_color(rt, false, ROTE_COLOR_INDEXED(param[i] - 100 + 8));
+      else if (param[i] == 38 || param[i] == 48) {  /* set extended color */
+         int taken = read_color(param, pcount, i, &color);
+         if (color) set_color(rt, param[i] == 38, color);
+         i += taken;
+      }
+      else if (param[i] == 39) {  /* reset foreground to default */
          ROTE_ATTR_MOD_FG(rt->curattr, 7);
-      else if (param[i] == 49)  /* reset background to default */
+         rt->pd->curfg = 0;
+      }
+      else if (param[i] == 49) {  /* reset background to default */
          ROTE_ATTR_MOD_BG(rt->curattr, 0);
+         rt->pd->curbg = 0;
+      }
    }
+
+   if (rt->pd->curfg || rt->pd->curbg) rote_vt_update_xattr(rt);
+   else rt->pd->curxattr = 0;
 }
 
 /* interprets an 'erase display' (ED) escape sequence */
@@ -111,21 +181,17 @@ static void interpret_csi_ED(RoteTerm *rt, int param[], int pcount) {
 
    else if (pcount && param[0] == 1)
                       start_row = 0, start_col = 0, end_row = rt->crow,
-                      end_col = rt->ccol;
+                      end_col = rt->ccol < rt->cols ? rt->ccol : rt->cols - 1;
 
    else start_row = rt->crow, start_col = rt->ccol,
         end_row = rt->rows - 1, end_col = rt->cols - 1;
 
    /* clean range */
    for (r = start_row; r <= end_row; r++) {
-      rt->line_dirty[r] = true;
-
-      for (c = (r == start_row ? start_col : 0);
-                             c <= (r == end_row ? end_col : rt->cols - 1);
-                             c++) {
-         rt->cells[r][c].ch = 0x20;
-         rt->cells[r][c].attr = rt->curattr;
-      }
+      c = (r == start_row ? start_col : 0);
+      rote_vt_fill_cells(rt, &rt->lines[r], c,
+                         (r == end_row ? end_col : rt->cols - 1) - c + 1,
+                         rt->curattr, rt->pd->curxattr);
    }
 }
 
@@ -169,7 +235,7 @@ static void interpret_csi_C(RoteTerm *rt, char verb,
 
 /* Interpret the 'erase line' escape sequence */
 static void interpret_csi_EL(RoteTerm *rt, int param[], int pcount) {
-   int erase_start, erase_end, i;
+   int erase_start, erase_end;
    int cmd = pcount ? param[0] : 0;
 
    switch (cmd) {
@@ -178,87 +244,78 @@ static void interpret_csi_EL(RoteTerm *rt, int param[], int pcount) {
       default: erase_start = rt->ccol;    erase_end = rt->cols - 1; break;
    }
 
-   for (i = erase_start; i <= erase_end; i++) {
-      rt->cells[rt->crow][i].ch = 0x20; 
-      rt->cells[rt->crow][i].attr = rt->curattr;
-   }
-
-   rt->line_dirty[rt->crow] = true;
+   if (erase_end >= rt->cols) erase_end = rt->cols - 1;
+   rote_vt_fill_cells(rt, &rt->lines[rt->crow], erase_start,
+                      erase_end - erase_start + 1, rt->curattr,
+                      rt->pd->curxattr);
 }
 
 /* Interpret the 'insert blanks' sequence (ICH) */
 static void interpret_csi_ICH(RoteTerm *rt, int param[], int pcount) {
    int n = (pcount && param[0] > 0) ? param[0] : 1; 
-   int i;
-   for (i = rt->cols - 1; i >= rt->ccol + n; i--)
-      rt->cells[rt->crow][i] = rt->cells[rt->crow][i - n];
-   for (i = rt->ccol; i < rt->ccol + n; i++) {
-      rt->cells[rt->crow][i].ch = 0x20;
-      rt->cells[rt->crow][i].attr = rt->curattr;
-   }
-
-   rt->line_dirty[rt->crow] = true;
+   RoteRow *row = &rt->lines[rt->crow];
+   if (rt->ccol >= rt->cols) return;
+   if (n > rt->cols - rt->ccol) n = rt->cols - rt->ccol;
+
+   /* cells pushed off the end may take half a wide glyph with them */
+   rote_vt_split_wide(rt, row, rt->ccol, rt->cols - rt->ccol - n);
+   memmove(row->text + rt->ccol + n, row->text + rt->ccol, rt->cols - rt->ccol - n);
+   memmove(row->attr + rt->ccol + n, row->attr + rt->ccol, rt->cols - rt->ccol - n);
+   if (row->glyph)
+      memmove(row->glyph + rt->ccol + n, row->glyph + rt->ccol,
+              sizeof(unsigned short) * (rt->cols - rt->ccol - n));
+   if (row->xattr)
+      memmove(row->xattr + rt->ccol + n, row->xattr + rt->ccol,
+              sizeof(unsigned short) * (rt->cols - rt->ccol - n));
+   rote_vt_fill_cells(rt, row, rt->ccol, n, rt->curattr, rt->pd->curxattr);
+
+   rote_vt_damage(rt, rt->crow, rt->ccol, rt->cols - 1);
 }
 
 /* Interpret the 'delete chars' sequence (DCH) */
 static void interpret_csi_DCH(RoteTerm *rt, int param[], int pcount) {
    int n = (pcount && param[0] > 0) ? param[0] : 1; 
-   int i;
-   for (i = rt->ccol; i < rt->cols; i++) {
-     if (i + n < rt->cols)
-         rt->cells[rt->crow][i] = rt->cells[rt->crow][i + n];
-     else {
-         rt->cells[rt->crow][i].ch = 0x20;
-         rt->cells[rt->crow][i].attr = rt->curattr;
-     }
-   }
-
-   rt->line_dirty[rt->crow] = true;
+   RoteRow *row = &rt->lines[rt->crow];
+   if (rt->ccol >= rt->cols) return;
+   if (n > rt->cols - rt->ccol) n = rt->cols - rt->ccol;
+
+   rote_vt_split_wide(rt, row, rt->ccol, n);
+   memmove(row->text + rt->ccol, row->text + rt->ccol + n, rt->cols - rt->ccol - n);
+   memmove(row->attr + rt->ccol, row->attr + rt->ccol + n, rt->cols - rt->ccol - n);
+   if (row->glyph)
+      memmove(row->glyph + rt->ccol, row->glyph + rt->ccol + n,
+              sizeof(unsigned short) * (rt->cols - rt->ccol - n));
+   if (row->xattr)
+      memmove(row->xattr + rt->ccol, row->xattr + rt->ccol + n,
+              sizeof(unsigned short) * (rt->cols - rt->ccol - n));
+   rote_vt_fill_cells(rt, row, rt->cols - n, n, rt->curattr,
+                      rt->pd->curxattr);
+
+   rote_vt_damage(rt, rt->crow, rt->ccol, rt->cols - 1);
 }
 
 /* Interpret an 'insert line' sequence (IL) */
 static void interpret_csi_IL(RoteTerm *rt, int param[], int pcount) {
    int n = (pcount && param[0] > 0) ? param[0] : 1;
-   int i, j;
-
-   for (i = rt->pd->scrollbottom; i >= rt->crow + n; i--) 
-      memcpy(rt->cells[i], rt->cells[i - n], sizeof(RoteCell) * rt->cols);
-
-   for (i = rt->crow; i < rt->crow + n && i <= rt->pd->scrollbottom; i++) {
-      rt->line_dirty[i] = true;
-      for (j = 0; j < rt->cols; j++) 
-         rt->cells[i][j].ch = 0x20, rt->cells[i][j].attr = rt->curattr;
-   }
-
+   rote_vt_rotate_rows(rt, rt->crow, rt->pd->scrollbottom, -n, rt->curattr,
+                       rt->pd->curxattr);
 }
 
 /* Interpret a 'delete line' sequence (DL) */
 static void interpret_csi_DL(RoteTerm *rt, int param[], int pcount) {
    int n = (pcount && param[0] > 0) ? param[0] : 1;
-   int i, j;
-
-   for (i = rt->crow; i <= rt->pd->scrollbottom; i++) {
-      rt->line_dirty[i] = true;
-      if (i + n <= rt->pd->scrollbottom)
-         memcpy(rt->cells[i], rt->cells[i+n], sizeof(RoteCell) * rt->cols);
-      else {
-         for (j = 0; j < rt->cols; j++)
-            rt->cells[i][j].ch = 0x20, rt->cells[i][j].attr = rt->curattr;
-      }
-   }
+   rote_vt_rotate_rows(rt, rt->crow, rt->pd->scrollbottom, n, rt->curattr,
+                       rt->pd->curxattr);
 }
 
 /* Interpret an 'erase characters' (ECH) sequence */
 static void interpret_csi_ECH(RoteTerm *rt, int param[], int pcount) {
    int n = (pcount && param[0] > 0) ? param[0] : 1;
-   int i;
-
-   for (i = rt->ccol; i < rt->ccol + n && i < rt->cols; i++) {
-      rt->cells[rt->crow][i].ch = 0x20;
-      rt->cells[rt->crow][i].attr = rt->curattr;
-   }
 
-   rt->line_dirty[rt->crow] = true;
+   if (rt->ccol >= rt->cols) return;
+   if (n > rt->cols - rt->ccol) n = rt->cols - rt->ccol;
+   rote_vt_fill_cells(rt, &rt->lines[rt->crow], rt->ccol, n, rt->curattr,
+                      rt->pd->curxattr);
 }
         
 /* Interpret a 'set scrolling region' (DECSTBM) sequence */
@@ -298,32 +355,56 @@ static void interpret_csi_RESTORECUR(RoteTerm *rt, int param[], int pcount) {
    rt->curpos_dirty = true;
 }
 
-void rote_es_interpret_csi(RoteTerm *rt) {
-   static int csiparam[MAX_CSI_ES_PARAMS];
-   int param_count = 0;
-   const char *p = rt->pd->esbuf + 1;
-   char verb = rt->pd->esbuf[rt->pd->esbuf_len - 1];
+/* interprets a 'set private mode' (DECSET) or 'reset private mode' (DECRST)
+ * escape sequence; only the alternate screen modes are supported */
+static void interpret_csi_DECSET(RoteTerm *rt, int param[], int pcount,
+                                 bool set) {
+   static int clear_all[] = { 2 };
+   int i;
 
-   if (!strncmp(rt->pd->esbuf, "[?", 2)) { /* private-mode CSI, ignore */
-      #ifdef DEBUG
-      fprintf(stderr, "Ignoring private-mode CSI: <%s>\n", rt->pd->esbuf);
-      #endif
-      return; 
+   for (i = 0; i < pcount; i++) {
+      switch (param[i]) {
+         case 1049: /* alternate screen, cleared, and the cursor saved */
+            if (set) {
+               interpret_csi_SAVECUR(rt, param, pcount);
+               if (rote_vt_set_alt_screen(rt, true))
+                  interpret_csi_ED(rt, clear_all, 1);
+            }
+            else {
+               rote_vt_set_alt_screen(rt, false);
+               interpret_csi_RESTORECUR(rt, param, pcount);
+            }
+            break;
+         case 1047: /* alternate screen, cleared on leaving */
+            if (!set && rt->pd->altscreen) interpret_csi_ED(rt, clear_all, 1);
+            rote_vt_set_alt_screen(rt, set);
+            break;
+         case 47: /* alternate screen */
+            rote_vt_set_alt_screen(rt, set);
+            break;
+      }
    }
+}
 
-   /* parse numeric parameters */
-   while ((*p >= '0' && *p <= '9') || *p == ';') {
-      if (*p == ';') {
-         if (param_count >= MAX_CSI_ES_PARAMS) return; /* too long! */
-         csiparam[param_count++] = 0;
-      }
-      else {
-         if (param_count == 0) csiparam[param_count++] = 0;
-         csiparam[param_count - 1] *= 10;
-         csiparam[param_count - 1] += *p - '0';
-      }
+void rote_es_interpret_csi(RoteTerm *rt, char verb) {
+   int *csiparam = rt->pd->csiparam;
+   int param_count = rt->pd->csiparam_count;
+
+   if (param_count > MAX_CSI_ES_PARAMS) param_count = MAX_CSI_ES_PARAMS;
 
-      p++;
+   if (rt->pd->csiprivate == '?' && !rt->pd->intermediate &&
+       (verb == 'h' || verb == 'l')) {
+      interpret_csi_DECSET(rt, csiparam, param_count, verb == 'h');
+      return;
+   }
+
+   if (rt->pd->csiprivate || rt->pd->intermediate) {
+      /* private-mode or extended CSI, ignore */
+      #ifdef DEBUG
+      fprintf(stderr, "Ignoring CSI <%c...%c%c>\n", rt->pd->csiprivate,
+                      rt->pd->intermediate, verb);
+      #endif
+      return; 
    }
 
    /* delegate handling depending on command character (verb) */
@@ -358,7 +439,7 @@ void rote_es_interpret_csi(RoteTerm *rt) {
          interpret_csi_RESTORECUR(rt, csiparam, param_count); break;
       #ifdef DEBUG
       default:
-         fprintf(stderr, "Unrecogized CSI: <%s>\n", rt->pd->esbuf); break;
+         fprintf(stderr, "Unrecogized CSI: <%c>\n", verb); break;
       #endif
    }
 }
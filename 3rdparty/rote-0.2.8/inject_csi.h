@@ -24,11 +24,11 @@ Copyright (c) 2004 Bruno T. C. de Oliveira
 
 #include "rote.h"
 
-/* Interprets a CSI escape sequence stored in rt->pd->esbuf,
- * changing rt to reflect the effect of the sequence. This function
- * will not change rt->pd->esbuf, rt->pd->escaped or other escape-sequence
- * related fields in it */
-void rote_es_interpret_csi(RoteTerm *rt);
+/* Interprets the CSI escape sequence ending with verb, whose parameters
+ * and markers the parser gathered in rt->pd, changing rt to reflect the
+ * effect of the sequence. This function will not change the parser's
+ * state or other escape-sequence related fields in rt->pd */
+void rote_es_interpret_csi(RoteTerm *rt, char verb);
 
 #endif
 
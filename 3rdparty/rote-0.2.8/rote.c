@@ -29,12 +29,76 @@ Copyright (c) 2004 Bruno T. C. de Oliveira
 #endif
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <signal.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* bytes consumed by a single rote_vt_update() call */
+#define ROTE_VT_UPDATE_BUDGET 16384
+
+/* size of the largest single read() from the pty */
+#define ROTE_VT_READ_CHUNK 16384
+
+/* Allocates the text and attribute planes of a blank rows x cols screen,
+ * and its rows in the middle of rowbuf so they can slide both ways; the
+ * glyph and xattr planes are left to their first use */
+static bool alloc_screen(RoteScreen *scr, int rows, int cols) {
+   RoteRow *lines;
+   int i;
+
+   memset(scr, 0, sizeof(RoteScreen));
+   scr->textbuf = (char*) malloc(rows * cols);
+   scr->attrbuf = (unsigned char*) malloc(rows * cols);
+   scr->rowbuf = (RoteRow*) malloc(sizeof(RoteRow) * rows * 3);
+   if (!scr->textbuf || !scr->attrbuf || !scr->rowbuf) {
+      free(scr->textbuf);
+      free(scr->attrbuf);
+      free(scr->rowbuf);
+      memset(scr, 0, sizeof(RoteScreen));
+      return false;
+   }
+
+   scr->rowoff = rows;
+   lines = scr->rowbuf + scr->rowoff;
+   for (i = 0; i < rows; i++) {
+      lines[i].text = scr->textbuf + i * cols;
+      lines[i].attr = scr->attrbuf + i * cols;
+      lines[i].glyph = NULL;
+      lines[i].xattr = NULL;
+      lines[i].snap = NULL;
+   }
+
+   /* fill with spaces, white text over black background */
+   memset(scr->textbuf, 0x20, rows * cols);
+   memset(scr->attrbuf, 0x70, rows * cols);
+   return true;
+}
 
-#define ROTE_VT_UPDATE_ITERATIONS 5
+/* Frees a screen of the given number of rows */
+static void free_screen(RoteScreen *scr, int rows) {
+   int i;
+   if (scr->rowbuf)
+      for (i = 0; i < rows; i++)
+         if (scr->rowbuf[scr->rowoff + i].snap)
+            rote_vt_drop_snap_row(&scr->rowbuf[scr->rowoff + i]);
+   free(scr->textbuf);
+   free(scr->attrbuf);
+   free(scr->rowbuf);
+   free(scr->glyphbuf);
+   free(scr->xattrbuf);
+   memset(scr, 0, sizeof(RoteScreen));
+}
 
 RoteTerm *rote_vt_create(int rows, int cols) {
    RoteTerm *rt;
-   int i, j;
+   int i;
 
    if (rows <= 0 || cols <= 0) return NULL;
 
@@ -45,21 +109,14 @@ RoteTerm *rote_vt_create(int rows, int cols) {
    rt->rows = rows;
    rt->cols = cols;
 
-   /* create the cell matrix */
-   rt->cells = (RoteCell**) malloc(sizeof(RoteCell*) * rt->rows);
+   /* allocate dirtiness arrays, the whole screen is to be drawn */
+   rt->line_dirty = (bool*) malloc(sizeof(bool) * rt->rows);
+   rt->line_damage = (RoteSpan*) malloc(sizeof(RoteSpan) * rt->rows);
    for (i = 0; i < rt->rows; i++) {
-      /* create row */
-      rt->cells[i] = (RoteCell*) malloc(sizeof(RoteCell) * rt->cols);
-
-      /* fill row with spaces */
-      for (j = 0; j < rt->cols; j++) {
-         rt->cells[i][j].ch = 0x20;    /* a space */
-         rt->cells[i][j].attr = 0x70;  /* white text, black background */
-      }
+      rt->line_dirty[i] = true;
+      rt->line_damage[i].first = 0;
+      rt->line_damage[i].last = cols - 1;
    }
-   
-   /* allocate dirtiness array */
-   rt->line_dirty = (bool*) malloc(sizeof(bool) * rt->rows);
 
    /* initialization of other public fields */
    rt->crow = rt->ccol = 0;
@@ -71,6 +128,12 @@ RoteTerm *rote_vt_create(int rows, int cols) {
 
    rt->pd->pty = -1;  /* no pty for now */
 
+   /* create the primary screen: one block of text and one of attributes
+    * the rows point into; the alternate screen waits for its first use */
+   alloc_screen(&rt->pd->screen, rt->rows, rt->cols);
+   rt->pd->rowtmp = (RoteRow*) malloc(sizeof(RoteRow) * rt->rows);
+   rt->lines = rt->pd->screen.rowbuf + rt->pd->screen.rowoff;
+
    /* initial scrolling area is the whole window */
    rt->pd->scrolltop = 0;
    rt->pd->scrollbottom = rt->rows - 1;
@@ -83,16 +146,294 @@ RoteTerm *rote_vt_create(int rows, int cols) {
 }
 
 void rote_vt_destroy(RoteTerm *rt) {
-   int i;
    if (!rt) return;
 
+   free(rt->pd->outbuf);
+   free_screen(&rt->pd->screen, rt->rows);
+   free_screen(&rt->pd->other, rt->rows);
+   free(rt->pd->rowtmp);
+   rote_vt_free_glyphs(rt);
+   rote_vt_free_xattrs(rt);
    free(rt->pd);
    free(rt->line_dirty);
-   for (i = 0; i < rt->rows; i++) free(rt->cells[i]);
-   free(rt->cells);
+   free(rt->line_damage);
    free(rt);
 }
 
+bool rote_vt_set_alt_screen(RoteTerm *rt, bool alt) {
+   RoteTermPrivate *pd = rt->pd;
+   RoteScreen shown;
+   int i;
+
+   if (alt == pd->altscreen) return true;
+   if (alt && !pd->other.textbuf &&
+       !alloc_screen(&pd->other, rt->rows, rt->cols))
+      return false;
+
+   shown = pd->screen;
+   pd->screen = pd->other;
+   pd->other = shown;
+   pd->altscreen = alt;
+   rt->lines = pd->screen.rowbuf + pd->screen.rowoff;
+
+   for (i = 0; i < rt->rows; i++) rote_vt_redraw(rt, i, 0, rt->cols - 1);
+   rt->curpos_dirty = true;
+
+   /* the current extended colors need the xattr plane of this screen too */
+   if (pd->curxattr) rote_vt_update_xattr(rt);
+   return true;
+}
+
+static inline void fill_xattr(RoteRow *row, int col, int n,
+                              unsigned short xattr) {
+   unsigned short *p = row->xattr + col;
+   while (n--) *p++ = xattr;
+}
+
+void rote_vt_fill_cells(RoteTerm *rt, RoteRow *row, int col, int n,
+                        unsigned char attr, unsigned short xattr) {
+   if (n <= 0) return;
+   rote_vt_damage(rt, row - rt->lines, col, col + n - 1);
+   if (row->glyph) rote_vt_split_wide(rt, row, col, n);
+   memset(row->text + col, 0x20, n);
+   memset(row->attr + col, attr, n);
+   if (row->xattr) fill_xattr(row, col, n, xattr);
+}
+
+/* Handles 32 (AVX2) or 16 (SSE2) bytes at a time, and finishes the rest,
+ * or everything on other targets, a byte at a time */
+int rote_vt_scan_printable(const char *data, int len) {
+   int i = 0;
+#if defined(__AVX2__)
+   /* as signed bytes, the printable ones are exactly those above 31 */
+   __m256i limit = _mm256_set1_epi8(31);
+   for (; i + 32 <= len; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+      unsigned mask = ~(unsigned) _mm256_movemask_epi8(
+                                     _mm256_cmpgt_epi8(v, limit));
+      if (mask) return i + __builtin_ctz(mask);
+   }
+#elif defined(__SSE2__)
+   __m128i limit = _mm_set1_epi8(31);
+   for (; i + 16 <= len; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+      unsigned mask = ~(unsigned) _mm_movemask_epi8(
+                                     _mm_cmpgt_epi8(v, limit)) & 0xFFFF;
+      if (mask) return i + __builtin_ctz(mask);
+   }
+#endif
+   for (; i < len; i++)
+      if ((unsigned char) data[i] <= 31 || (unsigned char) data[i] >= 0x80)
+         break;
+   return i;
+}
+
+void rote_vt_store_cells(RoteTerm *rt, RoteRow *row, int col,
+                         const char *data, int n, unsigned char attr,
+                         unsigned short xattr) {
+   rote_vt_damage(rt, row - rt->lines, col, col + n - 1);
+   if (row->glyph) rote_vt_split_wide(rt, row, col, n);
+   memcpy(row->text + col, data, n);
+   memset(row->attr + col, attr, n);
+   if (row->xattr) fill_xattr(row, col, n, xattr);
+}
+
+/* Re-centers the window of rows in rowbuf, once it reached an end */
+static void recenter_rows(RoteTerm *rt) {
+   RoteTermPrivate *pd = rt->pd;
+   memmove(pd->screen.rowbuf + rt->rows, rt->lines, sizeof(RoteRow) * rt->rows);
+   pd->screen.rowoff = rt->rows;
+   rt->lines = pd->screen.rowbuf + pd->screen.rowoff;
+}
+
+void rote_vt_rotate_rows(RoteTerm *rt, int top, int bottom, int n,
+                         unsigned char attr, unsigned short xattr) {
+   RoteTermPrivate *pd = rt->pd;
+   int height = bottom - top + 1;
+   int count = n > 0 ? n : -n;
+   int i, first;
+
+   if (top < 0 || bottom >= rt->rows || height <= 0 || n == 0) return;
+   if (count > height) count = height;
+
+   if (top == 0 && bottom == rt->rows - 1) {
+      /* whole screen: slide the window, the rows leaving it at one end
+       * come back in at the other */
+      if (n > 0) {
+         if (pd->screen.rowoff + rt->rows + count > rt->rows * 3) recenter_rows(rt);
+         for (i = 0; i < count; i++)
+            rt->lines[rt->rows + i] = rt->lines[i];
+         pd->screen.rowoff += count;
+      }
+      else {
+         if (pd->screen.rowoff < count) recenter_rows(rt);
+         for (i = 0; i < count; i++)
+            rt->lines[-1 - i] = rt->lines[rt->rows - 1 - i];
+         pd->screen.rowoff -= count;
+      }
+      rt->lines = pd->screen.rowbuf + pd->screen.rowoff;
+   }
+   else if (n > 0) {
+      memcpy(pd->rowtmp, rt->lines + top, sizeof(RoteRow) * count);
+      memmove(rt->lines + top, rt->lines + top + count,
+              sizeof(RoteRow) * (height - count));
+      memcpy(rt->lines + bottom + 1 - count, pd->rowtmp, sizeof(RoteRow) * count);
+   }
+   else {
+      memcpy(pd->rowtmp, rt->lines + bottom + 1 - count, sizeof(RoteRow) * count);
+      memmove(rt->lines + top + count, rt->lines + top,
+              sizeof(RoteRow) * (height - count));
+      memcpy(rt->lines + top, pd->rowtmp, sizeof(RoteRow) * count);
+   }
+
+   /* clear the rows that came around */
+   first = n > 0 ? bottom + 1 - count : top;
+   for (i = first; i < first + count; i++)
+      rote_vt_fill_cells(rt, &rt->lines[i], 0, rt->cols, attr, xattr);
+
+   for (i = top; i <= bottom; i++) rote_vt_redraw(rt, i, 0, rt->cols - 1);
+}
+
+/* Copies the cells of a row into a row of cols columns, cutting them or
+ * padding them with blanks; from == NULL makes a blank row */
+static void resize_row(const RoteRow *from, int from_cols, RoteRow *to,
+                       int cols) {
+   int n = !from ? 0 : from_cols < cols ? from_cols : cols;
+   if (n > 0) {
+      memcpy(to->text, from->text, n);
+      memcpy(to->attr, from->attr, n);
+      if (to->glyph) memcpy(to->glyph, from->glyph, sizeof(unsigned short) * n);
+      if (to->xattr) memcpy(to->xattr, from->xattr, sizeof(unsigned short) * n);
+
+      /* a wide glyph cut in half */
+      if (n < from_cols && (unsigned char) from->text[n] == ROTE_CELL_WIDE_TAIL)
+         to->text[n - 1] = 0x20;
+   }
+
+   memset(to->text + n, 0x20, cols - n);
+   memset(to->attr + n, 0x70, cols - n);
+   if (to->glyph) memset(to->glyph + n, 0, sizeof(unsigned short) * (cols - n));
+   if (to->xattr) memset(to->xattr + n, 0, sizeof(unsigned short) * (cols - n));
+}
+
+/* Builds a rows x cols copy of a screen of the terminal's current size,
+ * whose first row is row shift of the old one */
+static bool resize_screen(RoteTerm *rt, const RoteScreen *from, RoteScreen *to,
+                          int rows, int cols, int shift) {
+   const RoteRow *old = from->rowbuf + from->rowoff;
+   RoteRow *lines;
+   int i;
+
+   if (!alloc_screen(to, rows, cols)) return false;
+   if ((from->glyphbuf && !(to->glyphbuf = (unsigned short*)
+           malloc(sizeof(unsigned short) * rows * cols))) ||
+       (from->xattrbuf && !(to->xattrbuf = (unsigned short*)
+           malloc(sizeof(unsigned short) * rows * cols)))) {
+      free_screen(to, rows);
+      return false;
+   }
+
+   lines = to->rowbuf + to->rowoff;
+   for (i = 0; i < rows; i++) {
+      lines[i].glyph = to->glyphbuf ? to->glyphbuf + i * cols : NULL;
+      lines[i].xattr = to->xattrbuf ? to->xattrbuf + i * cols : NULL;
+      resize_row(i + shift < rt->rows ? &old[i + shift] : NULL, rt->cols,
+                 &lines[i], cols);
+   }
+   return true;
+}
+
+bool rote_vt_resize(RoteTerm *rt, int rows, int cols) {
+   RoteTermPrivate *pd = rt->pd;
+   RoteScreen screen, other;
+   const RoteRow *primary;
+   RoteRow *rowtmp;
+   bool *line_dirty;
+   RoteSpan *line_damage;
+   struct winsize ws;
+   int i, shift, other_shift, primary_shift;
+
+   if (rows <= 0 || cols <= 0) return false;
+   if (rows == rt->rows && cols == rt->cols) return true;
+
+   /* the cursor's row stays on screen, the rows taken away are taken
+    * from the top; while the alternate screen is shown, the primary
+    * screen keeps the row of the cursor saved on switching */
+   shift = rt->crow - (rows - 1);
+   if (shift < 0) shift = 0;
+   other_shift = pd->altscreen ? pd->saved_y - (rows - 1) : 0;
+   if (other_shift < 0) other_shift = 0;
+
+   /* the new screens are built next to the old ones so that a failure
+    * leaves the terminal as it was */
+   memset(&other, 0, sizeof(RoteScreen));
+   rowtmp = (RoteRow*) malloc(sizeof(RoteRow) * rows);
+   line_dirty = (bool*) malloc(sizeof(bool) * rows);
+   line_damage = (RoteSpan*) malloc(sizeof(RoteSpan) * rows);
+   if (!rowtmp || !line_dirty || !line_damage ||
+       !resize_screen(rt, &pd->screen, &screen, rows, cols, shift)) {
+      free(rowtmp);
+      free(line_dirty);
+      free(line_damage);
+      return false;
+   }
+   if (pd->other.textbuf &&
+       !resize_screen(rt, &pd->other, &other, rows, cols, other_shift)) {
+      free_screen(&screen, rows);
+      free(rowtmp);
+      free(line_dirty);
+      free(line_damage);
+      return false;
+   }
+
+   /* the rows of the primary screen taken away scroll off as they would
+    * with line feeds */
+   primary = pd->altscreen ? pd->other.rowbuf + pd->other.rowoff : rt->lines;
+   primary_shift = pd->altscreen ? other_shift : shift;
+   if (pd->scroll_handler)
+      for (i = 0; i < primary_shift; i++)
+         (*pd->scroll_handler)(rt, &primary[i], pd->scroll_data);
+
+   free_screen(&pd->screen, rt->rows);
+   free_screen(&pd->other, rt->rows);
+   free(pd->rowtmp);
+   free(rt->line_dirty);
+   free(rt->line_damage);
+   pd->screen = screen;
+   pd->other = other;
+   pd->rowtmp = rowtmp;
+   rt->line_dirty = line_dirty;
+   rt->line_damage = line_damage;
+   rt->lines = pd->screen.rowbuf + pd->screen.rowoff;
+   rt->rows = rows;
+   rt->cols = cols;
+   for (i = 0; i < rows; i++) {
+      line_dirty[i] = true;
+      line_damage[i].first = 0;
+      line_damage[i].last = cols - 1;
+   }
+
+   /* the cursors follow their rows, the scrolling region is reset */
+   rt->crow -= shift;
+   if (rt->ccol >= cols) rt->ccol = cols - 1;
+   pd->saved_y -= primary_shift;
+   if (pd->saved_y < 0) pd->saved_y = 0;
+   if (pd->saved_y >= rows) pd->saved_y = rows - 1;
+   if (pd->saved_x >= cols) pd->saved_x = cols - 1;
+   pd->scrolltop = 0;
+   pd->scrollbottom = rows - 1;
+   rt->curpos_dirty = true;
+
+   /* the kernel sends SIGWINCH to the child's foreground process group */
+   if (pd->pty >= 0) {
+      ws.ws_row = rows;
+      ws.ws_col = cols;
+      ws.ws_xpixel = ws.ws_ypixel = 0;
+      ioctl(pd->pty, TIOCSWINSZ, &ws);
+   }
+   return true;
+}
+
 static void default_cur_set_attr(WINDOW *win, unsigned char attr) {
    int cp = ROTE_ATTR_BG(attr) * 8 + 7 - ROTE_ATTR_FG(attr);
    if (!cp) wattrset(win, A_NORMAL);
@@ -109,14 +450,21 @@ void rote_vt_draw(RoteTerm *rt, WINDOW *win, int srow, int scol,
                                 void (*cur_set_attr)(WINDOW*,unsigned char)) {
 
    int i, j;
+   unsigned char ch;
    rote_vt_update(rt);
    
    if (!cur_set_attr) cur_set_attr = default_cur_set_attr;
    for (i = 0; i < rt->rows; i++) {
       wmove(win, srow + i, scol);
       for (j = 0; j < rt->cols; j++) {
-         (*cur_set_attr)(win, rt->cells[i][j].attr);
-         waddch(win, ensure_printable(rt->cells[i][j].ch));
+         ch = rt->lines[i].text[j];
+         if (ch == ROTE_CELL_WIDE_TAIL) continue;  /* drawn with its glyph */
+
+         (*cur_set_attr)(win, rt->lines[i].attr[j]);
+         if (ch == ROTE_CELL_GLYPH)
+            waddstr(win, rote_vt_get_glyph(rt, rt->lines[i].glyph[j])->utf8);
+         else
+            waddch(win, ensure_printable(ch));
       }
    }
 
@@ -136,6 +484,12 @@ pid_t rote_vt_forkpty(RoteTerm *rt, const char *command) {
 
    if (childpid == 0) {
       /* we are the child, running under the slave side of the pty. */
+      sigset_t nosignals;
+
+      /* The caller may have blocked signals (e.g. to receive SIGCHLD
+       * through a signalfd), and the mask survives exec. */
+      sigemptyset(&nosignals);
+      sigprocmask(SIG_SETMASK, &nosignals, NULL);
 
       /* Cajole application into using linux-console-compatible escape
        * sequences (which is what we are prepared to interpret) */
@@ -150,95 +504,210 @@ pid_t rote_vt_forkpty(RoteTerm *rt, const char *command) {
 
    /* if we got here we are the parent process */
    rt->childpid = childpid;
+
+   /* never block on the pty: output that the child doesn't consume
+    * is queued, see rote_vt_write */
+   fcntl(rt->pd->pty, F_SETFL, fcntl(rt->pd->pty, F_GETFL) | O_NONBLOCK);
    return childpid;
 }
 
 void rote_vt_forsake_child(RoteTerm *rt) {
    if (rt->pd->pty >= 0) close(rt->pd->pty);
    rt->pd->pty = -1;
+   rt->pd->outbuf_len = 0;  /* nobody left to read it */
    rt->childpid = 0;
 }
 
-void rote_vt_update(RoteTerm *rt) {
+static bool pty_readable(RoteTerm *rt) {
    fd_set ifs;
    struct timeval tvzero;
-   char buf[512];
-   int bytesread;
-   int n = ROTE_VT_UPDATE_ITERATIONS;
-   if (rt->pd->pty < 0) return;  /* nothing to pump */
-
-   while (n--) { /* iterate at most ROVE_VT_UPDATE_ITERATIONS times.
-                  * As Phil Endecott pointed out, if we don't restrict this,
-                  * a program that floods the terminal with output
-                  * could cause this loop to iterate forever, never
-                  * being able to catch up. So we'll rely on the client
-                  * calling rote_vt_update often, as the documentation
-                  * recommends :-) */
-
-      /* check if pty has something to say */
-      FD_ZERO(&ifs); FD_SET(rt->pd->pty, &ifs);
-      tvzero.tv_sec = 0; tvzero.tv_usec = 0;
-   
-      if (select(rt->pd->pty + 1, &ifs, NULL, NULL, &tvzero) <= 0)
-         return; /* nothing to read, or select() failed */
 
-      /* read what we can. This is guaranteed not to block, since
-       * select() told us there was something to read. */
-      bytesread = read(rt->pd->pty, buf, 512);
-      if (bytesread <= 0) return;   
+   FD_ZERO(&ifs); FD_SET(rt->pd->pty, &ifs);
+   tvzero.tv_sec = 0; tvzero.tv_usec = 0;
+   return select(rt->pd->pty + 1, &ifs, NULL, NULL, &tvzero) > 0;
+}
+
+int rote_vt_pending_input(RoteTerm *rt) {
+   int avail = 0;
+   if (rt->pd->pty < 0) return 0;
+   if (ioctl(rt->pd->pty, FIONREAD, &avail) < 0) return -1;
+   return avail;
+}
+
+void rote_vt_update(RoteTerm *rt) {
+   /* As Phil Endecott pointed out, if we don't restrict this,
+    * a program that floods the terminal with output
+    * could cause this loop to iterate forever, never
+    * being able to catch up. So we'll rely on the client
+    * calling rote_vt_update often, as the documentation
+    * recommends :-) */
+   rote_vt_update_budget(rt, ROTE_VT_UPDATE_BUDGET);
+}
+
+int rote_vt_update_budget(RoteTerm *rt, int max_bytes) {
+   char buf[ROTE_VT_READ_CHUNK];
+   int total = 0;
+   int want, avail, bytesread;
+   if (rt->pd->pty < 0) return 0;  /* nothing to pump */
+
+   while (total < max_bytes) {
+      want = max_bytes - total;
+      if (want > ROTE_VT_READ_CHUNK) want = ROTE_VT_READ_CHUNK;
+
+      /* ask the pty how much it holds, so that the read() below is
+       * guaranteed not to block and doesn't need a select() first */
+      avail = rote_vt_pending_input(rt);
+      if (avail > 0) {
+         if (want > avail) want = avail;
+      }
+      else if (total > 0 || !pty_readable(rt))
+         break;  /* drained, or nothing to read at all */
+
+      bytesread = read(rt->pd->pty, buf, want);
+      if (bytesread < 0 && (errno == EAGAIN || errno == EINTR))
+         break;  /* readable was a false alarm */
+      if (bytesread <= 0) return total > 0 ? total : -1;
 
       /* inject the data into the terminal */
       rote_vt_inject(rt, buf, bytesread);
+      total += bytesread;
    }
+
+   return total;
+}
+
+static void pty_write_error(RoteTerm *rt) {
+   /* very ugly way to inform the error. Improvements welcome! */
+   static char errormsg[] = "\n(ROTE: pty write() error)\n";
+   rt->pd->outbuf_len = 0;
+   rote_vt_inject(rt, errormsg, strlen(errormsg));
+}
+
+static bool outbuf_append(RoteTerm *rt, const char *data, int len) {
+   RoteTermPrivate *pd = rt->pd;
+   if (pd->outbuf_len + len > pd->outbuf_size) {
+      int size = pd->outbuf_size ? pd->outbuf_size : 256;
+      char *buf;
+      while (size < pd->outbuf_len + len) size *= 2;
+      if (! (buf = (char*) realloc(pd->outbuf, size)) ) return false;
+      pd->outbuf = buf;
+      pd->outbuf_size = size;
+   }
+   memcpy(pd->outbuf + pd->outbuf_len, data, len);
+   pd->outbuf_len += len;
+   return true;
+}
+
+/* writes as much as the pty accepts without blocking; returns the number
+ * of bytes written or -1 on error */
+static int pty_write(RoteTerm *rt, const char *data, int len) {
+   int total = 0;
+   while (total < len) {
+      int byteswritten = write(rt->pd->pty, data + total, len - total);
+      if (byteswritten < 0) {
+         if (errno == EINTR) continue;
+         if (errno == EAGAIN) break;  /* the child isn't reading */
+         return -1;
+      }
+      total += byteswritten;
+   }
+   return total;
 }
 
 void rote_vt_write(RoteTerm *rt, const char *data, int len) {
+   int byteswritten = 0;
+
    if (rt->pd->pty < 0) {
       /* no pty, so just inject the data plain and simple */
       rote_vt_inject(rt, data, len);
       return;
    }
 
-   /* write data to pty. Keep calling write() until we have written
-    * everything. */
-   while (len > 0) {
-      int byteswritten = write(rt->pd->pty, data, len);
+   /* keep the order: bypass the pty while older bytes are queued */
+   if (rt->pd->outbuf_len == 0 && !rt->pd->defer_output) {
+      byteswritten = pty_write(rt, data, len);
       if (byteswritten < 0) {
-         /* very ugly way to inform the error. Improvements welcome! */
-         static char errormsg[] = "\n(ROTE: pty write() error)\n";
-         rote_vt_inject(rt, errormsg, strlen(errormsg));
+         pty_write_error(rt);
          return;
       }
+   }
+
+   if (byteswritten < len && !outbuf_append(rt, data + byteswritten, len - byteswritten))
+      pty_write_error(rt);
+}
 
-      data += byteswritten;
-      len  -= byteswritten;
+int rote_vt_flush(RoteTerm *rt) {
+   RoteTermPrivate *pd = rt->pd;
+   int byteswritten;
+
+   if (pd->pty < 0 || pd->outbuf_len == 0) return 0;
+
+   byteswritten = pty_write(rt, pd->outbuf, pd->outbuf_len);
+   if (byteswritten < 0) {
+      pty_write_error(rt);
+      return -1;
    }
+
+   pd->outbuf_len -= byteswritten;
+   memmove(pd->outbuf, pd->outbuf + byteswritten, pd->outbuf_len);
+   return pd->outbuf_len;
 }
 
-void rote_vt_install_handler(RoteTerm *rt, rote_es_handler_t handler) {
-   rt->pd->handler = handler;
+int rote_vt_pending_output(RoteTerm *rt) {
+   return rt->pd->outbuf_len;
 }
 
-void *rote_vt_take_snapshot(RoteTerm *rt) {
-   int i;
-   int bytes_per_row = sizeof(RoteCell) * rt->cols;
-   void *buf = malloc(bytes_per_row * rt->rows);
-   void *ptr = buf;
+void rote_vt_defer_output(RoteTerm *rt, bool defer) {
+   rt->pd->defer_output = defer;
+}
 
-   for (i = 0; i < rt->rows; i++, ptr += bytes_per_row)
-      memcpy(ptr, rt->cells[i], bytes_per_row);
+int rote_vt_peek_output(RoteTerm *rt, const char **data) {
+   *data = rt->pd->outbuf;
+   return rt->pd->outbuf_len;
+}
 
-   return buf;
+void rote_vt_consume_output(RoteTerm *rt, int len) {
+   RoteTermPrivate *pd = rt->pd;
+   if (len <= 0) return;
+   if (len > pd->outbuf_len) len = pd->outbuf_len;
+   pd->outbuf_len -= len;
+   memmove(pd->outbuf, pd->outbuf + len, pd->outbuf_len);
 }
 
-void rote_vt_restore_snapshot(RoteTerm *rt, void *snapbuf) {
-   int i;
-   int bytes_per_row = sizeof(RoteCell) * rt->cols;
+void rote_vt_mark_damage(RoteTerm *rt, int row, int first, int last) {
+   if (row < 0 || row >= rt->rows) return;
+   if (first < 0) first = 0;
+   if (last >= rt->cols) last = rt->cols - 1;
+   if (first <= last) rote_vt_damage(rt, row, first, last);
+}
 
-   for (i = 0; i < rt->rows; i++, snapbuf += bytes_per_row) {
-      rt->line_dirty[i] = true;
-      memcpy(rt->cells[i], snapbuf, bytes_per_row);
-   }
+bool rote_vt_next_damage(RoteTerm *rt, int *row, RoteRect *rect) {
+   int r = *row;
+   while (r < rt->rows && !rt->line_dirty[r]) r++;
+   *row = r;
+   if (r >= rt->rows) return false;
+
+   rect->top = r;
+   rect->left = rt->line_damage[r].first;
+   rect->right = rt->line_damage[r].last;
+   r++;
+   while (r < rt->rows && rt->line_dirty[r] &&
+          rt->line_damage[r].first == rect->left &&
+          rt->line_damage[r].last == rect->right)
+      r++;
+   rect->bottom = r - 1;
+   *row = r;
+   return true;
+}
+
+void rote_vt_install_handler(RoteTerm *rt, rote_es_handler_t handler) {
+   rt->pd->handler = handler;
+}
+
+void rote_vt_install_scroll_handler(RoteTerm *rt,
+                                    rote_scroll_handler_t handler, void *data) {
+   rt->pd->scroll_handler = handler;
+   rt->pd->scroll_data = data;
 }
 
 int rote_vt_get_pty_fd(RoteTerm *rt) {
@@ -90,13 +90,112 @@ extern "C" {
 #define ROTE_ATTR_BOLD(attr)            ((attr) & 0x80)
 #define ROTE_ATTR_BLINK(attr)           ((attr) & 0x08)
 
-/* Represents each of the text cells in the terminal screen */
-typedef struct RoteCell_ {
-   unsigned char ch;    /* >= 32, that is, control characters are not
-                         * allowed to be on the virtual screen */
-
-   unsigned char attr;  /* a color attribute, as described previously */
-} RoteCell;
+/* Colors beyond the 8 of an attribute (SGR 38;5;n, 38;2;r;g;b, 90-97 and
+ * their background counterparts) don't fit in its byte. The attribute of
+ * the cell gets the nearest of the 8 colors, and the extended colors are
+ * interned by the terminal as an extended attribute, whose number the cell
+ * keeps in the xattr plane of its row. Extended attribute 0 has neither,
+ * the attribute alone gives the colors of the cell. */
+#define ROTE_COLOR_INDEXED(n)           (0x01000000u | (n))
+#define ROTE_COLOR_RGB(r, g, b)         (0x02000000u | (r) << 16 | (g) << 8 | (b))
+
+/* retrieve the fields of an extended color */
+#define ROTE_COLOR_IS_RGB(color)        ((color) & 0x02000000u)
+#define ROTE_COLOR_INDEX(color)         ((color) & 0xFF)
+#define ROTE_COLOR_R(color)             (((color) >> 16) & 0xFF)
+#define ROTE_COLOR_G(color)             (((color) >> 8) & 0xFF)
+#define ROTE_COLOR_B(color)             ((color) & 0xFF)
+
+/* Text bytes of the cells that don't hold a plain ASCII character. The
+ * input is decoded as UTF-8: ASCII stays one byte per cell, any other
+ * character (with the combining marks that follow it) is interned in a
+ * table of the terminal and the cell holds ROTE_CELL_GLYPH, with the
+ * number of the glyph in the glyph plane of the row. A glyph two columns
+ * wide takes its cell and the next, which holds ROTE_CELL_WIDE_TAIL. */
+#define ROTE_CELL_GLYPH      0x80
+#define ROTE_CELL_WIDE_TAIL  0x81
+
+/* Represents a row of the terminal screen. The characters and the
+ * attributes of its cells are kept in two separate planes, so the text of
+ * a row is a plain array of characters that can be scanned on its own. */
+typedef struct RoteRow_ {
+   char *text;          /* rt->cols characters, >= 32, that is, control
+                         * characters are not allowed to be on the
+                         * virtual screen */
+
+   unsigned char *attr; /* rt->cols color attributes, as described
+                         * previously */
+
+   unsigned short *glyph; /* rt->cols glyph numbers, only meaningful where
+                         * text is ROTE_CELL_GLYPH. NULL until the
+                         * terminal first gets a non-ASCII character. */
+
+   unsigned short *xattr; /* rt->cols extended attribute numbers. NULL
+                         * until the terminal first uses an extended
+                         * color, every row has them from then on. */
+
+   struct RoteSnapRow_ *snap; /* the copy of the row in the latest
+                         * snapshot, NULL once the row changed. Owned by
+                         * the terminal, don't touch. */
+} RoteRow;
+
+/* size of the longest glyph, in UTF-8 bytes, plus its terminating 0 */
+#define ROTE_GLYPH_BYTES 15
+
+/* A character, or a grapheme cluster, interned by a terminal */
+typedef struct RoteGlyph_ {
+   char utf8[ROTE_GLYPH_BYTES];  /* 0-terminated UTF-8 */
+   unsigned char width;          /* columns it takes, 1 or 2 */
+} RoteGlyph;
+
+/* The colors of an extended attribute, each one a ROTE_COLOR_* value, or
+ * 0 where the color of the attribute stands */
+typedef struct RoteXAttr_ {
+   unsigned int fg, bg;
+} RoteXAttr;
+
+/* A row of snapshots: a copy of the cells of a terminal row, shared by
+ * all the snapshots taken while the row didn't change. READ-ONLY, it may
+ * be shared with other threads as long as it is referenced. */
+typedef struct RoteSnapRow_ {
+   int refs;                 /* references to the row, from the snapshots
+                              * and from the terminal row it copies */
+   unsigned long generation; /* generation of the snapshot that copied
+                              * the row, see RoteSnapshot */
+   int cols;                 /* number of cells */
+   char *text;               /* the text plane, as in RoteRow */
+   unsigned char *attr;      /* the attribute plane */
+   unsigned short *glyph;    /* the glyph numbers, NULL if the row has no
+                              * ROTE_CELL_GLYPH cell */
+   unsigned short *xattr;    /* the extended attribute numbers, NULL if
+                              * the row has none */
+} RoteSnapRow;
+
+/* An immutable, reference counted copy of the screen of a terminal. The
+ * rows that didn't change between two snapshots are the same RoteSnapRow,
+ * so comparing the pointers tells which rows differ, and a snapshot costs
+ * a pointer per row plus a copy of the rows that changed since the
+ * previous one. READ-ONLY. */
+typedef struct RoteSnapshot_ {
+   int refs;                 /* references to the snapshot */
+   unsigned long generation; /* the terminal's count of snapshots so far,
+                              * 1 for its first one. A row whose own
+                              * generation is above that of an older
+                              * snapshot changed since; rows that only
+                              * moved (scrolled) keep their generation. */
+   int rows, cols;           /* dimensions of the terminal */
+   RoteSnapRow **lines;      /* the rows, each referenced */
+} RoteSnapshot;
+
+/* Columns first..last of a row */
+typedef struct RoteSpan_ {
+   int first, last;
+} RoteSpan;
+
+/* Rows top..bottom of columns left..right */
+typedef struct RoteRect_ {
+   int top, left, bottom, right;
+} RoteRect;
 
 /* Declaration of opaque rote_Term_Private structure */
 typedef struct RoteTermPrivate_ RoteTermPrivate;
@@ -110,13 +209,19 @@ typedef struct RoteTerm_ {
                                  * this (a segfault is about all you will 
                                  * accomplish). */
 
-   RoteCell **cells;            /* matrix of cells. This
-                                 * matrix is indexed as cell[row][column]
-                                 * where 0 <= row < rows and
+   RoteRow *lines;              /* rows of the screen. The cell at
+                                 * (row, column) is lines[row].text[column]
+                                 * and lines[row].attr[column], where
+                                 *       0 <= row < rows and
                                  *       0 <= col < cols
                                  *
                                  * You may freely modify the contents of
-                                 * the cells.
+                                 * the cells, then record it with
+                                 * rote_vt_mark_damage. Scrolling moves rows by
+                                 * swapping their RoteRow, so neither
+                                 * lines nor the planes of a row may be
+                                 * kept across calls that feed the
+                                 * terminal.
                                  */
 
    int crow, ccol;              /* cursor coordinates. READ-ONLY. */
@@ -135,9 +240,25 @@ typedef struct RoteTerm_ {
     * (when, for example, you redraw the term or something) --- */
    bool curpos_dirty;           /* whether cursor location has changed */
    bool *line_dirty;            /* whether each row is dirty  */
+   RoteSpan *line_damage;       /* the columns of each row that changed,
+                                 * only meaningful where line_dirty is
+                                 * raised: the first change after you
+                                 * lower the flag starts the span anew */
    /* --- end dirtiness flags */
 } RoteTerm;
 
+/* Records that columns first..last of the row changed: raises its
+ * line_dirty flag and widens its line_damage to them. Call it after
+ * modifying cells yourself, the next snapshot copies the row anew. */
+void rote_vt_mark_damage(RoteTerm *rt, int row, int first, int last);
+
+/* Iterates over the damage of the screen as rectangles, the spans of
+ * consecutive dirty rows that changed the same columns being merged.
+ * Start with *row at 0: each call puts the next rectangle in *rect and
+ * moves *row past it, and returns false once there is none left. The
+ * flags are left raised. */
+bool rote_vt_next_damage(RoteTerm *rt, int *row, RoteRect *rect);
+
 /* Creates a new virtual terminal with the given dimensions. You
  * must destroy it with rote_vt_destroy after you are done with it.
  * The terminal will be initially blank and the cursor will
@@ -151,6 +272,22 @@ RoteTerm *rote_vt_create(int rows, int cols);
  * rote_vt_create. If rt == NULL, does nothing. */
 void rote_vt_destroy(RoteTerm *rt);
 
+/* Changes the dimensions of the terminal, keeping its contents: rows are
+ * cut or padded with blanks on the right, and rows are taken away from or
+ * added at the bottom, except that the row of the cursor stays on screen;
+ * the rows above it that don't fit scroll off, through the scroll handler
+ * if one is installed. Both the primary and the alternate screen are
+ * resized; while the alternate one is shown, the saved cursor stands for
+ * the cursor of the primary one. The scrolling region is reset to the
+ * whole screen and the whole screen is damaged. If a child runs in the
+ * terminal, its pty is given the new size, which raises SIGWINCH in the
+ * child.
+ *
+ * Snapshots taken before can't be restored after. Returns false,
+ * leaving the terminal as it was, if memory ran out or the dimensions
+ * aren't positive. */
+bool rote_vt_resize(RoteTerm *rt, int rows, int cols);
+
 /* Starts a forked process in the terminal. The <command> parameter
  * is a shell command to execute (it will be interpreted by '/bin/sh -c') 
  * Returns the pid of the forked process. 
@@ -189,12 +326,56 @@ void rote_vt_forsake_child(RoteTerm *rt);
  * read from the child process it will return immediately. */
 void rote_vt_update(RoteTerm *rt);
 
+/* Same as rote_vt_update, but lets the caller decide how much output
+ * may be consumed: reads at most <max_bytes> bytes from the sub process,
+ * in chunks as large as possible, and injects them into the terminal.
+ *
+ * Returns the number of bytes injected, 0 if there was nothing to read,
+ * or -1 if the pty reported end of file or an error (which usually
+ * means the child process is gone). This function will not block. */
+int rote_vt_update_budget(RoteTerm *rt, int max_bytes);
+
+/* Returns how many bytes the sub process has written that were not
+ * read yet, 0 if there is no pty, or -1 if the pty can't tell. */
+int rote_vt_pending_input(RoteTerm *rt);
+
 /* Puts data into the terminal: if there is a forked process running,
  * the data will be sent to it. If there is no forked process,
  * the data will simply be injected into the terminal (as in
- * rote_vt_inject) */
+ * rote_vt_inject)
+ *
+ * This function will not block: whatever the child process doesn't
+ * accept right away is queued in the terminal, and sent by
+ * rote_vt_flush when the pty becomes writable again. */
 void rote_vt_write(RoteTerm *rt, const char *data, int length);
 
+/* Sends as much of the queued output as the child process accepts
+ * without blocking. Call it when the pty (see rote_vt_get_pty_fd) is
+ * writable and rote_vt_pending_output is not 0.
+ *
+ * Returns the number of bytes still queued, or -1 if the pty reported
+ * an error (the queue is then discarded). */
+int rote_vt_flush(RoteTerm *rt);
+
+/* Returns the number of bytes written with rote_vt_write that were not
+ * sent to the child process yet. */
+int rote_vt_pending_output(RoteTerm *rt);
+
+/* When <defer> is true, rote_vt_write never writes to the pty itself
+ * and only queues the data: the caller takes care of the actual I/O
+ * (e.g. with asynchronous writes), using rote_vt_peek_output and
+ * rote_vt_consume_output. */
+void rote_vt_defer_output(RoteTerm *rt, bool defer);
+
+/* Points <data> to the queued output and returns its length. The
+ * pointer is valid until the next rote_vt_write or
+ * rote_vt_consume_output call. */
+int rote_vt_peek_output(RoteTerm *rt, const char **data);
+
+/* Drops the first <len> bytes of the queued output, once the caller
+ * wrote them to the pty. */
+void rote_vt_consume_output(RoteTerm *rt, int len);
+
 /* Inject data into the terminal. <data> needs NOT be 0-terminated:
  * its length is solely determined by the <length> parameter. Please
  * notice that this writes directly to the terminal, that is,
@@ -215,6 +396,9 @@ void rote_vt_inject(RoteTerm *rt, const char *data, int length);
  * a common mapping, and the bold and blink attributes will be mapped 
  * to A_BOLD and A_BLINK.
  *
+ * Cells with extended colors are painted with the nearest of the 8 colors,
+ * which is what their attribute holds.
+ *
  * At the end of the function, the cursor will be left where the virtual 
  * cursor of the terminal is supposed to be.
  *
@@ -233,16 +417,38 @@ void rote_vt_draw(RoteTerm *rt, WINDOW *win, int startrow, int startcol,
  * when you use keypad(somewin, TRUE) (see man page). */
 void rote_vt_keypress(RoteTerm *rt, int keycode);
 
-/* Takes a snapshot of the current contents of the terminal and
- * saves them to a dynamically allocated buffer. Returns a pointer
- * to the newly created buffer, which you can pass to
- * rote_vt_restore_snapshot. Caller is responsible for free()'ing when
- * the snapshot is no longer needed. */
-void *rote_vt_take_snapshot(RoteTerm *rt);
+/* Same as calling rote_vt_keypress for each of the <count> keycodes,
+ * but the escape sequences are sent with as few rote_vt_write calls
+ * as possible (e.g. a whole pasted text at once). */
+void rote_vt_keypresses(RoteTerm *rt, const int *keycodes, int count);
+
+/* Takes a snapshot of the current contents of the terminal, with a
+ * reference the caller drops with rote_snapshot_unref. Only the rows that
+ * changed since the previous snapshot are copied, the others are shared
+ * with it, so taking one is mostly a pointer per row.
+ *
+ * Returns NULL if memory ran out. */
+RoteSnapshot *rote_vt_take_snapshot(RoteTerm *rt);
+
+/* Puts the contents of a snapshot of the terminal back on its screen;
+ * the rows that didn't change since are left alone. The snapshot keeps
+ * its reference. Returns false, leaving the terminal as it was, if the
+ * snapshot is of another size or memory ran out. */
+bool rote_vt_restore_snapshot(RoteTerm *rt, const RoteSnapshot *snap);
+
+/* Adds a reference to the snapshot and returns it. Safe to call from any
+ * thread. */
+RoteSnapshot *rote_snapshot_ref(RoteSnapshot *snap);
+
+/* Drops a reference to the snapshot, freeing it with the last one, along
+ * with the rows no other snapshot nor the terminal uses. Safe to call from
+ * any thread; if snap == NULL, does nothing. */
+void rote_snapshot_unref(RoteSnapshot *snap);
 
-/* Restores a snapshot previously taken with rote_vt_take_snapshot.
- * This function does NOT free() the passed buffer */
-void rote_vt_restore_snapshot(RoteTerm *rt, void *snapbuf);
+/* Same as rote_snapshot_ref and rote_snapshot_unref, for a row kept on
+ * its own, e.g. in a history of the screen. */
+RoteSnapRow *rote_snap_row_ref(RoteSnapRow *row);
+void rote_snap_row_unref(RoteSnapRow *row);
 
 /* Returns the pseudo tty descriptor associated with the given terminal.
  * Please don't do weird things with it (like close it for instance),
@@ -253,6 +459,19 @@ void rote_vt_restore_snapshot(RoteTerm *rt, void *snapbuf);
  * needed, e.g. on a call to rote_vt_forkpty. */
 int rote_vt_get_pty_fd(RoteTerm *rt);
 
+/* Returns the glyph with the given number, as found in the glyph plane
+ * of a row. Glyphs are never changed nor freed while the terminal lives,
+ * so a copy of the rows can still be drawn from another thread once it is
+ * handed over. Glyph 0 is U+FFFD, which also stands for the characters
+ * that came after the table filled up. */
+const RoteGlyph *rote_vt_get_glyph(RoteTerm *rt, unsigned short n);
+
+/* Returns the extended attribute with the given number, as found in the
+ * xattr plane of a row. Like glyphs, they are never changed nor freed
+ * while the terminal lives. Once the table is full, new colors only get
+ * their nearest in the attribute. */
+const RoteXAttr *rote_vt_get_xattr(RoteTerm *rt, unsigned short n);
+
 /* Declaration of custom escape sequence callback type. See the
  * rote_vt_add_es_handler function for more info */
 typedef int (*rote_es_handler_t)(RoteTerm *rt, const char *es);
@@ -280,10 +499,26 @@ typedef int (*rote_es_handler_t)(RoteTerm *rt, const char *es);
  * The handler may of course modify the terminal as it sees fit, taking 
  * care not to corrupt it of course (in particular, it should appropriately 
  * raise the line_dirty[] and curpos_dirty flags to indicate what it has 
- * changed).
+ * changed, rote_vt_mark_damage doing the former along with line_damage).
  */
 void rote_vt_install_handler(RoteTerm *rt, rote_es_handler_t handler);
                             
+/* Declaration of the scrollback callback type. See the
+ * rote_vt_install_scroll_handler function for more info */
+typedef void (*rote_scroll_handler_t)(RoteTerm *rt, const RoteRow *row,
+                                      void *data);
+
+/* Installs a callback that the library calls with each line about to
+ * scroll off the top of the screen, that is, a line feed on the last
+ * line of a scrolling region that starts at the top. This allows the
+ * application to keep a scrollback history. Nothing is passed while the
+ * alternate screen of full-screen programs (DECSET 47, 1047 or 1049) is
+ * shown. The row holds rt->cols cells
+ * and is only valid during the call; data is passed along unchanged.
+ * Passing a NULL handler removes it. */
+void rote_vt_install_scroll_handler(RoteTerm *rt,
+                                    rote_scroll_handler_t handler, void *data);
+
 /* Possible return values for the custom handler function and their
  * meanings: */
 #define ROTE_HANDLERESULT_OK 0      /* means escape sequence was handled */
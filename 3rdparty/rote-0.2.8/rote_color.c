@@ -0,0 +1,161 @@
+/*
+LICENSE INFORMATION:
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License (LGPL) as published by the Free Software Foundation.
+
+Please refer to the COPYING file for more information.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+*/
+
+
+#include "rote.h"
+#include "roteprivate.h"
+#include <stdlib.h>
+
+/* extended attributes are paged like the glyphs, see rote_utf8.c */
+#define XATTR_PAGE_SIZE 256
+#define XATTR_PAGES 256
+#define XATTR_MAX (XATTR_PAGE_SIZE * XATTR_PAGES - 1)
+#define XATTR_HASH_MIN 64
+
+/* levels of the 6x6x6 color cube of the 256 color palette */
+static const unsigned char cube_levels[6] = { 0, 95, 135, 175, 215, 255 };
+
+int rote_color_basic(unsigned int color) {
+   unsigned int n, r, g, b;
+   if (ROTE_COLOR_IS_RGB(color)) {
+      r = ROTE_COLOR_R(color);
+      g = ROTE_COLOR_G(color);
+      b = ROTE_COLOR_B(color);
+   }
+   else if ((n = ROTE_COLOR_INDEX(color)) < 16) return n & 7;
+   else if (n < 232) {
+      r = cube_levels[(n - 16) / 36];
+      g = cube_levels[(n - 16) / 6 % 6];
+      b = cube_levels[(n - 16) % 6];
+   }
+   else r = g = b = 8 + (n - 232) * 10;  /* the gray ramp */
+
+   /* bit 0 is red, bit 1 green, bit 2 blue */
+   return (r >= 128) | (g >= 128) << 1 | (b >= 128) << 2;
+}
+
+void rote_vt_alloc_xattrs(RoteTerm *rt) {
+   int i;
+   if (rt->pd->screen.xattrbuf) return;
+
+   rt->pd->screen.xattrbuf = (unsigned short*) calloc(rt->rows * rt->cols,
+                                               sizeof(unsigned short));
+   if (!rt->pd->screen.xattrbuf) return;
+   for (i = 0; i < rt->rows; i++)
+      rt->lines[i].xattr = rt->pd->screen.xattrbuf + i * rt->cols;
+}
+
+static inline RoteXAttr *xattr_at(RoteTermPrivate *pd, int n) {
+   return &pd->xattr_pages[n / XATTR_PAGE_SIZE][n % XATTR_PAGE_SIZE];
+}
+
+static unsigned int xattr_hash(unsigned int fg, unsigned int bg) {
+   unsigned int h = fg * 2654435761u ^ bg * 2246822519u;
+   return h ^ h >> 15;
+}
+
+/* Doubles the hash table, keeping it at most half full */
+static bool xattr_hash_grow(RoteTermPrivate *pd) {
+   int size = pd->xattr_hash_size ? pd->xattr_hash_size * 2 : XATTR_HASH_MIN;
+   unsigned short *hash = (unsigned short*) calloc(size, sizeof(unsigned short));
+   const RoteXAttr *x;
+   int i, slot;
+   if (!hash) return false;
+
+   for (i = 0; i < pd->xattr_count; i++) {
+      x = xattr_at(pd, i);
+      slot = xattr_hash(x->fg, x->bg) & (size - 1);
+      while (hash[slot]) slot = (slot + 1) & (size - 1);
+      hash[slot] = i + 1;
+   }
+
+   free(pd->xattr_hash);
+   pd->xattr_hash = hash;
+   pd->xattr_hash_size = size;
+   return true;
+}
+
+/* Appends an extended attribute to the table, returns its number or -1 */
+static int xattr_add(RoteTermPrivate *pd, unsigned int fg, unsigned int bg) {
+   int n = pd->xattr_count;
+   RoteXAttr *x;
+   if (n >= XATTR_MAX) return -1;
+
+   if (!pd->xattr_pages &&
+       !(pd->xattr_pages = (RoteXAttr**) calloc(XATTR_PAGES, sizeof(RoteXAttr*))))
+      return -1;
+   if (n % XATTR_PAGE_SIZE == 0 &&
+       !(pd->xattr_pages[n / XATTR_PAGE_SIZE] =
+            (RoteXAttr*) malloc(sizeof(RoteXAttr) * XATTR_PAGE_SIZE)))
+      return -1;
+
+   x = xattr_at(pd, n);
+   x->fg = fg;
+   x->bg = bg;
+   pd->xattr_count++;
+   return n;
+}
+
+static unsigned short intern_xattr(RoteTermPrivate *pd, unsigned int fg,
+                                   unsigned int bg) {
+   const RoteXAttr *x;
+   int slot, n;
+
+   /* extended attribute 0, with no extended colors */
+   if (pd->xattr_count == 0 && xattr_add(pd, 0, 0) < 0) return 0;
+   if ((pd->xattr_count + 1) * 2 > pd->xattr_hash_size &&
+       !xattr_hash_grow(pd))
+      return 0;
+
+   slot = xattr_hash(fg, bg) & (pd->xattr_hash_size - 1);
+   for (; pd->xattr_hash[slot]; slot = (slot + 1) & (pd->xattr_hash_size - 1)) {
+      x = xattr_at(pd, pd->xattr_hash[slot] - 1);
+      if (x->fg == fg && x->bg == bg) return pd->xattr_hash[slot] - 1;
+   }
+
+   if ((n = xattr_add(pd, fg, bg)) < 0) return 0;
+   pd->xattr_hash[slot] = n + 1;
+   return n;
+}
+
+void rote_vt_update_xattr(RoteTerm *rt) {
+   RoteTermPrivate *pd = rt->pd;
+   if (!pd->curfg && !pd->curbg) {
+      pd->curxattr = 0;
+      return;
+   }
+
+   /* without the plane, the colors are left to the attribute */
+   rote_vt_alloc_xattrs(rt);
+   pd->curxattr = pd->screen.xattrbuf ?
+                     intern_xattr(pd, pd->curfg, pd->curbg) : 0;
+}
+
+const RoteXAttr *rote_vt_get_xattr(RoteTerm *rt, unsigned short n) {
+   return xattr_at(rt->pd, n);
+}
+
+void rote_vt_free_xattrs(RoteTerm *rt) {
+   RoteTermPrivate *pd = rt->pd;
+   int i;
+   if (pd->xattr_pages) {
+      for (i = 0; i < XATTR_PAGES; i++) free(pd->xattr_pages[i]);
+      free(pd->xattr_pages);
+   }
+   free(pd->xattr_hash);
+}
@@ -41,6 +41,33 @@ void rote_vt_keypress(RoteTerm *rt, int keycode) {
       rote_vt_write(rt, &c, 1); /* not special, just write it */
 }
 
+void rote_vt_keypresses(RoteTerm *rt, const int *keycodes, int count) {
+   char buf[512];
+   int len = 0, i;
+
+   if (!initialized) keytable_init();
+
+   for (i = 0; i < count; i++) {
+      int keycode = keycodes[i];
+      const char *seq = NULL;
+      int seqlen = 1;
+
+      if (keycode >= 0 && keycode < KEY_MAX && keytable[keycode]) {
+         seq = keytable[keycode];
+         seqlen = strlen(seq);
+      }
+      if (len + seqlen > (int) sizeof(buf)) {
+         rote_vt_write(rt, buf, len);
+         len = 0;
+      }
+      if (seq) memcpy(buf + len, seq, seqlen);
+      else buf[len] = (char) keycode;
+      len += seqlen;
+   }
+
+   if (len > 0) rote_vt_write(rt, buf, len);
+}
+
 static void keytable_init() {
    initialized = 1;
    memset(keytable, 0, KEY_MAX+1 * sizeof(const char*));
@@ -0,0 +1,159 @@
+/*
+LICENSE INFORMATION:
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License (LGPL) as published by the Free Software Foundation.
+
+Please refer to the COPYING file for more information.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+*/
+
+
+#include "rote.h"
+#include "roteprivate.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Each terminal row holds a reference to its copy in the latest snapshot
+ * until the row changes (see rote_vt_damage), so the next snapshot only
+ * copies the rows that changed in between. The references are counted
+ * atomically: the snapshots are meant to be released on other threads. */
+
+RoteSnapRow *rote_snap_row_ref(RoteSnapRow *row) {
+   __atomic_add_fetch(&row->refs, 1, __ATOMIC_RELAXED);
+   return row;
+}
+
+void rote_snap_row_unref(RoteSnapRow *row) {
+   if (__atomic_sub_fetch(&row->refs, 1, __ATOMIC_ACQ_REL) == 0) free(row);
+}
+
+void rote_vt_drop_snap_row(RoteRow *row) {
+   rote_snap_row_unref(row->snap);
+   row->snap = NULL;
+}
+
+/* Copies the cells of a row, in one block: the planes of 16 bits first
+ * for their alignment, then the text and the attributes */
+static RoteSnapRow *copy_row(const RoteRow *row, int cols,
+                             unsigned long generation) {
+   bool has_glyph = row->glyph && memchr(row->text, ROTE_CELL_GLYPH, cols);
+   bool has_xattr = false;
+   size_t shorts;
+   RoteSnapRow *copy;
+   unsigned short *p;
+   int i;
+
+   for (i = 0; row->xattr && i < cols && !has_xattr; i++)
+      has_xattr = row->xattr[i] != 0;
+
+   shorts = (size_t) cols * ((has_glyph ? 1 : 0) + (has_xattr ? 1 : 0));
+   copy = (RoteSnapRow*) malloc(sizeof(RoteSnapRow) +
+                                sizeof(unsigned short) * shorts + 2 * cols);
+   if (!copy) return NULL;
+
+   copy->refs = 1;
+   copy->generation = generation;
+   copy->cols = cols;
+   p = (unsigned short*) (copy + 1);
+   copy->glyph = has_glyph ? p : NULL;
+   copy->xattr = has_xattr ? p + (has_glyph ? cols : 0) : NULL;
+   copy->text = (char*) (p + shorts);
+   copy->attr = (unsigned char*) copy->text + cols;
+
+   memcpy(copy->text, row->text, cols);
+   memcpy(copy->attr, row->attr, cols);
+   if (copy->glyph)
+      memcpy(copy->glyph, row->glyph, sizeof(unsigned short) * cols);
+   if (copy->xattr)
+      memcpy(copy->xattr, row->xattr, sizeof(unsigned short) * cols);
+   return copy;
+}
+
+RoteSnapshot *rote_vt_take_snapshot(RoteTerm *rt) {
+   RoteSnapshot *snap;
+   RoteRow *row;
+   int i;
+
+   snap = (RoteSnapshot*) malloc(sizeof(RoteSnapshot) +
+                                 sizeof(RoteSnapRow*) * rt->rows);
+   if (!snap) return NULL;
+   snap->refs = 1;
+   snap->generation = ++rt->pd->generation;
+   snap->rows = 0;
+   snap->cols = rt->cols;
+   snap->lines = (RoteSnapRow**) (snap + 1);
+
+   for (i = 0; i < rt->rows; i++) {
+      row = &rt->lines[i];
+      if (!row->snap &&
+          !(row->snap = copy_row(row, rt->cols, snap->generation))) {
+         rote_snapshot_unref(snap);
+         return NULL;
+      }
+      snap->lines[i] = rote_snap_row_ref(row->snap);
+      snap->rows++;
+   }
+   return snap;
+}
+
+bool rote_vt_restore_snapshot(RoteTerm *rt, const RoteSnapshot *snap) {
+   const RoteSnapRow *from;
+   RoteRow *row;
+   bool glyphs = false, xattrs = false;
+   int i;
+
+   if (snap->rows != rt->rows || snap->cols != rt->cols) return false;
+
+   /* the planes the snapshot needs, before touching any cell */
+   for (i = 0; i < snap->rows; i++) {
+      glyphs = glyphs || snap->lines[i]->glyph;
+      xattrs = xattrs || snap->lines[i]->xattr;
+   }
+   if (glyphs) rote_vt_alloc_glyphs(rt);
+   if (xattrs) rote_vt_alloc_xattrs(rt);
+   if ((glyphs && !rt->pd->screen.glyphbuf) ||
+       (xattrs && !rt->pd->screen.xattrbuf))
+      return false;
+
+   for (i = 0; i < rt->rows; i++) {
+      row = &rt->lines[i];
+      from = snap->lines[i];
+      if (row->snap == from) continue;
+
+      rote_vt_damage(rt, i, 0, rt->cols - 1);
+      memcpy(row->text, from->text, rt->cols);
+      memcpy(row->attr, from->attr, rt->cols);
+      if (from->glyph)
+         memcpy(row->glyph, from->glyph, sizeof(unsigned short) * rt->cols);
+      if (from->xattr)
+         memcpy(row->xattr, from->xattr, sizeof(unsigned short) * rt->cols);
+      else if (row->xattr)
+         memset(row->xattr, 0, sizeof(unsigned short) * rt->cols);
+
+      /* the row is that copy again */
+      row->snap = rote_snap_row_ref(snap->lines[i]);
+   }
+   return true;
+}
+
+RoteSnapshot *rote_snapshot_ref(RoteSnapshot *snap) {
+   __atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+   return snap;
+}
+
+void rote_snapshot_unref(RoteSnapshot *snap) {
+   int i;
+   if (!snap || __atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) != 0)
+      return;
+   for (i = 0; i < snap->rows; i++) rote_snap_row_unref(snap->lines[i]);
+   free(snap);
+}
@@ -0,0 +1,263 @@
+/*
+LICENSE INFORMATION:
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License (LGPL) as published by the Free Software Foundation.
+
+Please refer to the COPYING file for more information.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+*/
+
+
+#include "rote.h"
+#include "roteprivate.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* glyphs are allocated a page at a time, and a page never moves, so a
+ * glyph can be read while others are being added */
+#define GLYPH_PAGE_SIZE 256
+#define GLYPH_PAGES 256
+
+/* glyph numbers plus one must fit in the slots of the hash table */
+#define GLYPH_MAX (GLYPH_PAGE_SIZE * GLYPH_PAGES - 1)
+#define GLYPH_HASH_MIN 256
+
+typedef struct {
+   unsigned int first, last;
+} CodeRange;
+
+/* Combining marks and other characters of no width. An abridged version
+ * of the Unicode tables, covering the scripts seen in terminals; the
+ * emoji skin tone modifiers are here so that they join the emoji before
+ * them. */
+static const CodeRange zero_width[] = {
+   { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+   { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 },
+   { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F },
+   { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+   { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+   { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x0900, 0x0903 },
+   { 0x093A, 0x093C }, { 0x093E, 0x094F }, { 0x0951, 0x0957 },
+   { 0x0962, 0x0963 }, { 0x0981, 0x0983 }, { 0x09BC, 0x09BC },
+   { 0x09BE, 0x09CD }, { 0x0A01, 0x0A03 }, { 0x0A3C, 0x0A51 },
+   { 0x0A81, 0x0A83 }, { 0x0ABC, 0x0ABC }, { 0x0ABE, 0x0ACD },
+   { 0x0B01, 0x0B03 }, { 0x0B3C, 0x0B3C }, { 0x0B3E, 0x0B57 },
+   { 0x0BBE, 0x0BCD }, { 0x0C00, 0x0C04 }, { 0x0C3E, 0x0C56 },
+   { 0x0C81, 0x0C83 }, { 0x0CBC, 0x0CBC }, { 0x0CBE, 0x0CD6 },
+   { 0x0D00, 0x0D03 }, { 0x0D3E, 0x0D4D }, { 0x0E31, 0x0E31 },
+   { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 },
+   { 0x0EB4, 0x0EBC }, { 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 },
+   { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 }, { 0x0F39, 0x0F39 },
+   { 0x0F71, 0x0F84 }, { 0x102B, 0x103E }, { 0x1160, 0x11FF },
+   { 0x135D, 0x135F }, { 0x1712, 0x1714 }, { 0x17B4, 0x17D3 },
+   { 0x180B, 0x180F }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF },
+   { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 },
+   { 0x20D0, 0x20F0 }, { 0x302A, 0x302F }, { 0x3099, 0x309A },
+   { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF },
+   { 0x1F3FB, 0x1F3FF }, { 0xE0000, 0xE0FFF }
+};
+
+/* East Asian wide and fullwidth characters, and emoji */
+static const CodeRange double_width[] = {
+   { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+   { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 },
+   { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+   { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+   { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+   { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA },
+   { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA },
+   { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+   { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E },
+   { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+   { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C },
+   { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+   { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF },
+   { 0xA000, 0xA4CF }, { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 },
+   { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F },
+   { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x1F004, 0x1F004 },
+   { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A },
+   { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F64F }, { 0x1F680, 0x1F6FF },
+   { 0x1F7E0, 0x1F7EB }, { 0x1F900, 0x1F9FF }, { 0x1FA70, 0x1FAFF },
+   { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD }
+};
+
+static bool in_ranges(unsigned int cp, const CodeRange *ranges, int count) {
+   int lo = 0, hi = count - 1, mid;
+   if (cp < ranges[0].first || cp > ranges[hi].last) return false;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (cp > ranges[mid].last)       lo = mid + 1;
+      else if (cp < ranges[mid].first) hi = mid - 1;
+      else                             return true;
+   }
+   return false;
+}
+
+int rote_wcwidth(unsigned int cp) {
+   if (cp < 0x20 || (cp >= 0x7F && cp < 0xA0)) return -1;
+   if (in_ranges(cp, zero_width, sizeof(zero_width) / sizeof(CodeRange)))
+      return 0;
+   if (in_ranges(cp, double_width, sizeof(double_width) / sizeof(CodeRange)))
+      return 2;
+   return 1;
+}
+
+int rote_utf8_encode(unsigned int cp, char *buf) {
+   if (cp < 0x80) {
+      buf[0] = cp;
+      return 1;
+   }
+   if (cp < 0x800) {
+      buf[0] = 0xC0 | (cp >> 6);
+      buf[1] = 0x80 | (cp & 0x3F);
+      return 2;
+   }
+   if (cp < 0x10000) {
+      buf[0] = 0xE0 | (cp >> 12);
+      buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+      buf[2] = 0x80 | (cp & 0x3F);
+      return 3;
+   }
+   buf[0] = 0xF0 | (cp >> 18);
+   buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+   buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+   buf[3] = 0x80 | (cp & 0x3F);
+   return 4;
+}
+
+void rote_vt_alloc_glyphs(RoteTerm *rt) {
+   int i;
+   if (rt->pd->screen.glyphbuf) return;
+
+   rt->pd->screen.glyphbuf = (unsigned short*) calloc(rt->rows * rt->cols,
+                                               sizeof(unsigned short));
+   if (!rt->pd->screen.glyphbuf) return;
+   for (i = 0; i < rt->rows; i++)
+      rt->lines[i].glyph = rt->pd->screen.glyphbuf + i * rt->cols;
+}
+
+/* Whether the cells col - 1 and col hold the halves of a wide glyph. The
+ * first is checked too: the cell may be a stale one, left behind by a
+ * memmove of the row. */
+static inline bool is_wide_at(RoteTerm *rt, RoteRow *row, int col) {
+   return col > 0 && col < rt->cols &&
+          (unsigned char) row->text[col] == ROTE_CELL_WIDE_TAIL &&
+          (unsigned char) row->text[col - 1] == ROTE_CELL_GLYPH;
+}
+
+void rote_vt_split_wide(RoteTerm *rt, RoteRow *row, int col, int n) {
+   if (!row->glyph) return;  /* no glyphs, let alone wide ones */
+
+   if (is_wide_at(rt, row, col)) {
+      row->text[col - 1] = row->text[col] = ' ';
+      rote_vt_damage(rt, row - rt->lines, col - 1, col);
+   }
+   if (is_wide_at(rt, row, col + n)) {
+      row->text[col + n - 1] = row->text[col + n] = ' ';
+      rote_vt_damage(rt, row - rt->lines, col + n - 1, col + n);
+   }
+}
+
+static inline RoteGlyph *glyph_at(RoteTermPrivate *pd, int n) {
+   return &pd->glyph_pages[n / GLYPH_PAGE_SIZE][n % GLYPH_PAGE_SIZE];
+}
+
+/* FNV-1a */
+static unsigned int glyph_hash(const char *utf8, int len) {
+   unsigned int h = 2166136261u;
+   while (len--) h = (h ^ (unsigned char) *utf8++) * 16777619u;
+   return h;
+}
+
+/* Doubles the hash table, keeping it at most half full */
+static bool glyph_hash_grow(RoteTermPrivate *pd) {
+   int size = pd->glyph_hash_size ? pd->glyph_hash_size * 2 : GLYPH_HASH_MIN;
+   unsigned short *hash = (unsigned short*) calloc(size, sizeof(unsigned short));
+   const RoteGlyph *g;
+   int i, slot;
+   if (!hash) return false;
+
+   for (i = 0; i < pd->glyph_count; i++) {
+      g = glyph_at(pd, i);
+      slot = glyph_hash(g->utf8, strlen(g->utf8)) & (size - 1);
+      while (hash[slot]) slot = (slot + 1) & (size - 1);
+      hash[slot] = i + 1;
+   }
+
+   free(pd->glyph_hash);
+   pd->glyph_hash = hash;
+   pd->glyph_hash_size = size;
+   return true;
+}
+
+/* Appends a glyph to the table, returns its number or -1 */
+static int glyph_add(RoteTermPrivate *pd, const char *utf8, int len,
+                     int width) {
+   int n = pd->glyph_count;
+   RoteGlyph *g;
+   if (n >= GLYPH_MAX) return -1;
+
+   if (!pd->glyph_pages &&
+       !(pd->glyph_pages = (RoteGlyph**) calloc(GLYPH_PAGES, sizeof(RoteGlyph*))))
+      return -1;
+   if (n % GLYPH_PAGE_SIZE == 0 &&
+       !(pd->glyph_pages[n / GLYPH_PAGE_SIZE] =
+            (RoteGlyph*) malloc(sizeof(RoteGlyph) * GLYPH_PAGE_SIZE)))
+      return -1;
+
+   g = glyph_at(pd, n);
+   memcpy(g->utf8, utf8, len);
+   g->utf8[len] = '\0';
+   g->width = width;
+   pd->glyph_count++;
+   return n;
+}
+
+unsigned short rote_vt_intern_glyph(RoteTerm *rt, const char *utf8, int len,
+                                    int width) {
+   RoteTermPrivate *pd = rt->pd;
+   const RoteGlyph *g;
+   int slot, n;
+   if (len <= 0 || len >= ROTE_GLYPH_BYTES) return 0;
+
+   /* glyph 0, the replacement character */
+   if (pd->glyph_count == 0 && glyph_add(pd, "\xEF\xBF\xBD", 3, 1) < 0)
+      return 0;
+   if ((pd->glyph_count + 1) * 2 > pd->glyph_hash_size &&
+       !glyph_hash_grow(pd))
+      return 0;
+
+   slot = glyph_hash(utf8, len) & (pd->glyph_hash_size - 1);
+   for (; pd->glyph_hash[slot]; slot = (slot + 1) & (pd->glyph_hash_size - 1)) {
+      g = glyph_at(pd, pd->glyph_hash[slot] - 1);
+      if (!memcmp(g->utf8, utf8, len) && !g->utf8[len])
+         return pd->glyph_hash[slot] - 1;
+   }
+
+   if ((n = glyph_add(pd, utf8, len, width)) < 0) return 0;
+   pd->glyph_hash[slot] = n + 1;
+   return n;
+}
+
+const RoteGlyph *rote_vt_get_glyph(RoteTerm *rt, unsigned short n) {
+   return glyph_at(rt->pd, n);
+}
+
+void rote_vt_free_glyphs(RoteTerm *rt) {
+   RoteTermPrivate *pd = rt->pd;
+   int i;
+   if (pd->glyph_pages) {
+      for (i = 0; i < GLYPH_PAGES; i++) free(pd->glyph_pages[i]);
+      free(pd->glyph_pages);
+   }
+   free(pd->glyph_hash);
+}
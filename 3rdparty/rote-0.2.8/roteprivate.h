@@ -24,29 +24,191 @@ Copyright (c) 2004 Bruno T. C. de Oliveira
 
 #define ESEQ_BUF_SIZE 128  /* size of escape sequence buffer */
 #define MAX_CUSTOM_ES_HANDLERS 32
+#define MAX_CSI_ES_PARAMS 32
+
+/* The cells of a screen: the primary one, or the alternate one that
+ * full-screen programs switch to */
+typedef struct RoteScreen_ {
+   char *textbuf;             /* the text plane of all the cells, one
+                               * contiguous block the rows point into */
+   unsigned char *attrbuf;    /* the attribute plane, likewise */
+   RoteRow *rowbuf;           /* room for 3 * rows rows; rt->lines is a
+                               * window of it that slides by a row on
+                               * every full-screen scroll */
+   int rowoff;                /* offset of rt->lines in rowbuf */
+   unsigned short *glyphbuf;  /* the glyph plane, allocated along with
+                               * the first glyph */
+   unsigned short *xattrbuf;  /* the xattr plane, allocated along with the
+                               * first extended color */
+} RoteScreen;
 
 /* Terminal private data */
 struct RoteTermPrivate_ {
-   bool escaped;              /* whether we are currently reading an
-                               * escape sequence */
+   unsigned char state;       /* state of the escape sequence parser,
+                               * see inject.c; 0 is the ground state */
+   bool handler_seq;          /* whether the sequence being read goes to
+                               * the custom handler first, through esbuf */
+
+   int csiparam[MAX_CSI_ES_PARAMS + 1]; /* parameters of the CSI sequence
+                               * being read; extra ones all go to the
+                               * last, unused slot */
+   int csiparam_count;        /* parameters started so far, up to
+                               * MAX_CSI_ES_PARAMS + 1 */
+   char csiprivate;           /* private marker (one of <=>?) of the
+                               * sequence, 0 for none */
+   char intermediate;         /* first intermediate byte of the sequence,
+                               * 0 for none */
 
    bool graphmode;            /* whether terminal is in graphical 
                                * character mode or not */
 
+   unsigned int utf8_cp;      /* code point being decoded */
+   unsigned int utf8_min;     /* least code point its length may encode,
+                               * anything below is an overlong form */
+   int utf8_left;             /* continuation bytes still expected */
+
    int scrolltop, scrollbottom;  /* current scrolling region of terminal */
+
+   RoteScreen screen;         /* the screen shown, rt->lines is its rows */
+   RoteScreen other;          /* the screen not shown: the alternate one,
+                               * all NULL until first used, or the primary
+                               * one while the alternate one is shown */
+   bool altscreen;            /* whether the alternate screen is shown */
+   RoteRow *rowtmp;           /* scratch for rote_vt_rotate_rows */
+   unsigned long generation;  /* snapshots taken so far */
+
+   RoteGlyph **glyph_pages;   /* the interned glyphs, GLYPH_PAGE_SIZE a
+                               * page; the array of pages never moves */
+   int glyph_count;           /* glyphs interned so far */
+   unsigned short *glyph_hash; /* open addressing table of glyph numbers
+                               * plus one, 0 for an empty slot */
+   int glyph_hash_size;       /* slots in glyph_hash, a power of 2 */
+
+   unsigned int curfg, curbg; /* extended colors of curattr, 0 for none */
+   unsigned short curxattr;   /* their extended attribute */
+   RoteXAttr **xattr_pages;   /* the interned extended attributes, paged
+                               * like the glyphs */
+   int xattr_count;           /* extended attributes interned so far */
+   unsigned short *xattr_hash; /* open addressing table of their numbers
+                               * plus one, 0 for an empty slot */
+   int xattr_hash_size;       /* slots in xattr_hash, a power of 2 */
    int saved_x, saved_y;         /* saved cursor position */
 
-   char esbuf[ESEQ_BUF_SIZE]; /* 0-terminated string. Does NOT include
-                               * the initial escape (\x1B) character. */
+   char esbuf[ESEQ_BUF_SIZE]; /* 0-terminated string, only kept for the
+                               * custom handler. Does NOT include the
+                               * initial escape (\x1B) character. */
    int esbuf_len;             /* length of buffer. The following property
                                * is always kept: esbuf[esbuf_len] == '\0' */
 
    int pty;                   /* file descriptor for the pty attached to
                                * this terminal. -1 if none. */
 
+   char *outbuf;              /* bytes written with rote_vt_write that the
+                               * pty didn't accept yet, see rote_vt_flush */
+   int outbuf_len;            /* number of queued bytes */
+   int outbuf_size;           /* allocated size of outbuf */
+   bool defer_output;         /* whether rote_vt_write only queues, leaving
+                               * the actual writes to the caller */
+
    /* custom escape sequence handler */
    rote_es_handler_t handler;
+
+   /* callback receiving the lines scrolled off the screen, and its data */
+   rote_scroll_handler_t scroll_handler;
+   void *scroll_data;
 };
 
+/* Records that columns first..last of the row are to be drawn again
+ * although their cells didn't change, e.g. because the row moved: its
+ * copy in the latest snapshot still holds */
+static inline void rote_vt_redraw(RoteTerm *rt, int row, int first, int last) {
+   RoteSpan *span = &rt->line_damage[row];
+   if (!rt->line_dirty[row]) {
+      rt->line_dirty[row] = true;
+      span->first = first;
+      span->last = last;
+      return;
+   }
+   if (first < span->first) span->first = first;
+   if (last > span->last) span->last = last;
+}
+
+/* Drops the row's copy in the latest snapshot, the next one copies the
+ * row anew */
+void rote_vt_drop_snap_row(RoteRow *row);
+
+/* Records that columns first..last of the row changed, see
+ * rote_vt_mark_damage; inline for the character by character paths */
+static inline void rote_vt_damage(RoteTerm *rt, int row, int first, int last) {
+   if (rt->lines[row].snap) rote_vt_drop_snap_row(&rt->lines[row]);
+   rote_vt_redraw(rt, row, first, last);
+}
+
+/* Fills n cells of the row from column col with blanks of attribute attr
+ * and extended attribute xattr */
+void rote_vt_fill_cells(RoteTerm *rt, RoteRow *row, int col, int n,
+                        unsigned char attr, unsigned short xattr);
+
+/* Returns the length of the run of printable ASCII bytes (none of 0..31
+ * nor 128..255) at the start of data, scanning up to len bytes */
+int rote_vt_scan_printable(const char *data, int len);
+
+/* Writes n characters into n cells of the row from column col, all with
+ * attribute attr and extended attribute xattr */
+void rote_vt_store_cells(RoteTerm *rt, RoteRow *row, int col,
+                         const char *data, int n, unsigned char attr,
+                         unsigned short xattr);
+
+/* Before cells col..col+n-1 of the row are overwritten or moved, blanks
+ * both halves of the wide glyphs that straddle either end of them */
+void rote_vt_split_wide(RoteTerm *rt, RoteRow *row, int col, int n);
+
+/* Allocates the glyph plane of the rows of the screen shown, if it
+ * isn't yet */
+void rote_vt_alloc_glyphs(RoteTerm *rt);
+
+/* Returns the number of the glyph made of the len bytes of UTF-8 in utf8,
+ * interning it with the given width if it is new */
+unsigned short rote_vt_intern_glyph(RoteTerm *rt, const char *utf8, int len,
+                                    int width);
+
+/* Frees the glyph table */
+void rote_vt_free_glyphs(RoteTerm *rt);
+
+/* Columns taken by the code point: 0 for combining marks and other zero
+ * width characters, 2 for wide ones, -1 for C1 controls */
+int rote_wcwidth(unsigned int cp);
+
+/* Encodes the code point as UTF-8 into buf, which has room for 4 bytes,
+ * and returns the number of bytes */
+int rote_utf8_encode(unsigned int cp, char *buf);
+
+/* Returns the nearest of the 8 attribute colors to an extended color */
+int rote_color_basic(unsigned int color);
+
+/* Interns the extended colors of the current attribute, pd->curfg and
+ * pd->curbg, as pd->curxattr, allocating the xattr plane if need be */
+void rote_vt_update_xattr(RoteTerm *rt);
+
+/* Allocates the xattr plane of the rows of the screen shown, if it
+ * isn't yet */
+void rote_vt_alloc_xattrs(RoteTerm *rt);
+
+/* Frees the table of extended attributes */
+void rote_vt_free_xattrs(RoteTerm *rt);
+
+/* Shows the alternate screen, allocating it on first use, or the primary
+ * one again; the cursor and the scrolling region are left as they are.
+ * Returns false if memory ran out. */
+bool rote_vt_set_alt_screen(RoteTerm *rt, bool alt);
+
+/* Rotates rows top..bottom of the terminal by n lines, up if n > 0
+ * (like a line feed at the bottom), down if n < 0, and clears the rows
+ * that came around with attribute attr and extended attribute xattr.
+ * Only the RoteRow move, not the cells: scrolling the whole screen is
+ * O(1), a sub-region costs one RoteRow per row. */
+void rote_vt_rotate_rows(RoteTerm *rt, int top, int bottom, int n,
+                         unsigned char attr, unsigned short xattr);
+
 #endif
 
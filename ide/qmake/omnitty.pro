@@ -7,6 +7,7 @@ CONFIG -= qt
 
 
 QMAKE_CXXFLAGS += -std=c++0x -g
+DEFINES += _XOPEN_SOURCE_EXTENDED
 
 
 macx {
@@ -16,7 +17,7 @@ INCLUDEPATH += /usr/local/include/
 
 unix:!macx{
 LIBS += -L/usr/local/lib -lrote -llog4cplus
-LIBS += -L/usr/lib/x86_64-linux-gnu -lncurses -ljsoncpp
+LIBS += -L/usr/lib/x86_64-linux-gnu -lncursesw -ljsoncpp -lpthread
 INCLUDEPATH += /usr/include
 INCLUDEPATH += /usr/local/include
 }
@@ -30,7 +31,18 @@ SOURCES += \
     ../../src/machine_manager.cpp \
     ../../src/window_manager.cpp \
     ../../src/config.cpp \
-    ../../src/opt_parser.cpp
+    ../../src/opt_parser.cpp \
+    ../../src/event_loop.cpp \
+    ../../src/terminal_worker.cpp \
+    ../../src/child_reaper.cpp \
+    ../../src/io_backend.cpp \
+    ../../src/io_uring_backend.cpp \
+    ../../src/transcript.cpp \
+    ../../src/raw_ring.cpp \
+    ../../src/timer_wheel.cpp \
+    ../../src/frame_scheduler.cpp \
+    ../../src/scrollback.cpp \
+    ../../src/color_pair_cache.cpp
 
 HEADERS += \
     ../../src/curutil.h \
@@ -41,6 +53,18 @@ HEADERS += \
     ../../src/log.h \
     ../../src/config.h \
     ../../src/opt_parser.h \
-    ../../src/utils.h
+    ../../src/utils.h \
+    ../../src/event_loop.h \
+    ../../src/terminal_worker.h \
+    ../../src/screen_snapshot.h \
+    ../../src/child_reaper.h \
+    ../../src/io_backend.h \
+    ../../src/io_uring_backend.h \
+    ../../src/transcript.h \
+    ../../src/raw_ring.h \
+    ../../src/timer_wheel.h \
+    ../../src/frame_scheduler.h \
+    ../../src/scrollback.h \
+    ../../src/color_pair_cache.h
 
 
@@ -0,0 +1,207 @@
+/**
+ * @brief Measures what it costs omnitty's I/O backends to drain flooding ptys.
+ * @details Each pty runs a child that writes SIZE_MB of 80 column lines. The
+ *          ptys are drained into their terminals by the backend picked on the
+ *          command line, from OmniIoBackend::Create(), with the deficit round
+ *          robin of OmniTerminalWorker::ScheduleReads() and the default read
+ *          budget and quantum. Snapshots aren't published, the terminals are
+ *          parsed as they're read.
+ *
+ *          The program prints the syscalls it made and its CPU time, both per
+ *          GB of terminal output. It counts the syscalls itself, there may be
+ *          no strace around: read(), ioctl(), epoll_wait() and syscall(), which
+ *          the io_uring backend enters the ring with, are interposed below, in
+ *          omnitty's code and in rote's alike. Linux only.
+ *
+ *              omnitty_iobench poll 8 64
+ *              omnitty_iobench io_uring 8 64
+ */
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <log4cplus/consoleappender.h>
+#include "log.h"
+#include "config.h"
+#include "machine.h"
+#include "io_backend.h"
+#include "event_loop.h"
+
+
+using namespace omnitty;
+
+
+#define PTYS_MAX 64
+#define TERMINAL_ROWS 40
+#define TERMINAL_COLS 140
+/* same cap on a machine's deficit as the terminal worker */
+#define READ_DEFICIT_MAX_QUANTA 4
+
+
+static unsigned long syscalls = 0;
+
+
+template <typename Function>
+static Function RealFunction(const char *name)
+{
+    return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+
+extern "C" ssize_t read(int fd, void *buf, size_t count)
+{
+    static auto realRead = RealFunction<ssize_t (*)(int, void *, size_t)>("read");
+    ++syscalls;
+    return realRead(fd, buf, count);
+}
+
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    static auto realIoctl = RealFunction<int (*)(int, unsigned long, void *)>("ioctl");
+    va_list args;
+    va_start(args, request);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+    ++syscalls;
+    return realIoctl(fd, request, arg);
+}
+
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxEvents, int timeoutMs)
+{
+    static auto realEpollWait = RealFunction<int (*)(int, struct epoll_event *, int, int)>("epoll_wait");
+    ++syscalls;
+    return realEpollWait(epfd, events, maxEvents, timeoutMs);
+}
+
+
+extern "C" long syscall(long number, ...) __THROW
+{
+    static auto realSyscall = RealFunction<long (*)(long, ...)>("syscall");
+    /* the io_uring calls take up to 6 arguments, all passed as registers */
+    va_list args;
+    va_start(args, number);
+    long a[6];
+    for (long &arg : a) arg = va_arg(args, long);
+    va_end(args);
+    ++syscalls;
+    return realSyscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+
+static double Seconds(const struct timeval &tv)
+{
+    return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+}
+
+
+int main(int argc, char **argv)
+{
+    int ptys = argc == 4 ? atoi(argv[2]) : 0;
+    long long megabytes = argc == 4 ? atoll(argv[3]) : 0;
+    if (ptys < 1 || ptys > PTYS_MAX || megabytes < 1) {
+        fprintf(stderr, "usage: %s poll|io_uring PTYS SIZE_MB\n", argv[0]);
+        return 2;
+    }
+
+    log4cplus::Logger logger = log4cplus::Logger::getInstance(omnitty::LOGGER_NAME);
+    logger.addAppender(log4cplus::SharedAppenderPtr(new log4cplus::ConsoleAppender(true)));
+    logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+
+    std::deque<MachinePtr> readQueue;
+    auto onReadable = [&readQueue](const MachinePtr &machine) {
+        if (!machine->IsReadPending()) {
+            machine->SetIsReadPending(true);
+            readQueue.push_back(machine);
+        }
+    };
+    OmniEventLoop eventLoop;
+    std::unique_ptr<OmniIoBackend> ioBackend = OmniIoBackend::Create(argv[1]);
+    if (!eventLoop.Init() || !ioBackend ||
+        !ioBackend->Init(eventLoop, onReadable, [](const MachinePtr &) {})) {
+        fprintf(stderr, "io backend %s unavailable\n", argv[1]);
+        return 1;
+    }
+
+    /* 79 characters and a newline, the pty turns it into \r\n */
+    char command[128];
+    snprintf(command, sizeof(command), "yes %079d | head -c %lld", 0, megabytes << 20);
+    OmniConfig *config = OmniConfig::GetInstance();
+    std::vector<MachinePtr> machines;
+    for (int i = 0; i < ptys; ++i) {
+        machines.push_back(std::make_shared<OmniMachine>("flood", "10.0.0." + std::to_string(i), command,
+            TERMINAL_ROWS, TERMINAL_COLS, config->GetRawRingBytes(), config->GetScrollbackLines()));
+        if (machines.back()->GetPid() < 0 || !ioBackend->AddMachine(machines.back())) {
+            fprintf(stderr, "cannot start pty %d\n", i);
+            return 1;
+        }
+    }
+
+    /* the worker submits at the end of the tick that added the machines */
+    ioBackend->Submit();
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    syscalls = 0;
+    unsigned long long bytes = 0;
+    int alive = ptys;
+    while (alive > 0) {
+        /* a tick of OmniTerminalWorker::RunOnce() */
+        eventLoop.Wait(readQueue.empty() ? -1 : 0);
+
+        uint32_t budget = config->GetReadBudget();
+        uint32_t quantum = config->GetReadQuantum();
+        while (!readQueue.empty() && budget > 0) {
+            MachinePtr machine = readQueue.front();
+            readQueue.pop_front();
+
+            uint32_t deficit = std::min(machine->GetReadDeficit() + quantum, quantum * READ_DEFICIT_MAX_QUANTA);
+            uint32_t want = std::min(deficit, budget);
+            int bytesRead = ioBackend->Read(machine, static_cast<int>(want));
+            int backlog = bytesRead < 0 ? 0 : ioBackend->GetPendingInput(machine);
+            if (bytesRead < 0) {
+                /* the child is done */
+                ioBackend->RemoveMachine(machine);
+                machine->SetIsReadPending(false);
+                --alive;
+                continue;
+            }
+
+            bytes += static_cast<unsigned long long>(bytesRead);
+            budget -= bytesRead;
+            deficit -= bytesRead;
+            if (static_cast<uint32_t>(bytesRead) == want || backlog > 0) {
+                machine->SetReadDeficit(deficit);
+                readQueue.push_back(machine);
+            } else {
+                machine->SetReadDeficit(0);
+                machine->SetIsReadPending(false);
+            }
+        }
+        ioBackend->Submit();
+    }
+    gettimeofday(&end, NULL);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = Seconds(usage.ru_utime) + Seconds(usage.ru_stime);
+    double gigabytes = static_cast<double>(bytes) / (1 << 30);
+    printf("%-8s %2d ptys  %7.1f MB  %5.2f s  syscalls %9lu (%7.0f/GB)  "
+           "cpu user %5.2f sys %5.2f s (%5.2f s/GB)\n",
+           ioBackend->GetName(), ptys, static_cast<double>(bytes) / (1 << 20), Seconds(end) - Seconds(start),
+           syscalls, static_cast<double>(syscalls) / gigabytes,
+           Seconds(usage.ru_utime), Seconds(usage.ru_stime), cpu / gigabytes);
+
+    for (auto &machine : machines) waitpid(machine->GetPid(), NULL, 0);
+    return 0;
+}
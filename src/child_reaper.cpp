@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifndef __APPLE__
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#endif
+#include "log.h"
+#include "child_reaper.h"
+
+
+using namespace omnitty;
+
+
+OmniChildReaper::OmniChildReaper()
+    : m_readFd(-1), m_writeFd(-1)
+{
+}
+
+
+#ifdef __APPLE__
+
+/* write end of the pipe of the only reaper, used by the signal handler */
+static volatile int SIGCHLD_PIPE_FD = -1;
+
+
+static void SigchldHandler(int)
+{
+    int savedErrno = errno;
+    char c = 0;
+    /* a full pipe is as good as a successful write */
+    ssize_t ret = write(SIGCHLD_PIPE_FD, &c, 1);
+    (void)ret;
+    errno = savedErrno;
+}
+
+
+void OmniChildReaper::BlockSignal()
+{
+}
+
+
+OmniChildReaper::~OmniChildReaper()
+{
+    signal(SIGCHLD, SIG_DFL);
+    SIGCHLD_PIPE_FD = -1;
+    if (m_writeFd >= 0) close(m_writeFd);
+    if (m_readFd >= 0) close(m_readFd);
+}
+
+
+bool OmniChildReaper::Init()
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "pipe failed, errno: %d", errno);
+        return false;
+    }
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    m_readFd = fds[0];
+    m_writeFd = fds[1];
+    SIGCHLD_PIPE_FD = m_writeFd;
+
+    struct sigaction action;
+    action.sa_handler = SigchldHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &action, NULL) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "sigaction failed, errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+
+static void DrainNotifications(int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) ;
+}
+
+#else
+
+/* thread owning the signalfd of the only reaper, used by the signal handler */
+static volatile pid_t SIGCHLD_REAPER_TID = 0;
+
+
+/* only runs on the threads started before BlockSignal() (e.g. by a library's
+ * static initializers), which would otherwise swallow the signal: sends it
+ * again to the reaper's thread, where it's blocked and lands in the signalfd */
+static void SigchldHandler(int)
+{
+    int savedErrno = errno;
+    if (SIGCHLD_REAPER_TID > 0) syscall(SYS_tgkill, getpid(), SIGCHLD_REAPER_TID, SIGCHLD);
+    errno = savedErrno;
+}
+
+
+OmniChildReaper::~OmniChildReaper()
+{
+    signal(SIGCHLD, SIG_DFL);
+    SIGCHLD_REAPER_TID = 0;
+    if (m_readFd >= 0) close(m_readFd);
+}
+
+
+void OmniChildReaper::BlockSignal()
+{
+    /* an ignored SIGCHLD (possibly inherited) makes the kernel reap the
+     * children on its own and never raise the signal */
+    signal(SIGCHLD, SIG_DFL);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    /* a blocked signal stays pending and is delivered through the fd only */
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+
+bool OmniChildReaper::Init()
+{
+    BlockSignal();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    m_readFd = m_writeFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (m_readFd < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "signalfd failed, errno: %d", errno);
+        return false;
+    }
+
+    SIGCHLD_REAPER_TID = static_cast<pid_t>(syscall(SYS_gettid));
+    struct sigaction action;
+    action.sa_handler = SigchldHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &action, NULL) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "sigaction failed, errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+
+static void DrainNotifications(int fd)
+{
+    struct signalfd_siginfo infos[16];
+    while (read(fd, infos, sizeof(infos)) > 0) ;
+}
+
+#endif
+
+
+int OmniChildReaper::Reap(const ReapCallback &callback)
+{
+    DrainNotifications(m_readFd);
+
+    int count = 0;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        callback(pid, status);
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <functional>
+#include <sys/types.h>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Turns SIGCHLD into a readable descriptor for the event loop.
+ * @details Uses a signalfd on Linux, and a pipe written by the signal handler
+ *          on MacOS. Several deaths may be folded into a single notification,
+ *          so Reap() collects every exited child with waitpid(WNOHANG) until
+ *          none is left.
+ *
+ *          On Linux SIGCHLD has to be blocked in every thread, or it may be
+ *          consumed by a thread that doesn't block it, call BlockSignal()
+ *          before any thread is started. Threads that predate main() can't
+ *          be covered, the reaper's handler forwards the signal they catch
+ *          to the thread that called Init(), which must be the one reading
+ *          the signalfd. Forked children have to restore their signal mask
+ *          before exec.
+ */
+class OmniChildReaper
+{
+public:
+    /**
+     * @brief Called with the pid and the wait status of each reaped child.
+     */
+    typedef std::function<void(pid_t pid, int status)> ReapCallback;
+
+
+    OmniChildReaper();
+
+
+    ~OmniChildReaper();
+
+
+    /**
+     * @brief Blocks SIGCHLD for the calling thread and the threads it creates
+     *        afterwards. Does nothing on MacOS.
+     */
+    static void BlockSignal();
+
+
+    bool Init();
+
+
+    /**
+     * @brief Consumes the pending notifications and reaps all exited children.
+     * @return the number of reaped children
+     */
+    int Reap(const ReapCallback &callback);
+
+
+    /**
+     * @brief GetFd
+     * @return a descriptor that is readable when a child has exited
+     */
+    int GetFd() const { return m_readFd; }
+
+
+protected:
+    OmniChildReaper(const OmniChildReaper &) = delete;
+    OmniChildReaper &operator=(const OmniChildReaper &) = delete;
+
+
+private:
+    int     m_readFd;
+    int     m_writeFd;
+};
+
+
+}
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include "log.h"
+#include "curutil.h"
+#include "color_pair_cache.h"
+
+
+/* pairs 1 - 63 are the basic ones, see CurutilColorpairInit() */
+#define FIRST_EXTENDED_PAIR 64
+/* bounds the cache, a screen rarely shows more color combinations */
+#define MAX_EXTENDED_PAIRS 4096
+/* direct color terminals take the RGB value as color number */
+#define DIRECT_COLORS 0x1000000
+
+/* init_extended_pair() and pair numbers beyond a short came with ncurses 6.1 */
+#if defined(NCURSES_EXT_COLORS) && NCURSES_EXT_COLORS >= 20180127
+#define HAS_EXTENDED_PAIRS 1
+#else
+#define HAS_EXTENDED_PAIRS 0
+/* without them, the pair must fit in the A_COLOR bits of an attribute */
+#define MAX_SHORT_PAIRS 256
+#endif
+
+
+using namespace omnitty;
+
+
+/* the 8 bright colors of the 256 color palette, then the levels of its
+ * 6x6x6 color cube */
+static const uint8_t BRIGHT_COLORS[8][3] = {
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+    {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+};
+static const uint8_t CUBE_LEVELS[6] = {0, 95, 135, 175, 215, 255};
+
+
+static uint32_t PaletteToRgb(int index)
+{
+    const uint8_t *bright = BRIGHT_COLORS[index & 7];
+    if (index < 16) return (bright[0] << 16) | (bright[1] << 8) | bright[2];
+    if (index < 232) {
+        index -= 16;
+        return (CUBE_LEVELS[index / 36] << 16) | (CUBE_LEVELS[index / 6 % 6] << 8) | CUBE_LEVELS[index % 6];
+    }
+    uint32_t gray = 8 + (index - 232) * 10;
+    return (gray << 16) | (gray << 8) | gray;
+}
+
+
+static int CubeIndex(int level)
+{
+    return level < 48 ? 0 : level < 115 ? 1 : (level - 35) / 40;
+}
+
+
+/* the nearest color of the cube or of the gray ramp */
+static int RgbToPalette(int r, int g, int b)
+{
+    int cr = CubeIndex(r), cg = CubeIndex(g), cb = CubeIndex(b);
+    int cubeDistance = (r - CUBE_LEVELS[cr]) * (r - CUBE_LEVELS[cr]) + (g - CUBE_LEVELS[cg]) * (g - CUBE_LEVELS[cg]) +
+                       (b - CUBE_LEVELS[cb]) * (b - CUBE_LEVELS[cb]);
+
+    int average = (r + g + b) / 3;
+    int grayIndex = average > 238 ? 23 : std::max(average - 3, 0) / 10;
+    int gray = 8 + grayIndex * 10;
+    int grayDistance = (r - gray) * (r - gray) + (g - gray) * (g - gray) + (b - gray) * (b - gray);
+
+    return grayDistance < cubeDistance ? 232 + grayIndex : 16 + cr * 36 + cg * 6 + cb;
+}
+
+
+OmniColorPairCache::OmniColorPairCache()
+    : m_firstPair(FIRST_EXTENDED_PAIR), m_pairCount(0)
+{
+}
+
+
+void OmniColorPairCache::Init()
+{
+    int pairs = COLOR_PAIRS;
+#if !HAS_EXTENDED_PAIRS
+    pairs = std::min(pairs, MAX_SHORT_PAIRS);
+#endif
+    m_pairCount = std::max(0, std::min(pairs - m_firstPair, MAX_EXTENDED_PAIRS));
+    m_lru.clear();
+    m_pairs.clear();
+    LOG4CPLUS_INFO_FMT(LOGGER_NAME, "colors: %d, pairs for extended colors: %d", COLORS, m_pairCount);
+}
+
+
+void OmniColorPairCache::Attrset(WINDOW *wnd, unsigned char attr, const RoteXAttr *xattr)
+{
+    int fg = (xattr && xattr->fg) ? ToCursesColor(xattr->fg) : -1;
+    int bg = (xattr && xattr->bg) ? ToCursesColor(xattr->bg) : -1;
+    int pair = (fg >= 0 || bg >= 0) ? GetPair(fg >= 0 ? fg : ROTE_ATTR_FG(attr), bg >= 0 ? bg : ROTE_ATTR_BG(attr)) : -1;
+    if (pair < 0) {
+        CurutilAttrset(wnd, attr);
+        return;
+    }
+
+    attr_t attrs = A_NORMAL;
+    if (ROTE_ATTR_BOLD(attr)) attrs |= A_BOLD;
+    if (ROTE_ATTR_BLINK(attr)) attrs |= A_BLINK;
+#if HAS_EXTENDED_PAIRS
+    wattr_set(wnd, attrs, 0, &pair);
+#else
+    wattr_set(wnd, attrs, static_cast<short>(pair), nullptr);
+#endif
+}
+
+
+int OmniColorPairCache::ToCursesColor(uint32_t color) const
+{
+    if (!ROTE_COLOR_IS_RGB(color)) {
+        int index = ROTE_COLOR_INDEX(color);
+        /* the first 8 stay colors in direct color terminals, the others don't */
+        if (COLORS >= DIRECT_COLORS) return index < 8 ? index : PaletteToRgb(index);
+        return index < COLORS ? index : -1;
+    }
+
+    int r = ROTE_COLOR_R(color), g = ROTE_COLOR_G(color), b = ROTE_COLOR_B(color);
+    if (COLORS >= DIRECT_COLORS) return (r << 16) | (g << 8) | b;
+    return COLORS >= 256 ? RgbToPalette(r, g, b) : -1;
+}
+
+
+int OmniColorPairCache::GetPair(int fg, int bg)
+{
+    uint64_t key = (static_cast<uint64_t>(fg) << 32) | static_cast<uint32_t>(bg);
+    auto iter = m_pairs.find(key);
+    if (iter != m_pairs.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, iter->second.m_lruEntry);
+        return iter->second.m_pair;
+    }
+    if (m_pairCount == 0) return -1;
+
+    /* a recycled pair changes the colors of the cells still drawn with it,
+     * until they're drawn again */
+    int pair;
+    if (static_cast<int>(m_pairs.size()) < m_pairCount) {
+        pair = m_firstPair + static_cast<int>(m_pairs.size());
+    } else {
+        auto oldest = m_pairs.find(m_lru.back());
+        pair = oldest->second.m_pair;
+        m_pairs.erase(oldest);
+        m_lru.pop_back();
+    }
+
+#if HAS_EXTENDED_PAIRS
+    init_extended_pair(pair, fg, bg);
+#else
+    init_pair(static_cast<short>(pair), static_cast<short>(fg), static_cast<short>(bg));
+#endif
+    m_lru.push_front(key);
+    m_pairs[key] = CachedPair{pair, m_lru.begin()};
+    return pair;
+}
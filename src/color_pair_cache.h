@@ -0,0 +1,75 @@
+#pragma once
+#include <list>
+#include <cstdint>
+#include <unordered_map>
+#include <ncurses.h>
+#include <rote/rote.h>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief The curses color pairs of the cells with extended colors.
+ * @details The pairs of the 8 basic colors are set once by
+ *          CurutilColorpairInit(). A pair for extended colors is only set
+ *          when a cell first needs it, above those, and once the terminal's
+ *          pairs run out the least recently used one is set anew. Colors the
+ *          terminal can't show fall back to the basic color of the cell's
+ *          attribute.
+ */
+class OmniColorPairCache
+{
+public:
+    OmniColorPairCache();
+
+
+    /**
+     * @brief Sizes the cache from what the terminal offers, after start_color().
+     */
+    void Init();
+
+
+    /**
+     * @brief Sets the window's attributes to those of a cell.
+     * @param attr the rote attribute of the cell
+     * @param xattr its extended attribute, nullptr for none
+     */
+    void Attrset(WINDOW *wnd, unsigned char attr, const RoteXAttr *xattr);
+
+
+private:
+    /**
+     * @brief ToCursesColor
+     * @param color a ROTE_COLOR_* value
+     * @return the curses color closest to it, -1 if the terminal only has
+     *         the basic colors for it
+     */
+    int ToCursesColor(uint32_t color) const;
+
+
+    /**
+     * @brief GetPair
+     * @return the pair of the two curses colors, set if need be, -1 if the
+     *         terminal has no pairs to spare
+     */
+    int GetPair(int fg, int bg);
+
+
+private:
+    typedef std::list<uint64_t> LruList;
+    struct CachedPair
+    {
+        int                 m_pair;
+        LruList::iterator   m_lruEntry;
+    };
+
+    int                                     m_firstPair;
+    int                                     m_pairCount;
+    /* (fg, bg) keys, the most recently used first */
+    LruList                                 m_lru;
+    std::unordered_map<uint64_t, CachedPair> m_pairs;
+};
+
+
+}
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <algorithm>
 #ifdef __APPLE__
 #include <json/json.h>
 #else
@@ -13,12 +14,40 @@ using namespace omnitty;
 
 OmniConfig *OmniConfig::m_instance      = nullptr;
 static const int TERM_WND_MIN_WIDTH     = 80;
+static const uint32_t MAX_FPS           = 30;
+static const uint32_t MAX_FPS_MAX       = 1000;
+static const uint32_t READ_BUDGET       = 1024 * 1024;
+static const uint32_t READ_QUANTUM      = 16 * 1024;
+static const uint32_t READ_QUANTUM_MIN  = 512;
+static const uint32_t RAW_RING          = 64 * 1024;
+static const uint32_t RAW_RING_MIN      = 4 * 1024;
+static const uint32_t RAW_RING_MAX      = 64 * 1024 * 1024;
+static const uint32_t SCROLLBACK_LINES  = 5000;
+static const uint32_t SCROLLBACK_LINES_MAX = 1000000;
+static const uint32_t MEMORY_BUDGET_MB  = 512;
+static const uint32_t MEMORY_BUDGET_MB_MAX = 1024 * 1024;
+static const uint32_t OUTPUT_HIGH_WATER = 4 * 1024;
+static const uint32_t WORKERS           = 0;
+static const uint32_t WORKERS_MAX       = 64;
+static const char *IO_BACKEND           = "poll";
+static const uint32_t TRANSCRIPT_MAX    = 64 * 1024 * 1024;
+static const uint32_t TRANSCRIPT_KEPT   = 3;
+static const uint32_t TRANSCRIPT_KEPT_MAX = 99;
+static const uint32_t LOGIN_TIMEOUT     = 60;
+static const uint32_t STALL_TIMEOUT     = 30;
+static const uint32_t PROBE_INTERVAL    = 10;
+/* seconds, keeps the timers' milliseconds within 32 bits */
+static const uint32_t TIMEOUT_MAX       = 24 * 3600;
 
 
 OmniConfig::OmniConfig()
-    : m_listWndWidth(15), m_summaryWndWidth(15), m_terminalWndWidth(80),
+    : m_listWndWidth(15), m_summaryWndWidth(15), m_terminalWndWidth(80), m_maxFps(MAX_FPS),
       m_logFilePath("/tmp/omnitty.log"), m_logFormat("%d{%y-%m-%d %H:%M:%S} %p %l %m%n"),
-      m_sshUserName("root")
+      m_sshUserName("root"), m_readBudget(READ_BUDGET), m_readQuantum(READ_QUANTUM),
+      m_rawRingBytes(RAW_RING), m_scrollbackLines(SCROLLBACK_LINES), m_memoryBudgetMb(MEMORY_BUDGET_MB),
+      m_isLazyParsing(false), m_outputHighWaterMark(OUTPUT_HIGH_WATER), m_workerThreads(WORKERS),
+      m_ioBackend(IO_BACKEND), m_transcriptMaxBytes(TRANSCRIPT_MAX), m_transcriptRotations(TRANSCRIPT_KEPT),
+      m_loginTimeout(LOGIN_TIMEOUT), m_stallTimeout(STALL_TIMEOUT), m_probeInterval(PROBE_INTERVAL)
 {
     m_configFilePath = getenv("HOME") + std::string("/.omnitty/config.json");
 }
@@ -45,6 +74,7 @@ bool OmniConfig::LoadConfig()
     if (m_terminalWndWidth < TERM_WND_MIN_WIDTH) {
         m_terminalWndWidth = TERM_WND_MIN_WIDTH;
     }
+    m_maxFps = std::min(root.get("MaxFps", MAX_FPS).asUInt(), MAX_FPS_MAX);
 
     // log
     m_logFilePath = root.get("LogFilePath", "/tmp/omnitty.log").asString();
@@ -59,6 +89,55 @@ bool OmniConfig::LoadConfig()
     m_sshUserPassword = root.get("SSHUserPassword", "").asString();
     m_sshParam = root.get("SSHParam", "").asString();
 
+    // pty reading
+    m_readBudget = root.get("ReadBudgetPerTick", READ_BUDGET).asUInt();
+    m_readQuantum = root.get("ReadQuantum", READ_QUANTUM).asUInt();
+
+    if (m_readQuantum < READ_QUANTUM_MIN) {
+        m_readQuantum = READ_QUANTUM_MIN;
+    }
+    if (m_readBudget < m_readQuantum) {
+        m_readBudget = m_readQuantum;
+    }
+
+    m_rawRingBytes = root.get("RawRingBytes", RAW_RING).asUInt();
+    if (m_rawRingBytes < RAW_RING_MIN) {
+        m_rawRingBytes = RAW_RING_MIN;
+    } else if (m_rawRingBytes > RAW_RING_MAX) {
+        m_rawRingBytes = RAW_RING_MAX;
+    }
+    m_isLazyParsing = root.get("LazyParsing", false).asBool();
+
+    // scrollback
+    m_scrollbackLines = std::min(root.get("ScrollbackLines", SCROLLBACK_LINES).asUInt(), SCROLLBACK_LINES_MAX);
+    m_memoryBudgetMb = std::min(root.get("MemoryBudgetMB", MEMORY_BUDGET_MB).asUInt(), MEMORY_BUDGET_MB_MAX);
+
+    // pty writing
+    m_outputHighWaterMark = root.get("OutputHighWaterMark", OUTPUT_HIGH_WATER).asUInt();
+    if (m_outputHighWaterMark == 0) {
+        m_outputHighWaterMark = 1;
+    }
+
+    // terminal workers
+    m_workerThreads = root.get("WorkerThreads", WORKERS).asUInt();
+    if (m_workerThreads > WORKERS_MAX) {
+        m_workerThreads = WORKERS_MAX;
+    }
+    m_ioBackend = root.get("IoBackend", IO_BACKEND).asString();
+
+    // session transcripts
+    m_transcriptDirectory = root.get("TranscriptDirectory", "").asString();
+    m_transcriptMaxBytes = root.get("TranscriptMaxBytes", TRANSCRIPT_MAX).asUInt();
+    m_transcriptRotations = root.get("TranscriptRotations", TRANSCRIPT_KEPT).asUInt();
+    if (m_transcriptRotations > TRANSCRIPT_KEPT_MAX) {
+        m_transcriptRotations = TRANSCRIPT_KEPT_MAX;
+    }
+
+    // hung sessions
+    m_loginTimeout = std::min(root.get("LoginTimeout", LOGIN_TIMEOUT).asUInt(), TIMEOUT_MAX);
+    m_stallTimeout = std::min(root.get("StallTimeout", STALL_TIMEOUT).asUInt(), TIMEOUT_MAX);
+    m_probeInterval = std::min(root.get("ProbeInterval", PROBE_INTERVAL).asUInt(), TIMEOUT_MAX);
+
     ifstream.close();
     return true;
 }
@@ -76,6 +155,7 @@ bool OmniConfig::SaveConfig()
     root["ListWindowWidth"] = m_listWndWidth;
     root["SummaryWindowWidth"] = m_summaryWndWidth;
     root["TerminalWindowWidth"] = m_terminalWndWidth;
+    root["MaxFps"] = m_maxFps;
 
     root["LogFilePath"] = m_logFilePath;
     root["LogConfigFilePath"] = m_logConfigFilePath;
@@ -87,6 +167,26 @@ bool OmniConfig::SaveConfig()
     root["SSHUserPassword"] = m_sshUserPassword;
     root["SSHParam"] = m_sshParam;
 
+    root["ReadBudgetPerTick"] = m_readBudget;
+    root["ReadQuantum"] = m_readQuantum;
+    root["RawRingBytes"] = m_rawRingBytes;
+    root["LazyParsing"] = m_isLazyParsing;
+    root["ScrollbackLines"] = m_scrollbackLines;
+    root["MemoryBudgetMB"] = m_memoryBudgetMb;
+
+    root["OutputHighWaterMark"] = m_outputHighWaterMark;
+
+    root["WorkerThreads"] = m_workerThreads;
+    root["IoBackend"] = m_ioBackend;
+
+    root["TranscriptDirectory"] = m_transcriptDirectory;
+    root["TranscriptMaxBytes"] = m_transcriptMaxBytes;
+    root["TranscriptRotations"] = m_transcriptRotations;
+
+    root["LoginTimeout"] = m_loginTimeout;
+    root["StallTimeout"] = m_stallTimeout;
+    root["ProbeInterval"] = m_probeInterval;
+
     Json::FastWriter writer;
     std::string fileContent = writer.write(root);
     ofstream << fileContent;
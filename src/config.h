@@ -32,6 +32,9 @@ public:
 
     uint32_t GetTerminalWndWidth() const { return m_terminalWndWidth; }
 
+    /* screen refreshes per second at most, 0 redraws every change right away */
+    uint32_t GetMaxFps() const { return m_maxFps; }
+
     const std::string &GetLogFilePath() const { return m_logFilePath; }
 
     const std::string &GetLogConfigFilePath() const { return m_logConfigFilePath; }
@@ -44,11 +47,57 @@ public:
 
     const std::string &GetSshParam() const { return m_sshParam; }
 
+    uint32_t GetReadBudget() const { return m_readBudget; }
+
+    uint32_t GetReadQuantum() const { return m_readQuantum; }
+
+    /* capacity of each machine's ring of raw pty output */
+    uint32_t GetRawRingBytes() const { return m_rawRingBytes; }
+
+    /* lines scrolled off each terminal that are kept, 0 keeps none */
+    uint32_t GetScrollbackLines() const { return m_scrollbackLines; }
+
+    /* megabytes all the machines' terminals, scrollback and raw output may
+     * take together, the least recently viewed scrollback goes first; 0 is
+     * unlimited */
+    uint32_t GetMemoryBudgetMb() const { return m_memoryBudgetMb; }
+
+    /* machines off screen only keep their output in the raw ring until shown */
+    bool IsLazyParsing() const { return m_isLazyParsing; }
+
+    /* queued keystrokes above which a machine is shown as backpressured */
+    uint32_t GetOutputHighWaterMark() const { return m_outputHighWaterMark; }
+
+    /* 0 drains the terminals on the UI thread */
+    uint32_t GetWorkerThreads() const { return m_workerThreads; }
+
+    /* how the workers move pty data: "poll" or "io_uring" (Linux only) */
+    const std::string &GetIoBackend() const { return m_ioBackend; }
+
+    /* session transcripts are written there, none if empty */
+    const std::string &GetTranscriptDirectory() const { return m_transcriptDirectory; }
+
+    /* size at which a transcript is rotated, 0 never rotates */
+    uint32_t GetTranscriptMaxBytes() const { return m_transcriptMaxBytes; }
+
+    /* rotated transcripts kept per machine */
+    uint32_t GetTranscriptRotations() const { return m_transcriptRotations; }
+
+    /* seconds a new machine has to print something, 0 never gives up */
+    uint32_t GetLoginTimeout() const { return m_loginTimeout; }
+
+    /* seconds a machine has to answer keystrokes, 0 waits forever */
+    uint32_t GetStallTimeout() const { return m_stallTimeout; }
+
+    /* seconds between checks of the keystrokes a machine didn't take, 0 never checks */
+    uint32_t GetProbeInterval() const { return m_probeInterval; }
+
 private:
     static OmniConfig   *m_instance;
     uint32_t            m_listWndWidth;
     uint32_t            m_summaryWndWidth;
     uint32_t            m_terminalWndWidth;
+    uint32_t            m_maxFps;
     std::string         m_configFilePath;
     std::string         m_logFilePath;
     std::string         m_logConfigFilePath;
@@ -57,6 +106,21 @@ private:
     std::string         m_sshUserName;
     std::string         m_sshUserPassword;
     std::string         m_sshParam;
+    uint32_t            m_readBudget;
+    uint32_t            m_readQuantum;
+    uint32_t            m_rawRingBytes;
+    uint32_t            m_scrollbackLines;
+    uint32_t            m_memoryBudgetMb;
+    bool                m_isLazyParsing;
+    uint32_t            m_outputHighWaterMark;
+    uint32_t            m_workerThreads;
+    std::string         m_ioBackend;
+    std::string         m_transcriptDirectory;
+    uint32_t            m_transcriptMaxBytes;
+    uint32_t            m_transcriptRotations;
+    uint32_t            m_loginTimeout;
+    uint32_t            m_stallTimeout;
+    uint32_t            m_probeInterval;
 };
 
 
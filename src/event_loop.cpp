@@ -0,0 +1,291 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#include "log.h"
+#include "event_loop.h"
+
+
+/* upper bound of events fetched by a single Wait(), the rest stay pending
+ * (everything is level triggered) and are picked up on the next call */
+#define MAX_EVENTS_PER_WAIT 256
+/* resolution of the loop's timers */
+#define TIMER_TICK_MS 100
+
+
+using namespace omnitty;
+
+
+OmniEventLoop::OmniEventLoop()
+    : m_loopFd(-1), m_timers(TIMER_TICK_MS)
+{
+}
+
+
+int OmniEventLoop::Wait(int timeoutMs)
+{
+    int timerTimeoutMs = m_timers.GetTimeoutMs();
+    if (timerTimeoutMs >= 0 && (timeoutMs < 0 || timerTimeoutMs < timeoutMs)) timeoutMs = timerTimeoutMs;
+
+    int n = WaitFds(timeoutMs);
+    if (n < 0) return n;
+    return n + m_timers.Advance();
+}
+
+
+OmniEventLoop::~OmniEventLoop()
+{
+    if (m_loopFd >= 0) close(m_loopFd);
+}
+
+
+#ifdef __APPLE__
+
+bool OmniEventLoop::Init()
+{
+    m_loopFd = kqueue();
+    if (m_loopFd < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "kqueue failed, errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+
+static bool KqueueChange(int kq, int fd, uint32_t oldEvents, uint32_t newEvents)
+{
+    struct kevent changes[2];
+    int n = 0;
+    if ((oldEvents ^ newEvents) & OmniEventLoop::EVENT_READ) {
+        EV_SET(&changes[n++], fd, EVFILT_READ, (newEvents & OmniEventLoop::EVENT_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    }
+    if ((oldEvents ^ newEvents) & OmniEventLoop::EVENT_WRITE) {
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, (newEvents & OmniEventLoop::EVENT_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    }
+    return n == 0 || kevent(kq, changes, n, NULL, 0, NULL) == 0;
+}
+
+
+bool OmniEventLoop::AddFd(int fd, uint32_t events, const EventCallback &callback)
+{
+    if (m_watchedFds.count(fd) || !KqueueChange(m_loopFd, fd, 0, events)) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot watch fd: %d, errno: %d", fd, errno);
+        return false;
+    }
+    m_watchedFds[fd] = OmniWatchedFd{events, callback};
+    return true;
+}
+
+
+bool OmniEventLoop::ModifyFd(int fd, uint32_t events)
+{
+    auto iter = m_watchedFds.find(fd);
+    if (iter == m_watchedFds.end()) return false;
+    if (!KqueueChange(m_loopFd, fd, iter->second.m_events, events)) return false;
+    iter->second.m_events = events;
+    return true;
+}
+
+
+void OmniEventLoop::RemoveFd(int fd)
+{
+    auto iter = m_watchedFds.find(fd);
+    if (iter == m_watchedFds.end()) return;
+    KqueueChange(m_loopFd, fd, iter->second.m_events, 0);
+    m_watchedFds.erase(iter);
+}
+
+
+int OmniEventLoop::WaitFds(int timeoutMs)
+{
+    struct kevent events[MAX_EVENTS_PER_WAIT];
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+    int n = kevent(m_loopFd, NULL, 0, events, MAX_EVENTS_PER_WAIT, timeoutMs < 0 ? NULL : &timeout);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; ++i) {
+        int fd = static_cast<int>(events[i].ident);
+        auto iter = m_watchedFds.find(fd);
+        if (iter == m_watchedFds.end()) continue;
+
+        uint32_t ready = (events[i].filter == EVFILT_WRITE) ? EVENT_WRITE : EVENT_READ;
+        if (events[i].flags & (EV_EOF | EV_ERROR)) ready |= EVENT_ERROR;
+
+        /* the callback may remove its own fd, so call through a copy */
+        EventCallback callback = iter->second.m_callback;
+        callback(fd, ready);
+    }
+    return n;
+}
+
+#else
+
+static uint32_t ToEpollEvents(uint32_t events)
+{
+    uint32_t epollEvents = 0;
+    if (events & OmniEventLoop::EVENT_READ) epollEvents |= EPOLLIN;
+    if (events & OmniEventLoop::EVENT_WRITE) epollEvents |= EPOLLOUT;
+    return epollEvents;
+}
+
+
+bool OmniEventLoop::Init()
+{
+    m_loopFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_loopFd < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "epoll_create1 failed, errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+
+bool OmniEventLoop::AddFd(int fd, uint32_t events, const EventCallback &callback)
+{
+    struct epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = fd;
+    if (m_watchedFds.count(fd) || epoll_ctl(m_loopFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot watch fd: %d, errno: %d", fd, errno);
+        return false;
+    }
+    m_watchedFds[fd] = OmniWatchedFd{events, callback};
+    return true;
+}
+
+
+bool OmniEventLoop::ModifyFd(int fd, uint32_t events)
+{
+    auto iter = m_watchedFds.find(fd);
+    if (iter == m_watchedFds.end()) return false;
+    if (iter->second.m_events == events) return true;
+
+    struct epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = fd;
+    if (epoll_ctl(m_loopFd, EPOLL_CTL_MOD, fd, &ev) < 0) return false;
+    iter->second.m_events = events;
+    return true;
+}
+
+
+void OmniEventLoop::RemoveFd(int fd)
+{
+    auto iter = m_watchedFds.find(fd);
+    if (iter == m_watchedFds.end()) return;
+    epoll_ctl(m_loopFd, EPOLL_CTL_DEL, fd, NULL);
+    m_watchedFds.erase(iter);
+}
+
+
+int OmniEventLoop::WaitFds(int timeoutMs)
+{
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+    int n = epoll_wait(m_loopFd, events, MAX_EVENTS_PER_WAIT, timeoutMs);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        auto iter = m_watchedFds.find(fd);
+        if (iter == m_watchedFds.end()) continue;
+
+        uint32_t ready = 0;
+        if (events[i].events & EPOLLIN) ready |= EVENT_READ;
+        if (events[i].events & EPOLLOUT) ready |= EVENT_WRITE;
+        if (events[i].events & (EPOLLHUP | EPOLLERR)) ready |= EVENT_ERROR;
+
+        /* the callback may remove its own fd, so call through a copy */
+        EventCallback callback = iter->second.m_callback;
+        callback(fd, ready);
+    }
+    return n;
+}
+
+#endif
+
+
+OmniEventNotifier::OmniEventNotifier()
+    : m_readFd(-1), m_writeFd(-1)
+{
+}
+
+
+OmniEventNotifier::~OmniEventNotifier()
+{
+    if (m_writeFd >= 0 && m_writeFd != m_readFd) close(m_writeFd);
+    if (m_readFd >= 0) close(m_readFd);
+}
+
+
+#ifdef __APPLE__
+
+bool OmniEventNotifier::Init()
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "pipe failed, errno: %d", errno);
+        return false;
+    }
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    m_readFd = fds[0];
+    m_writeFd = fds[1];
+    return true;
+}
+
+
+void OmniEventNotifier::Notify()
+{
+    char c = 0;
+    /* a full pipe is as good as a successful write */
+    ssize_t ret = write(m_writeFd, &c, 1);
+    (void)ret;
+}
+
+
+void OmniEventNotifier::Clear()
+{
+    char buf[64];
+    while (read(m_readFd, buf, sizeof(buf)) > 0) ;
+}
+
+#else
+
+bool OmniEventNotifier::Init()
+{
+    m_readFd = m_writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_readFd < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "eventfd failed, errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+
+void OmniEventNotifier::Notify()
+{
+    uint64_t one = 1;
+    ssize_t ret = write(m_writeFd, &one, sizeof(one));
+    (void)ret;
+}
+
+
+void OmniEventNotifier::Clear()
+{
+    uint64_t count;
+    ssize_t ret = read(m_readFd, &count, sizeof(count));
+    (void)ret;
+}
+
+#endif
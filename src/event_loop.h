@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include "timer_wheel.h"
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Readiness based event loop over file descriptors, and timers.
+ * @details Uses epoll on Linux and kqueue on MacOS, so only the descriptors
+ *          that actually became ready are reported, an idle fleet of
+ *          terminals costs a single blocking syscall per wakeup. The wait
+ *          is cut short by the next timer of GetTimers().
+ */
+class OmniEventLoop
+{
+public:
+    enum {
+        EVENT_READ  = 0x01,
+        EVENT_WRITE = 0x02,
+        EVENT_ERROR = 0x04,
+    };
+
+    /**
+     * @brief Called with the ready fd and the EVENT_* flags that fired.
+     */
+    typedef std::function<void(int fd, uint32_t events)> EventCallback;
+
+
+    OmniEventLoop();
+
+
+    ~OmniEventLoop();
+
+
+    /**
+     * @brief Creates the underlying epoll/kqueue descriptor.
+     * @return Whether the loop is usable.
+     */
+    bool Init();
+
+
+    /**
+     * @brief Starts watching the fd.
+     * @param fd the descriptor to watch
+     * @param events EVENT_READ and/or EVENT_WRITE
+     * @param callback invoked from Wait() when the fd is ready
+     */
+    bool AddFd(int fd, uint32_t events, const EventCallback &callback);
+
+
+    /**
+     * @brief Changes the set of events watched for an already added fd.
+     */
+    bool ModifyFd(int fd, uint32_t events);
+
+
+    /**
+     * @brief Stops watching the fd. Must be called before the fd is closed.
+     */
+    void RemoveFd(int fd);
+
+
+    /**
+     * @brief Waits for ready descriptors and dispatches their callbacks, then
+     *        runs the expired timers.
+     * @param timeoutMs maximum time to block, -1 blocks until an event arrives
+     * @return the number of dispatched events and expired timers, 0 on
+     *         timeout or signal interruption, -1 on error
+     */
+    int Wait(int timeoutMs);
+
+
+    /**
+     * @brief GetTimers
+     * @details Timers must be armed and cancelled on the loop's thread.
+     * @return the timers run by Wait()
+     */
+    OmniTimerWheel &GetTimers() { return m_timers; }
+
+
+    /**
+     * @brief GetFd
+     * @return the epoll/kqueue descriptor, readable when an event is pending
+     */
+    int GetFd() const { return m_loopFd; }
+
+
+protected:
+    OmniEventLoop(const OmniEventLoop &) = delete;
+    OmniEventLoop &operator=(const OmniEventLoop &) = delete;
+
+
+private:
+    /**
+     * @brief The epoll/kqueue part of Wait().
+     */
+    int WaitFds(int timeoutMs);
+
+
+private:
+    struct OmniWatchedFd {
+        uint32_t        m_events;
+        EventCallback   m_callback;
+    };
+
+    int                                         m_loopFd;
+    std::unordered_map<int, OmniWatchedFd>      m_watchedFds;
+    OmniTimerWheel                              m_timers;
+};
+
+
+/**
+ * @brief A descriptor other threads can make readable to wake up a loop.
+ * @details eventfd on Linux, a non-blocking pipe on MacOS.
+ */
+class OmniEventNotifier
+{
+public:
+    OmniEventNotifier();
+
+
+    ~OmniEventNotifier();
+
+
+    bool Init();
+
+
+    /**
+     * @brief Makes GetFd() readable. Safe to call from any thread.
+     */
+    void Notify();
+
+
+    /**
+     * @brief Consumes all pending notifications.
+     */
+    void Clear();
+
+
+    int GetFd() const { return m_readFd; }
+
+
+protected:
+    OmniEventNotifier(const OmniEventNotifier &) = delete;
+    OmniEventNotifier &operator=(const OmniEventNotifier &) = delete;
+
+
+private:
+    int     m_readFd;
+    int     m_writeFd;
+};
+
+
+}
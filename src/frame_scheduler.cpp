@@ -0,0 +1,60 @@
+#include <chrono>
+#include "frame_scheduler.h"
+
+
+using namespace omnitty;
+
+
+OmniFrameScheduler::OmniFrameScheduler(uint32_t maxFps)
+    : m_frameIntervalUs(maxFps > 0 ? 1000000 / maxFps : 0), m_isPending(false), m_frameStartUs(0), m_drawnFrameStartUs(0), m_stats()
+{
+}
+
+
+void OmniFrameScheduler::Invalidate()
+{
+    m_isPending = true;
+    ++m_stats.m_invalidations;
+}
+
+
+int OmniFrameScheduler::GetDelayMs() const
+{
+    if (!m_isPending) return -1;
+
+    uint64_t dueUs = m_drawnFrameStartUs + m_frameIntervalUs;
+    uint64_t nowUs = NowUs();
+    /* rounded up, waking up early would only spin */
+    return dueUs > nowUs ? static_cast<int>((dueUs - nowUs + 999) / 1000) : 0;
+}
+
+
+void OmniFrameScheduler::BeginFrame()
+{
+    m_isPending = false;
+    m_frameStartUs = NowUs();
+}
+
+
+void OmniFrameScheduler::EndFrame(bool isDrawn)
+{
+    if (!isDrawn) {
+        /* the next change doesn't have to wait for this one */
+        ++m_stats.m_skippedFrames;
+        return;
+    }
+
+    uint64_t frameUs = NowUs() - m_frameStartUs;
+    m_drawnFrameStartUs = m_frameStartUs;
+    ++m_stats.m_drawnFrames;
+    m_stats.m_lastFrameUs = frameUs;
+    m_stats.m_totalFrameUs += frameUs;
+    if (frameUs > m_stats.m_maxFrameUs) m_stats.m_maxFrameUs = frameUs;
+}
+
+
+uint64_t OmniFrameScheduler::NowUs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Frame timing, for tuning MaxFps.
+ */
+struct OmniFrameStats
+{
+    /** frames that drew something */
+    uint64_t    m_drawnFrames;
+    /** frames whose windows all turned out unchanged */
+    uint64_t    m_skippedFrames;
+    /** changes reported, several of them are coalesced into one frame */
+    uint64_t    m_invalidations;
+    uint64_t    m_lastFrameUs;
+    uint64_t    m_maxFrameUs;
+    uint64_t    m_totalFrameUs;
+};
+
+
+/**
+ * @brief Decides when the screen is redrawn.
+ * @details Changes only mark a frame as pending, the frame is drawn once the
+ *          minimum interval since the previous one elapsed, so a burst of
+ *          changes (e.g. a flooding terminal) costs one frame per interval
+ *          instead of one per change.
+ */
+class OmniFrameScheduler
+{
+public:
+    /**
+     * @param maxFps frame rate cap, 0 draws every change right away
+     */
+    explicit OmniFrameScheduler(uint32_t maxFps);
+
+
+    /**
+     * @brief Something on screen may have changed, a frame is pending.
+     */
+    void Invalidate();
+
+
+    bool IsPending() const { return m_isPending; }
+
+
+    /**
+     * @brief GetDelayMs
+     * @return how long before the pending frame is due, 0 if it is, -1 if no
+     *         frame is pending
+     */
+    int GetDelayMs() const;
+
+
+    /**
+     * @brief Starts timing the pending frame.
+     */
+    void BeginFrame();
+
+
+    /**
+     * @brief Ends the frame started by BeginFrame().
+     * @param isDrawn whether anything had to be drawn
+     */
+    void EndFrame(bool isDrawn);
+
+
+    const OmniFrameStats &GetStats() const { return m_stats; }
+
+
+    static uint64_t NowUs();
+
+
+private:
+    uint64_t        m_frameIntervalUs;
+    bool            m_isPending;
+    uint64_t        m_frameStartUs;
+    /* start of the last frame that drew something */
+    uint64_t        m_drawnFrameStartUs;
+    OmniFrameStats  m_stats;
+};
+
+
+}
@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <unistd.h>
+#include "log.h"
+#include "io_backend.h"
+#include "io_uring_backend.h"
+
+
+using namespace omnitty;
+
+
+std::unique_ptr<OmniIoBackend> OmniIoBackend::Create(const std::string &name)
+{
+    if (name == "poll") {
+        return std::unique_ptr<OmniIoBackend>(new OmniPollBackend());
+    }
+#ifdef __linux__
+    if (name == "io_uring") {
+        return std::unique_ptr<OmniIoBackend>(new OmniUringBackend());
+    }
+#endif
+    LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "unsupported io backend: %s", name.c_str());
+    return nullptr;
+}
+
+
+OmniPollBackend::OmniPollBackend()
+    : m_eventLoop(nullptr)
+{
+}
+
+
+bool OmniPollBackend::Init(OmniEventLoop &eventLoop, const MachineCallback &onReadable,
+                           const MachineCallback &onChanged)
+{
+    m_eventLoop = &eventLoop;
+    m_onReadable = onReadable;
+    m_onChanged = onChanged;
+    return true;
+}
+
+
+bool OmniPollBackend::AddMachine(const MachinePtr &machine)
+{
+    int fd = rote_vt_get_pty_fd(machine->GetVirtualTerminal());
+    if (fd < 0) return false;
+
+    return m_eventLoop->AddFd(fd, OmniEventLoop::EVENT_READ, [this, machine](int, uint32_t events) {
+        if (events & OmniEventLoop::EVENT_WRITE) FlushOutput(machine);
+        if (events & (OmniEventLoop::EVENT_READ | OmniEventLoop::EVENT_ERROR)) m_onReadable(machine);
+    });
+}
+
+
+void OmniPollBackend::RemoveMachine(const MachinePtr &machine)
+{
+    int fd = rote_vt_get_pty_fd(machine->GetVirtualTerminal());
+    if (fd >= 0) m_eventLoop->RemoveFd(fd);
+}
+
+
+int OmniPollBackend::Read(const MachinePtr &machine, int maxBytes)
+{
+    int fd = rote_vt_get_pty_fd(machine->GetVirtualTerminal());
+    if (fd < 0) return 0;
+
+    OmniTranscript *transcript = machine->GetTranscript();
+    int total = 0;
+    while (total < maxBytes) {
+        /* straight into the ring, the pty is non-blocking */
+        uint32_t want;
+        char *span = machine->ReserveRawOutput(static_cast<uint32_t>(maxBytes - total), &want);
+        int bytesRead = (transcript && transcript->IsOpen()) ?
+            transcript->Read(fd, span, static_cast<int>(want)) : static_cast<int>(read(fd, span, want));
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EINTR)) break;
+        if (bytesRead <= 0) return total > 0 ? total : -1;
+
+        machine->CommitRawOutput(static_cast<uint32_t>(bytesRead));
+        total += bytesRead;
+        if (static_cast<uint32_t>(bytesRead) < want) break;
+    }
+    return total;
+}
+
+
+int OmniPollBackend::GetPendingInput(const MachinePtr &machine)
+{
+    return rote_vt_pending_input(machine->GetVirtualTerminal());
+}
+
+
+void OmniPollBackend::Flush(const MachinePtr &machine)
+{
+    /* rote_vt_write() already wrote what the pty accepted, wait until it
+     * accepts more */
+    int fd = rote_vt_get_pty_fd(machine->GetVirtualTerminal());
+    if (fd < 0) return;
+    m_eventLoop->ModifyFd(fd, OmniEventLoop::EVENT_READ | OmniEventLoop::EVENT_WRITE);
+}
+
+
+void OmniPollBackend::FlushOutput(const MachinePtr &machine)
+{
+    std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+    RoteTerm *rt = machine->GetVirtualTerminal();
+    int fd = rote_vt_get_pty_fd(rt);
+    int pending = rote_vt_flush(rt);
+    if (pending > 0) {
+        machine->SetWriteBacklog(static_cast<uint32_t>(pending));
+        return;
+    }
+
+    /* drained, or the pty failed and the queue was dropped */
+    machine->SetWriteBacklog(0);
+    machine->SetIsWritePending(false);
+    m_eventLoop->ModifyFd(fd, OmniEventLoop::EVENT_READ);
+    if (pending < 0) m_onChanged(machine);
+}
+
@@ -0,0 +1,149 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <functional>
+#include "machine.h"
+#include "event_loop.h"
+
+
+namespace omnitty {
+
+
+/**
+ * @brief How a terminal worker moves bytes between the ptys and the terminals.
+ * @details A backend is owned by a single worker and only used from the
+ *          worker's side. Read() and Flush() are called with the machine's
+ *          terminal mutex held; the backend takes the mutex itself for work
+ *          it does on its own (e.g. when a write completes).
+ */
+class OmniIoBackend
+{
+public:
+    typedef std::function<void(const MachinePtr &machine)> MachineCallback;
+
+
+    virtual ~OmniIoBackend() {}
+
+
+    /**
+     * @brief Creates the backend called name, "poll" or "io_uring".
+     * @return the backend, or nullptr if the name is unknown or the backend
+     *         isn't built on this platform
+     */
+    static std::unique_ptr<OmniIoBackend> Create(const std::string &name);
+
+
+    /**
+     * @brief Registers the backend's descriptors with the worker's loop.
+     * @param onReadable called when a machine has input for Read()
+     * @param onChanged called when a machine's screen changed outside of
+     *        Read(), e.g. a failed write printed an error
+     */
+    virtual bool Init(OmniEventLoop &eventLoop, const MachineCallback &onReadable,
+                      const MachineCallback &onChanged) = 0;
+
+
+    virtual const char *GetName() const = 0;
+
+
+    /**
+     * @brief Starts moving the machine's pty input and output.
+     */
+    virtual bool AddMachine(const MachinePtr &machine) = 0;
+
+
+    /**
+     * @brief Stops watching the machine's pty. Does nothing if it isn't watched.
+     */
+    virtual void RemoveMachine(const MachinePtr &machine) = 0;
+
+
+    /**
+     * @brief Moves up to maxBytes of the machine's input into its raw ring
+     *        and has the terminal parse them.
+     * @return the number of bytes read, 0 if nothing is available, -1
+     *         if the pty reported end of file or an error
+     */
+    virtual int Read(const MachinePtr &machine, int maxBytes) = 0;
+
+
+    /**
+     * @brief GetPendingInput
+     * @return bytes known to be waiting for Read(), -1 if unknown
+     */
+    virtual int GetPendingInput(const MachinePtr &machine) = 0;
+
+
+    /**
+     * @brief Collects the input of the machine that completed but wasn't
+     *        handed over yet, e.g. still in a completion queue, before its
+     *        last Read()s.
+     * @details Called without the terminal mutex, the backend may take it.
+     * @return whether Read() has input of the machine
+     */
+    virtual bool Drain(const MachinePtr &machine) { return false; }
+
+
+    /**
+     * @brief Starts sending the output queued in the machine's terminal.
+     * @details Clears the machine's IsWritePending() flag once everything
+     *          has been written.
+     */
+    virtual void Flush(const MachinePtr &machine) = 0;
+
+
+    /**
+     * @brief Called at the end of every tick, hands the requests queued
+     *        during the tick to the kernel at once.
+     */
+    virtual void Submit() {}
+};
+
+
+/**
+ * @brief Readiness based backend: epoll/kqueue tells which ptys are ready,
+ *        one read() or write() per machine moves the data.
+ */
+class OmniPollBackend : public OmniIoBackend
+{
+public:
+    OmniPollBackend();
+
+
+    bool Init(OmniEventLoop &eventLoop, const MachineCallback &onReadable,
+              const MachineCallback &onChanged) override;
+
+
+    const char *GetName() const override { return "poll"; }
+
+
+    bool AddMachine(const MachinePtr &machine) override;
+
+
+    void RemoveMachine(const MachinePtr &machine) override;
+
+
+    int Read(const MachinePtr &machine, int maxBytes) override;
+
+
+    int GetPendingInput(const MachinePtr &machine) override;
+
+
+    void Flush(const MachinePtr &machine) override;
+
+
+private:
+    /**
+     * @brief Event loop callback for a writable pty, sends the queued output.
+     */
+    void FlushOutput(const MachinePtr &machine);
+
+
+private:
+    OmniEventLoop       *m_eventLoop;
+    MachineCallback     m_onReadable;
+    MachineCallback     m_onChanged;
+};
+
+
+}
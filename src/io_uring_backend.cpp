@@ -0,0 +1,593 @@
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "log.h"
+#include "io_uring_backend.h"
+
+
+#define URING_SQ_ENTRIES        256
+#define URING_CQ_ENTRIES        1024
+/* provided read buffers, the count must be a power of 2 */
+#define URING_BUFFER_COUNT      512
+#define URING_BUFFER_SIZE       4096
+#define URING_BUFFER_GROUP      0
+/* completed buffers a pty may hold before its read is paused */
+#define URING_PTY_BUFFER_QUOTA  64
+#define URING_WRITE_SLOTS       64
+#define URING_WRITE_SLOT_SIZE   4096
+
+/* user_data of a request: the pty's id shifted left 8 bits, or'ed with the kind */
+#define URING_KIND_READ         1
+#define URING_KIND_WRITE        2
+#define URING_KIND_CANCEL       3
+#define URING_USER_DATA(id, kind) ((static_cast<uint64_t>(id) << 8) | (kind))
+
+
+using namespace omnitty;
+
+
+/* IORING_OP_READ_MULTISHOT, Linux 6.7, missing from older headers */
+static const uint8_t URING_OP_READ_MULTISHOT = 49;
+
+
+static int UringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+
+static int UringEnter(int fd, unsigned toSubmit, unsigned flags = 0)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, 0, flags, NULL, 0));
+}
+
+
+static int UringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+
+OmniUringBackend::OmniUringBackend()
+    : m_eventLoop(nullptr), m_ringFd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED),
+      m_sqRingSize(0), m_cqRingSize(0), m_sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)), m_sqesSize(0),
+      m_sqHead(nullptr), m_sqTail(nullptr), m_sqArray(nullptr), m_sqMask(0), m_sqEntries(0),
+      m_sqLocalTail(0), m_toSubmit(0), m_cqHead(nullptr), m_cqTail(nullptr), m_cqMask(0), m_cqes(nullptr),
+      m_bufferRing(static_cast<struct io_uring_buf_ring *>(MAP_FAILED)), m_bufferRingSize(0),
+      m_readBuffers(static_cast<char *>(MAP_FAILED)), m_bufferTail(0), m_heldBuffers(0),
+      m_writeBuffer(static_cast<char *>(MAP_FAILED)), m_isMultishot(true), m_nextId(0)
+{
+}
+
+
+OmniUringBackend::~OmniUringBackend()
+{
+    if (m_ringFd >= 0) {
+        if (m_eventLoop) m_eventLoop->RemoveFd(m_ringFd);
+        /* cancels whatever is still in flight */
+        close(m_ringFd);
+    }
+    if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED) munmap(m_sqRing, m_sqRingSize);
+    if (m_bufferRing != MAP_FAILED) munmap(m_bufferRing, m_bufferRingSize);
+    if (m_readBuffers != MAP_FAILED) munmap(m_readBuffers, URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (m_writeBuffer != MAP_FAILED) munmap(m_writeBuffer, URING_WRITE_SLOTS * URING_WRITE_SLOT_SIZE);
+}
+
+
+bool OmniUringBackend::Init(OmniEventLoop &eventLoop, const MachineCallback &onReadable,
+                            const MachineCallback &onChanged)
+{
+    m_onReadable = onReadable;
+    m_onChanged = onChanged;
+    if (!SetupRing() || !SetupBuffers()) return false;
+
+    /* the ring's fd polls readable while completions are pending */
+    if (!eventLoop.AddFd(m_ringFd, OmniEventLoop::EVENT_READ, [this](int, uint32_t) { ReapCompletions(); })) {
+        return false;
+    }
+    m_eventLoop = &eventLoop;
+    return true;
+}
+
+
+bool OmniUringBackend::SetupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    m_ringFd = UringSetup(URING_SQ_ENTRIES, &params);
+    if (m_ringFd < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "io_uring_setup failed, errno: %d", errno);
+        return false;
+    }
+    fcntl(m_ringFd, F_SETFD, FD_CLOEXEC);
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool isSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (isSingleMmap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) return false;
+    m_cqRing = isSingleMmap ? m_sqRing : mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) return false;
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = static_cast<struct io_uring_sqe *>(mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) return false;
+
+    char *sq = static_cast<char *>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqLocalTail = *m_sqTail;
+
+    char *cq = static_cast<char *>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+
+bool OmniUringBackend::SetupBuffers()
+{
+    m_bufferRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    m_bufferRing = static_cast<struct io_uring_buf_ring *>(mmap(NULL, m_bufferRingSize, PROT_READ | PROT_WRITE,
+                                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    m_readBuffers = static_cast<char *>(mmap(NULL, URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    m_writeBuffer = static_cast<char *>(mmap(NULL, URING_WRITE_SLOTS * URING_WRITE_SLOT_SIZE, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (m_bufferRing == MAP_FAILED || m_readBuffers == MAP_FAILED || m_writeBuffer == MAP_FAILED) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot allocate io_uring buffers, errno: %d", errno);
+        return false;
+    }
+
+    struct io_uring_buf_reg bufferReg;
+    memset(&bufferReg, 0, sizeof(bufferReg));
+    bufferReg.ring_addr = reinterpret_cast<uint64_t>(m_bufferRing);
+    bufferReg.ring_entries = URING_BUFFER_COUNT;
+    bufferReg.bgid = URING_BUFFER_GROUP;
+    if (UringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &bufferReg, 1) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot register io_uring buffer ring, errno: %d", errno);
+        return false;
+    }
+    for (uint16_t i = 0; i < URING_BUFFER_COUNT; ++i) {
+        RecycleBuffer(i);
+    }
+    m_heldBuffers = 0;
+
+    /* one registered region, the writes use slots inside it */
+    struct iovec writeRegion;
+    writeRegion.iov_base = m_writeBuffer;
+    writeRegion.iov_len = URING_WRITE_SLOTS * URING_WRITE_SLOT_SIZE;
+    if (UringRegister(m_ringFd, IORING_REGISTER_BUFFERS, &writeRegion, 1) < 0) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot register io_uring write buffer, errno: %d", errno);
+        return false;
+    }
+    for (int i = URING_WRITE_SLOTS - 1; i >= 0; --i) {
+        m_freeWriteSlots.push_back(i);
+    }
+    return true;
+}
+
+
+bool OmniUringBackend::AddMachine(const MachinePtr &machine)
+{
+    RoteTerm *rt = machine->GetVirtualTerminal();
+    int fd = rote_vt_get_pty_fd(rt);
+    if (fd < 0 || m_ptyIds.count(machine.get())) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        rote_vt_defer_output(rt, true);
+    }
+    /* a multishot read on a blocking pty misses the input pending when it
+     * is armed and never sees the hangup; single shot reads wait for
+     * readiness themselves only on blocking files */
+    if (!m_isMultishot) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    std::unique_ptr<OmniUringPty> pty(new OmniUringPty());
+    pty->m_machine = machine;
+    pty->m_fd = fd;
+    pty->m_id = m_nextId++;
+    pty->m_pendingBytes = 0;
+    pty->m_isReadArmed = false;
+    pty->m_isCancelling = false;
+    pty->m_isEof = false;
+    pty->m_isRemoved = false;
+    pty->m_writeSlot = -1;
+
+    OmniUringPty *rawPty = pty.get();
+    m_ptyIds[machine.get()] = pty->m_id;
+    m_ptys[pty->m_id] = std::move(pty);
+    ArmRead(rawPty);
+    return true;
+}
+
+
+void OmniUringBackend::RemoveMachine(const MachinePtr &machine)
+{
+    auto iter = m_ptyIds.find(machine.get());
+    if (iter == m_ptyIds.end()) return;
+    OmniUringPty *pty = m_ptys[iter->second].get();
+    m_ptyIds.erase(iter);
+
+    pty->m_isRemoved = true;
+    for (auto &chunk : pty->m_chunks) {
+        RecycleBuffer(chunk.m_bufferId);
+    }
+    pty->m_chunks.clear();
+    pty->m_pendingBytes = 0;
+
+    CancelRead(pty);
+    if (pty->m_writeSlot >= 0) {
+        struct io_uring_sqe *sqe = GetSqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = URING_USER_DATA(pty->m_id, URING_KIND_WRITE);
+            sqe->user_data = URING_USER_DATA(pty->m_id, URING_KIND_CANCEL);
+        }
+    }
+    ReleaseIfIdle(pty);
+    RearmStarvedReads();
+}
+
+
+int OmniUringBackend::Read(const MachinePtr &machine, int maxBytes)
+{
+    OmniUringPty *pty = FindPty(machine);
+    if (!pty) return 0;
+
+    int total = 0;
+    bool isRecycled = false;
+    while (total < maxBytes && !pty->m_chunks.empty()) {
+        OmniChunk &chunk = pty->m_chunks.front();
+        uint32_t length = std::min(chunk.m_length, static_cast<uint32_t>(maxBytes - total));
+        machine->AppendRawOutput(m_readBuffers + chunk.m_bufferId * URING_BUFFER_SIZE + chunk.m_offset, length);
+        chunk.m_offset += length;
+        chunk.m_length -= length;
+        pty->m_pendingBytes -= length;
+        total += static_cast<int>(length);
+        if (chunk.m_length == 0) {
+            RecycleBuffer(chunk.m_bufferId);
+            pty->m_chunks.pop_front();
+            isRecycled = true;
+        }
+    }
+    if (total == 0 && pty->m_isEof) return -1;
+
+    /* resume a read paused by the quota once the pty caught up */
+    if (!pty->m_isReadArmed && !pty->m_isEof && pty->m_chunks.size() <= URING_PTY_BUFFER_QUOTA / 2) {
+        ArmRead(pty);
+    }
+    if (isRecycled) RearmStarvedReads();
+    return total;
+}
+
+
+int OmniUringBackend::GetPendingInput(const MachinePtr &machine)
+{
+    OmniUringPty *pty = FindPty(machine);
+    if (!pty) return 0;
+    /* an end of file behind the last chunks has no completion left to
+     * announce it, it counts as input until Read() returned -1 */
+    return pty->m_pendingBytes > 0 ? static_cast<int>(pty->m_pendingBytes) : (pty->m_isEof ? 1 : 0);
+}
+
+
+bool OmniUringBackend::Drain(const MachinePtr &machine)
+{
+    if (!FindPty(machine)) return false;
+
+    /* submits a re-armed read, then has the kernel run the completions
+     * it still holds as task work, without waiting for any */
+    Submit();
+    UringEnter(m_ringFd, 0, IORING_ENTER_GETEVENTS);
+    ReapCompletions();
+
+    OmniUringPty *pty = FindPty(machine);
+    return pty && pty->m_pendingBytes > 0;
+}
+
+
+void OmniUringBackend::Flush(const MachinePtr &machine)
+{
+    OmniUringPty *pty = FindPty(machine);
+    if (!pty || pty->m_writeSlot >= 0) return;
+    StartWrite(pty);
+}
+
+
+void OmniUringBackend::Submit()
+{
+    if (m_toSubmit == 0) return;
+
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    int submitted = UringEnter(m_ringFd, m_toSubmit);
+    if (submitted < 0) {
+        /* EAGAIN/EBUSY: out of memory or completions, retried next tick */
+        if (errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+            LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "io_uring_enter failed, errno: %d", errno);
+        }
+        return;
+    }
+    m_toSubmit -= std::min(m_toSubmit, static_cast<unsigned>(submitted));
+}
+
+
+struct io_uring_sqe *OmniUringBackend::GetSqe()
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail - head >= m_sqEntries) {
+        Submit();
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail - head >= m_sqEntries) return nullptr;
+    }
+
+    unsigned index = m_sqLocalTail & m_sqMask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    ++m_sqLocalTail;
+    ++m_toSubmit;
+    return sqe;
+}
+
+
+void OmniUringBackend::ArmRead(OmniUringPty *pty)
+{
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        m_starvedReads.push_back(pty->m_id);
+        return;
+    }
+
+    sqe->opcode = m_isMultishot ? URING_OP_READ_MULTISHOT : static_cast<uint8_t>(IORING_OP_READ);
+    sqe->fd = pty->m_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->len = m_isMultishot ? 0 : URING_BUFFER_SIZE;
+    /* ptys have no position, read from the current one */
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = URING_USER_DATA(pty->m_id, URING_KIND_READ);
+    pty->m_isReadArmed = true;
+}
+
+
+void OmniUringBackend::CancelRead(OmniUringPty *pty)
+{
+    if (!pty->m_isReadArmed || pty->m_isCancelling) return;
+
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_USER_DATA(pty->m_id, URING_KIND_READ);
+    sqe->user_data = URING_USER_DATA(pty->m_id, URING_KIND_CANCEL);
+    pty->m_isCancelling = true;
+}
+
+
+void OmniUringBackend::StartWrite(OmniUringPty *pty)
+{
+    const MachinePtr &machine = pty->m_machine;
+    const char *data;
+    int length = rote_vt_peek_output(machine->GetVirtualTerminal(), &data);
+    if (length <= 0) {
+        machine->SetWriteBacklog(0);
+        machine->SetIsWritePending(false);
+        return;
+    }
+    machine->SetWriteBacklog(static_cast<uint32_t>(length));
+
+    struct io_uring_sqe *sqe = m_freeWriteSlots.empty() ? nullptr : GetSqe();
+    if (!sqe) {
+        m_pendingWrites.push_back(pty->m_id);
+        return;
+    }
+
+    int slot = m_freeWriteSlots.back();
+    m_freeWriteSlots.pop_back();
+    char *slotBuffer = m_writeBuffer + slot * URING_WRITE_SLOT_SIZE;
+    length = std::min(length, URING_WRITE_SLOT_SIZE);
+    memcpy(slotBuffer, data, length);
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = pty->m_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(slotBuffer);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->buf_index = 0;
+    sqe->user_data = URING_USER_DATA(pty->m_id, URING_KIND_WRITE);
+    pty->m_writeSlot = slot;
+}
+
+
+void OmniUringBackend::RecycleBuffer(uint16_t bufferId)
+{
+    /* not m_bufferRing->bufs: in C++ the header's flexible array member
+     * starts after an empty struct of size 1, 8 bytes too far */
+    struct io_uring_buf *buffer = reinterpret_cast<struct io_uring_buf *>(m_bufferRing) +
+                                  (m_bufferTail & (URING_BUFFER_COUNT - 1));
+    buffer->addr = reinterpret_cast<uint64_t>(m_readBuffers + bufferId * URING_BUFFER_SIZE);
+    buffer->len = URING_BUFFER_SIZE;
+    buffer->bid = bufferId;
+    ++m_bufferTail;
+    __atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+    if (m_heldBuffers > 0) --m_heldBuffers;
+}
+
+
+void OmniUringBackend::ReapCompletions()
+{
+    unsigned head = *m_cqHead;
+    for (;;) {
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+
+        /* copy and release the entry first, the handlers may submit */
+        struct io_uring_cqe cqe = m_cqes[head & m_cqMask];
+        __atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);
+
+        uint32_t kind = static_cast<uint32_t>(cqe.user_data & 0xFF);
+        uint32_t id = static_cast<uint32_t>(cqe.user_data >> 8);
+        auto iter = m_ptys.find(id);
+        if (iter == m_ptys.end()) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                ++m_heldBuffers;
+                RecycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            continue;
+        }
+
+        if (kind == URING_KIND_READ) {
+            HandleRead(iter->second.get(), cqe.res, cqe.flags);
+        } else if (kind == URING_KIND_WRITE) {
+            HandleWrite(iter->second.get(), cqe.res);
+            ServePendingWrites();
+        }
+    }
+    Submit();
+}
+
+
+void OmniUringBackend::HandleRead(OmniUringPty *pty, int result, uint32_t flags)
+{
+    bool hasBuffer = (flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bufferId = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    if (hasBuffer) ++m_heldBuffers;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        pty->m_isReadArmed = false;
+        pty->m_isCancelling = false;
+    }
+
+    if (pty->m_isRemoved) {
+        if (hasBuffer) RecycleBuffer(bufferId);
+        ReleaseIfIdle(pty);
+        return;
+    }
+
+    if (result > 0 && hasBuffer) {
+        OmniTranscript *transcript = pty->m_machine->GetTranscript();
+        if (transcript && transcript->IsOpen()) {
+            /* the bytes are already in user space, no splicing here */
+            transcript->Write(m_readBuffers + bufferId * URING_BUFFER_SIZE, result);
+        }
+        pty->m_chunks.push_back(OmniChunk{bufferId, 0, static_cast<uint32_t>(result)});
+        pty->m_pendingBytes += static_cast<uint32_t>(result);
+        if (pty->m_chunks.size() >= URING_PTY_BUFFER_QUOTA) CancelRead(pty);
+        m_onReadable(pty->m_machine);
+    } else if (hasBuffer) {
+        RecycleBuffer(bufferId);
+    }
+    if (pty->m_isReadArmed) return;
+
+    if (result == -EINVAL && m_isMultishot) {
+        LOG4CPLUS_INFO(omnitty::LOGGER_NAME, "io_uring: no multishot reads, using single shot reads");
+        m_isMultishot = false;
+        for (auto &entry : m_ptys) {
+            int fd = entry.second->m_fd;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        }
+    } else if (result == -ENOBUFS) {
+        m_starvedReads.push_back(pty->m_id);
+        return;
+    } else if (result == 0 || (result < 0 && result != -ECANCELED && result != -EAGAIN && result != -EINTR)) {
+        /* end of file, or the pty is gone */
+        pty->m_isEof = true;
+        m_onReadable(pty->m_machine);
+        return;
+    }
+
+    if (pty->m_chunks.size() < URING_PTY_BUFFER_QUOTA) ArmRead(pty);
+}
+
+
+void OmniUringBackend::HandleWrite(OmniUringPty *pty, int result)
+{
+    m_freeWriteSlots.push_back(pty->m_writeSlot);
+    pty->m_writeSlot = -1;
+    if (pty->m_isRemoved) {
+        ReleaseIfIdle(pty);
+        return;
+    }
+
+    const MachinePtr &machine = pty->m_machine;
+    std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+    RoteTerm *rt = machine->GetVirtualTerminal();
+    if (result > 0) {
+        rote_vt_consume_output(rt, result);
+    } else if (result != -EAGAIN && result != -EINTR) {
+        /* nobody will ever read it */
+        const char *data;
+        rote_vt_consume_output(rt, rote_vt_peek_output(rt, &data));
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "io_uring pty write failed: %d", result);
+    }
+    StartWrite(pty);
+}
+
+
+void OmniUringBackend::ServePendingWrites()
+{
+    while (!m_pendingWrites.empty() && !m_freeWriteSlots.empty()) {
+        auto iter = m_ptys.find(m_pendingWrites.front());
+        m_pendingWrites.pop_front();
+        if (iter == m_ptys.end()) continue;
+
+        OmniUringPty *pty = iter->second.get();
+        if (pty->m_isRemoved || pty->m_writeSlot >= 0) continue;
+        std::lock_guard<std::mutex> lock(pty->m_machine->GetTerminalMutex());
+        StartWrite(pty);
+    }
+}
+
+
+void OmniUringBackend::RearmStarvedReads()
+{
+    while (!m_starvedReads.empty() && m_heldBuffers < URING_BUFFER_COUNT) {
+        auto iter = m_ptys.find(m_starvedReads.front());
+        m_starvedReads.pop_front();
+        if (iter == m_ptys.end()) continue;
+
+        OmniUringPty *pty = iter->second.get();
+        if (pty->m_isRemoved || pty->m_isReadArmed || pty->m_isEof) continue;
+        if (pty->m_chunks.size() < URING_PTY_BUFFER_QUOTA) ArmRead(pty);
+    }
+}
+
+
+void OmniUringBackend::ReleaseIfIdle(OmniUringPty *pty)
+{
+    if (pty->m_isRemoved && !pty->m_isReadArmed && pty->m_writeSlot < 0) {
+        m_ptys.erase(pty->m_id);
+    }
+}
+
+
+OmniUringBackend::OmniUringPty *OmniUringBackend::FindPty(const MachinePtr &machine)
+{
+    auto iter = m_ptyIds.find(machine.get());
+    if (iter == m_ptyIds.end()) return nullptr;
+    return m_ptys[iter->second].get();
+}
+#endif
@@ -0,0 +1,206 @@
+#pragma once
+#ifdef __linux__
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <linux/io_uring.h>
+#include "io_backend.h"
+
+
+namespace omnitty {
+
+
+/**
+ * @brief io_uring backend: all the pty reads and writes of a tick are
+ *        submitted with a single io_uring_enter().
+ * @details Every pty keeps a multishot read armed (a re-armed single shot
+ *          read on kernels older than 6.7) that picks its buffers from a
+ *          ring of provided buffers, so idle ptys cost nothing and busy ones
+ *          need no syscall per read. Completed buffers wait in the backend
+ *          until the worker's scheduler injects them; a pty holding too many
+ *          of them gets its read cancelled until it catches up, so a flood
+ *          can't starve the others of buffers.
+ *
+ *          Keystrokes are copied from the terminal's output queue (the
+ *          terminals run with deferred output) into slots of a registered
+ *          buffer and sent with fixed writes, at most one in flight per pty.
+ *
+ *          The ring's descriptor is watched by the worker's event loop, it's
+ *          readable when completions are pending.
+ */
+class OmniUringBackend : public OmniIoBackend
+{
+public:
+    OmniUringBackend();
+
+
+    ~OmniUringBackend() override;
+
+
+    bool Init(OmniEventLoop &eventLoop, const MachineCallback &onReadable,
+              const MachineCallback &onChanged) override;
+
+
+    const char *GetName() const override { return "io_uring"; }
+
+
+    bool AddMachine(const MachinePtr &machine) override;
+
+
+    void RemoveMachine(const MachinePtr &machine) override;
+
+
+    int Read(const MachinePtr &machine, int maxBytes) override;
+
+
+    int GetPendingInput(const MachinePtr &machine) override;
+
+
+    bool Drain(const MachinePtr &machine) override;
+
+
+    void Flush(const MachinePtr &machine) override;
+
+
+    void Submit() override;
+
+
+protected:
+    OmniUringBackend(const OmniUringBackend &) = delete;
+    OmniUringBackend &operator=(const OmniUringBackend &) = delete;
+
+
+private:
+    /* a completed read, still to be injected into the terminal */
+    struct OmniChunk {
+        uint16_t    m_bufferId;
+        uint32_t    m_offset;
+        uint32_t    m_length;
+    };
+
+    struct OmniUringPty {
+        MachinePtr              m_machine;
+        int                     m_fd;
+        uint32_t                m_id;
+        std::deque<OmniChunk>   m_chunks;
+        uint32_t                m_pendingBytes;
+        bool                    m_isReadArmed;
+        bool                    m_isCancelling;
+        bool                    m_isEof;
+        bool                    m_isRemoved;
+        /* write slot in flight, -1 if none */
+        int                     m_writeSlot;
+    };
+
+
+    bool SetupRing();
+
+
+    bool SetupBuffers();
+
+
+    /**
+     * @brief Returns a zeroed submission entry, submitting the queued ones
+     *        first if the ring is full.
+     */
+    struct io_uring_sqe *GetSqe();
+
+
+    void ArmRead(OmniUringPty *pty);
+
+
+    void CancelRead(OmniUringPty *pty);
+
+
+    /**
+     * @brief Copies the start of the terminal's output queue to a free write
+     *        slot and submits it. The terminal mutex must be held.
+     */
+    void StartWrite(OmniUringPty *pty);
+
+
+    void RecycleBuffer(uint16_t bufferId);
+
+
+    /**
+     * @brief Event loop callback of the ring's fd, handles all completions.
+     */
+    void ReapCompletions();
+
+
+    void HandleRead(OmniUringPty *pty, int result, uint32_t flags);
+
+
+    void HandleWrite(OmniUringPty *pty, int result);
+
+
+    /**
+     * @brief Re-arms the reads that stopped for lack of buffers. Takes no
+     *        lock, Read() calls it with a terminal mutex held.
+     */
+    void RearmStarvedReads();
+
+
+    /**
+     * @brief Starts the writes that waited for a free slot.
+     */
+    void ServePendingWrites();
+
+
+    /**
+     * @brief Forgets a removed pty once no request refers to it anymore.
+     */
+    void ReleaseIfIdle(OmniUringPty *pty);
+
+
+    OmniUringPty *FindPty(const MachinePtr &machine);
+
+
+private:
+    OmniEventLoop           *m_eventLoop;
+    MachineCallback         m_onReadable;
+    MachineCallback         m_onChanged;
+
+    int                     m_ringFd;
+    void                    *m_sqRing;
+    void                    *m_cqRing;
+    size_t                  m_sqRingSize;
+    size_t                  m_cqRingSize;
+    struct io_uring_sqe     *m_sqes;
+    size_t                  m_sqesSize;
+    unsigned                *m_sqHead;
+    unsigned                *m_sqTail;
+    unsigned                *m_sqArray;
+    unsigned                m_sqMask;
+    unsigned                m_sqEntries;
+    unsigned                m_sqLocalTail;
+    unsigned                m_toSubmit;
+    unsigned                *m_cqHead;
+    unsigned                *m_cqTail;
+    unsigned                m_cqMask;
+    struct io_uring_cqe     *m_cqes;
+
+    /* provided buffers for the reads */
+    struct io_uring_buf_ring *m_bufferRing;
+    size_t                  m_bufferRingSize;
+    char                    *m_readBuffers;
+    uint16_t                m_bufferTail;
+    /* buffers out of the ring: completed reads not recycled yet */
+    unsigned                m_heldBuffers;
+    /* registered buffer cut in slots for the writes */
+    char                    *m_writeBuffer;
+    std::vector<int>        m_freeWriteSlots;
+    /* whether the kernel supports multishot reads, until proven otherwise */
+    bool                    m_isMultishot;
+
+    uint32_t                m_nextId;
+    std::unordered_map<uint32_t, std::unique_ptr<OmniUringPty>> m_ptys;
+    std::unordered_map<const OmniMachine *, uint32_t>           m_ptyIds;
+    /* ptys whose read ran out of buffers, and ptys waiting for a write slot */
+    std::deque<uint32_t>    m_starvedReads;
+    std::deque<uint32_t>    m_pendingWrites;
+};
+
+
+}
+#endif
@@ -1,28 +1,174 @@
+#include <string.h>
 #include "machine.h"
 
 
 #define TAGSTACK_SIZE 8
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
 
 
 using namespace omnitty;
 
 
+static inline uint64_t HashBytes(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < length; ++i) hash = (hash ^ bytes[i]) * FNV_PRIME;
+    return hash;
+}
+
+
+/* FNV-1a of the text and the attributes, then of the glyphs and the
+ * extended colors by value: their numbers are the terminal's own */
+static uint64_t HashScreenRow(const ScreenRow &row, RoteTerm *rt)
+{
+    uint64_t hash = HashBytes(FNV_OFFSET_BASIS, row.m_text.data(), row.m_text.size());
+    hash = HashBytes(hash, row.m_attrs.data(), row.m_attrs.size());
+    for (size_t c = 0; c < row.m_glyphs.size(); ++c) {
+        if (static_cast<unsigned char>(row.m_text[c]) != ROTE_CELL_GLYPH) continue;
+        const char *utf8 = rote_vt_get_glyph(rt, row.m_glyphs[c])->utf8;
+        hash = HashBytes(hash, utf8, strlen(utf8) + 1);
+    }
+    for (size_t c = 0; c < row.m_xattrs.size(); ++c) {
+        if (row.m_xattrs[c] == 0) continue;
+        const RoteXAttr *xattr = rote_vt_get_xattr(rt, row.m_xattrs[c]);
+        uint32_t cell[3] = {static_cast<uint32_t>(c), xattr->fg, xattr->bg};
+        hash = HashBytes(hash, cell, sizeof(cell));
+    }
+    return hash;
+}
+
+
+/* rote calls it while parsing, with the terminal mutex held */
+static void OnScrolledOff(RoteTerm *rt, const RoteRow *row, void *data)
+{
+    static_cast<OmniScrollback *>(data)->Append(row, rt->cols);
+}
+
+
 OmniMachine::OmniMachine(const std::string &machineName, const std::string &machineIp, const std::string &command,
-                         int vtRows, int vtCols)
-    : m_isTagged(false), m_isAlive(true), m_machineName(machineName), m_machineIp(machineIp)
+                         int vtRows, int vtCols, uint32_t rawRingBytes, uint32_t scrollbackLines)
+    : m_isTagged(false), m_isAlive(true), m_machineName(machineName), m_machineIp(machineIp),
+      m_workerId(0), m_readDeficit(0), m_isReadPending(false), m_isPublishPending(false), m_readBacklog(0),
+      m_isWritePending(false), m_writeBacklog(0), m_rawRing(rawRingBytes),
+      m_parsedPosition(0), m_isParseDeferred(false), m_lastShownMs(0), m_isStalled(false), m_stalledPosition(0),
+      m_inputPosition(0), m_probedWriteBacklog(0)
 {
     m_tagStack.reserve(TAGSTACK_SIZE);
     m_virtualTerminal = rote_vt_create(vtRows, vtCols);
+    if (scrollbackLines > 0) {
+        m_scrollback.reset(new OmniScrollback(scrollbackLines));
+        rote_vt_install_scroll_handler(m_virtualTerminal, OnScrolledOff, m_scrollback.get());
+    }
     m_pid = rote_vt_forkpty(m_virtualTerminal, command.c_str());
+    PublishScreenSnapshot();
 }
 
 
 OmniMachine::~OmniMachine()
 {
+    /* closing the pty hangs up a still running ssh, it is reaped as usual */
+    rote_vt_forsake_child(m_virtualTerminal);
     rote_vt_destroy(m_virtualTerminal);
 }
 
 
+char *OmniMachine::ReserveRawOutput(uint32_t maxBytes, uint32_t *length)
+{
+    if (GetParseBacklog() + maxBytes > m_rawRing.GetCapacity()) ParseRawOutput();
+    return m_rawRing.Reserve(maxBytes, length);
+}
+
+
+void OmniMachine::CommitRawOutput(uint32_t length)
+{
+    m_rawRing.Commit(length);
+    if (!m_isParseDeferred) ParseRawOutput();
+}
+
+
+void OmniMachine::AppendRawOutput(const char *data, uint32_t length)
+{
+    while (length > 0) {
+        uint32_t spanLength;
+        char *span = ReserveRawOutput(length, &spanLength);
+        memcpy(span, data, spanLength);
+        CommitRawOutput(spanLength);
+        data += spanLength;
+        length -= spanLength;
+    }
+}
+
+
+uint32_t OmniMachine::ParseRawOutput()
+{
+    uint32_t parsed = 0;
+    m_rawRing.Consume(m_parserCursor, [this, &parsed](const char *data, uint32_t length) {
+        rote_vt_inject(m_virtualTerminal, data, static_cast<int>(length));
+        parsed += length;
+    });
+    m_parsedPosition = m_parserCursor.m_position;
+    return parsed;
+}
+
+
+bool OmniMachine::PublishScreenSnapshot()
+{
+    RoteTerm *rt = m_virtualTerminal;
+    /* only this thread stores m_screenSnapshot, a plain read is enough */
+    const OmniScreenSnapshot *previous = m_screenSnapshot.get();
+    bool isFirst = (previous == nullptr);
+
+    bool isDirty = isFirst || rt->curpos_dirty;
+    for (int r = 0; r < rt->rows && !isDirty; ++r) {
+        isDirty = rt->line_dirty[r];
+    }
+    if (!isDirty) return false;
+
+    std::shared_ptr<OmniScreenSnapshot> snapshot = std::make_shared<OmniScreenSnapshot>();
+    snapshot->m_rows = rt->rows;
+    snapshot->m_cols = rt->cols;
+    snapshot->m_cursorRow = rt->crow;
+    snapshot->m_cursorCol = rt->ccol;
+    snapshot->m_sequence = isFirst ? 1 : previous->m_sequence + 1;
+    snapshot->m_historyLines = m_scrollback ? m_scrollback->GetEndLine() : 0;
+    snapshot->m_lines.reserve(rt->rows);
+    snapshot->m_damage.assign(rt->rows, RoteSpan{0, rt->cols - 1});
+    snapshot->m_hash = HashBytes(FNV_OFFSET_BASIS, &rt->cols, sizeof(rt->cols));
+    for (int r = 0; r < rt->rows; ++r) {
+        if (isFirst || rt->line_dirty[r]) {
+            std::shared_ptr<ScreenRow> row = std::make_shared<ScreenRow>(rt->lines[r].text, rt->lines[r].attr,
+                                                                         rt->lines[r].glyph, rt->lines[r].xattr, rt->cols);
+            row->m_hash = HashScreenRow(*row, rt);
+            snapshot->m_lines.push_back(row);
+            if (!isFirst) snapshot->m_damage[r] = rt->line_damage[r];
+        } else {
+            snapshot->m_lines.push_back(previous->m_lines[r]);
+        }
+        snapshot->m_hash = HashBytes(snapshot->m_hash, &snapshot->m_lines[r]->m_hash, sizeof(uint64_t));
+        rt->line_dirty[r] = false;
+    }
+    rt->curpos_dirty = false;
+
+    std::atomic_store(&m_screenSnapshot, ScreenSnapshotPtr(snapshot));
+    return true;
+}
+
+
+OmniMemoryUsage OmniMachine::GetMemoryUsage() const
+{
+    OmniMemoryUsage usage;
+    ScreenSnapshotPtr snapshot = GetScreenSnapshot();
+    /* rote's two planes and its rows (three per row), the snapshot's copy
+     * of the planes and its shared rows */
+    size_t rowBytes = snapshot->m_cols * 2 * 2 + 3 * sizeof(RoteRow) + sizeof(ScreenRowPtr) + sizeof(ScreenRow);
+    usage.m_cellBytes = snapshot->m_rows * rowBytes;
+    usage.m_historyBytes = m_scrollback ? m_scrollback->GetMemoryBytes() : 0;
+    usage.m_rawBytes = m_rawRing.GetCapacity();
+    return usage;
+}
+
+
 void OmniMachine::PushMachineTag()
 {
     if (m_tagStack.size() >= TAGSTACK_SIZE) return;
@@ -1,13 +1,48 @@
 #pragma once
+#include <mutex>
+#include <memory>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <rote/rote.h>
 #include "utils.h"
+#include "raw_ring.h"
+#include "scrollback.h"
+#include "transcript.h"
+#include "timer_wheel.h"
+#include "screen_snapshot.h"
 
 
 namespace omnitty {
 
 
+/**
+ * @brief Memory a machine holds on to, in bytes.
+ */
+struct OmniMemoryUsage
+{
+    OmniMemoryUsage() : m_cellBytes(0), m_historyBytes(0), m_rawBytes(0) {}
+
+    /** the terminal's screen and the snapshot of it, roughly */
+    size_t  m_cellBytes;
+    /** the scrollback, packed and open */
+    size_t  m_historyBytes;
+    /** the ring of raw output, allocated in full */
+    size_t  m_rawBytes;
+
+
+    size_t GetTotalBytes() const { return m_cellBytes + m_historyBytes + m_rawBytes; }
+
+
+    OmniMemoryUsage &operator+=(const OmniMemoryUsage &usage) {
+        m_cellBytes += usage.m_cellBytes;
+        m_historyBytes += usage.m_historyBytes;
+        m_rawBytes += usage.m_rawBytes;
+        return *this;
+    }
+};
+
+
 /**
  * @brief This class represents each machine the program interacts with
  */
@@ -24,9 +59,11 @@ public:
      * @param machineIp Machine IP.
      * @param vtRows Virtual terminal rows.
      * @param vtCols Virtual terminal Cols.
+     * @param rawRingBytes Capacity of the ring of raw pty output.
+     * @param scrollbackLines Lines scrolled off the terminal to keep, 0 for none.
      */
     OmniMachine(const std::string &machineName, const std::string &machineIp, const std::string &command,
-                int vtRows, int vtCols);
+                int vtRows, int vtCols, uint32_t rawRingBytes, uint32_t scrollbackLines);
 
 
     /**
@@ -78,11 +115,52 @@ public:
 
     /**
      * @brief GetVirtualTerminal
+     * @details The terminal is shared with the worker that drains the pty,
+     *          lock GetTerminalMutex() around any access to it.
      * @return the machine's terminal
      */
     RoteTerm *GetVirtualTerminal() const { return m_virtualTerminal; }
 
 
+    /**
+     * @brief GetTerminalMutex
+     * @return the mutex guarding the virtual terminal
+     */
+    std::mutex &GetTerminalMutex() { return m_terminalMutex; }
+
+
+    /**
+     * @brief GetScreenSnapshot
+     * @details Safe to call from any thread without holding the terminal mutex.
+     * @return the latest published copy of the terminal's screen
+     */
+    ScreenSnapshotPtr GetScreenSnapshot() const { return std::atomic_load(&m_screenSnapshot); }
+
+
+    /**
+     * @brief Publishes a new screen snapshot if the terminal changed since the
+     *        previous one, copying and hashing only the dirty rows.
+     * @details Clears the terminal's dirtiness flags. The terminal mutex must
+     *          be held.
+     * @return whether a snapshot was published
+     */
+    bool PublishScreenSnapshot();
+
+
+    /**
+     * @brief GetWorkerId
+     * @return the index of the worker draining this machine's pty
+     */
+    uint32_t GetWorkerId() const { return m_workerId; }
+
+
+    /**
+     * @brief SetWorkerId
+     * @param workerId the worker to set
+     */
+    void SetWorkerId(uint32_t workerId) { m_workerId = workerId; }
+
+
     /**
      * @brief GetMachineName
      * @return the machine's name
@@ -106,6 +184,286 @@ public:
     const std::string &GetMachineIp() const { return m_machineIp; }
 
 
+    /**
+     * @brief IsPublishPending
+     * @return whether the worker has to publish a snapshot at the end of its tick
+     */
+    bool IsPublishPending() const { return m_isPublishPending; }
+
+
+    /**
+     * @brief SetIsPublishPending
+     * @param isPublishPending whether a snapshot has to be published
+     */
+    void SetIsPublishPending(bool isPublishPending) { m_isPublishPending = isPublishPending; }
+
+
+    /**
+     * @brief IsWritePending
+     * @return whether the worker waits for the pty to accept queued keystrokes
+     */
+    bool IsWritePending() const { return m_isWritePending; }
+
+
+    /**
+     * @brief SetIsWritePending
+     * @param isWritePending whether queued keystrokes wait for the pty
+     */
+    void SetIsWritePending(bool isWritePending) { m_isWritePending = isWritePending; }
+
+
+    /**
+     * @brief GetWriteBacklog
+     * @return number of keystroke bytes the pty didn't accept yet
+     */
+    uint32_t GetWriteBacklog() const { return m_writeBacklog; }
+
+
+    /**
+     * @brief SetWriteBacklog
+     * @param writeBacklog the backlog to set
+     */
+    void SetWriteBacklog(uint32_t writeBacklog) { m_writeBacklog = writeBacklog; }
+
+
+    /**
+     * @brief GetReadDeficit
+     * @return bytes the reader is still allowed to consume in the current round
+     */
+    uint32_t GetReadDeficit() const { return m_readDeficit; }
+
+
+    /**
+     * @brief SetReadDeficit
+     * @param readDeficit the deficit to set
+     */
+    void SetReadDeficit(uint32_t readDeficit) { m_readDeficit = readDeficit; }
+
+
+    /**
+     * @brief IsReadPending
+     * @return whether the machine is queued for reading
+     */
+    bool IsReadPending() const { return m_isReadPending; }
+
+
+    /**
+     * @brief SetIsReadPending
+     * @param isReadPending whether the machine is queued for reading
+     */
+    void SetIsReadPending(bool isReadPending) { m_isReadPending = isReadPending; }
+
+
+    /**
+     * @brief GetReadBacklog
+     * @return bytes waiting in the pty after the last read
+     */
+    uint32_t GetReadBacklog() const { return m_readBacklog; }
+
+
+    /**
+     * @brief SetReadBacklog
+     * @param readBacklog the backlog to set
+     */
+    void SetReadBacklog(uint32_t readBacklog) { m_readBacklog = readBacklog; }
+
+
+    /**
+     * @brief IsStalled
+     * @details Cleared as soon as the machine prints something again.
+     * @return whether the machine was found silent when it should have answered
+     */
+    bool IsStalled() const { return m_isStalled && m_rawRing.GetHead() == m_stalledPosition; }
+
+
+    /**
+     * @brief Flags the machine as stalled until its next output.
+     */
+    void MarkStalled() {
+        m_isStalled = true;
+        m_stalledPosition = m_rawRing.GetHead();
+    }
+
+
+    /**
+     * @brief GetStallTimer
+     * @details Armed by the UI thread when the machine has to answer: after
+     *          keystrokes, and for its login.
+     * @return the timer expiring when the machine didn't answer in time
+     */
+    OmniTimer &GetStallTimer() { return m_stallTimer; }
+
+
+    /**
+     * @brief GetInputPosition
+     * @return the end of the raw output when the stall timer was armed
+     */
+    uint64_t GetInputPosition() const { return m_inputPosition; }
+
+
+    /**
+     * @brief SetInputPosition
+     * @param inputPosition the position to set
+     */
+    void SetInputPosition(uint64_t inputPosition) { m_inputPosition = inputPosition; }
+
+
+    /**
+     * @brief GetProbeTimer
+     * @return the periodic timer checking whether the machine takes its input
+     */
+    OmniTimer &GetProbeTimer() { return m_probeTimer; }
+
+
+    /**
+     * @brief GetProbedWriteBacklog
+     * @return the keystrokes the pty didn't accept at the previous probe
+     */
+    uint32_t GetProbedWriteBacklog() const { return m_probedWriteBacklog; }
+
+
+    /**
+     * @brief SetProbedWriteBacklog
+     * @param probedWriteBacklog the backlog to set
+     */
+    void SetProbedWriteBacklog(uint32_t probedWriteBacklog) { m_probedWriteBacklog = probedWriteBacklog; }
+
+
+    /**
+     * @brief GetRawRing
+     * @details The worker draining the pty produces into it, other
+     *          consumers read it with a cursor of their own.
+     * @return the ring of the pty's raw output
+     */
+    OmniRawRing &GetRawRing() { return m_rawRing; }
+
+
+    /**
+     * @brief Producer side: returns where the next pty bytes go in the raw
+     *        ring, see OmniRawRing::Reserve(). The terminal mutex must be held.
+     * @details Deferred output that the reservation would overwrite is
+     *          parsed first, nothing is ever lost.
+     */
+    char *ReserveRawOutput(uint32_t maxBytes, uint32_t *length);
+
+
+    /**
+     * @brief Producer side: publishes the bytes written in the reservation
+     *        and parses them, unless parsing is deferred.
+     */
+    void CommitRawOutput(uint32_t length);
+
+
+    /**
+     * @brief Producer side: ReserveRawOutput(), copy and CommitRawOutput().
+     */
+    void AppendRawOutput(const char *data, uint32_t length);
+
+
+    /**
+     * @brief Feeds the terminal with the raw output it didn't parse yet.
+     * @details The terminal mutex must be held, the producer only writes the
+     *          ring with it held.
+     * @return the number of bytes parsed
+     */
+    uint32_t ParseRawOutput();
+
+
+    /**
+     * @brief IsParseDeferred
+     * @return whether new output is only kept in the raw ring, because the
+     *         machine isn't on screen and lazy parsing is on
+     */
+    bool IsParseDeferred() const { return m_isParseDeferred; }
+
+
+    /**
+     * @brief SetIsParseDeferred
+     * @details Whoever stops the deferral has the worker parse the backlog.
+     * @param isParseDeferred whether to defer parsing
+     */
+    void SetIsParseDeferred(bool isParseDeferred) { m_isParseDeferred = isParseDeferred; }
+
+
+    /**
+     * @brief HasDeferredOutput
+     * @details Safe to call from any thread.
+     * @return whether the ring holds output the terminal didn't parse yet
+     */
+    bool HasDeferredOutput() const { return m_rawRing.GetHead() > m_parsedPosition; }
+
+
+    /**
+     * @brief GetParseBacklog
+     * @details The terminal mutex must be held.
+     * @return raw bytes the terminal didn't parse yet
+     */
+    uint64_t GetParseBacklog() const { return m_rawRing.GetDepth(m_parserCursor); }
+
+
+    /**
+     * @brief GetParseOverrunBytes
+     * @details The terminal mutex must be held.
+     * @return raw bytes the terminal never got, overwritten before parsing
+     */
+    uint64_t GetParseOverrunBytes() const { return m_parserCursor.m_overrunBytes; }
+
+
+    /**
+     * @brief GetScrollback
+     * @details Filled by the thread parsing the terminal, safe to read from
+     *          any thread.
+     * @return the lines scrolled off the terminal, nullptr if none are kept
+     */
+    const OmniScrollback *GetScrollback() const { return m_scrollback.get(); }
+
+
+    /**
+     * @brief Drops scrollback, oldest lines first, see OmniScrollback::Shrink().
+     * @return the bytes freed
+     */
+    size_t ShrinkScrollback(size_t bytes) { return m_scrollback ? m_scrollback->Shrink(bytes) : 0; }
+
+
+    /**
+     * @brief GetMemoryUsage
+     * @details Safe to call from any thread.
+     * @return the memory held by the machine
+     */
+    OmniMemoryUsage GetMemoryUsage() const;
+
+
+    /**
+     * @brief GetLastShownMs
+     * @return when the machine was last on screen, see OmniTimerWheel::Now(),
+     *         0 if it never was
+     */
+    uint64_t GetLastShownMs() const { return m_lastShownMs; }
+
+
+    /**
+     * @brief SetLastShownMs
+     * @param lastShownMs when the machine was last on screen
+     */
+    void SetLastShownMs(uint64_t lastShownMs) { m_lastShownMs = lastShownMs; }
+
+
+    /**
+     * @brief GetTranscript
+     * @details Only used by the worker draining the pty.
+     * @return the session transcript, nullptr if the machine has none
+     */
+    OmniTranscript *GetTranscript() const { return m_transcript.get(); }
+
+
+    /**
+     * @brief SetTranscript
+     * @details Must be set before the machine is handed to a worker.
+     * @param transcript the transcript to record the pty's output in
+     */
+    void SetTranscript(std::unique_ptr<OmniTranscript> transcript) { m_transcript = std::move(transcript); }
+
+
     /**
      * @brief Save machine's 'tagged' state.
      */
@@ -134,8 +492,46 @@ private:
     std::string             m_machineIp;
     /** the following stack is used for storing the 'tagged' state for later retrieval */
     std::vector<uint8_t>    m_tagStack;
+    /** guards m_virtualTerminal, which the worker parses while the UI thread writes keys */
+    std::mutex              m_terminalMutex;
+    /** latest screen published by the worker, accessed atomically */
+    ScreenSnapshotPtr       m_screenSnapshot;
+    /** index of the worker draining the pty, see OmniMachineManager */
+    uint32_t                m_workerId;
+    /** deficit round robin state of the pty reader, owned by the worker */
+    uint32_t                m_readDeficit;
+    bool                    m_isReadPending;
+    bool                    m_isPublishPending;
+    /** written by the worker, read by the UI thread */
+    std::atomic<uint32_t>   m_readBacklog;
+    /** pty output queue state, guarded by m_terminalMutex */
+    bool                    m_isWritePending;
+    /** written under m_terminalMutex, read by the UI thread when drawing */
+    std::atomic<uint32_t>   m_writeBacklog;
+    /** raw pty output, and the terminal's position in it (guarded by m_terminalMutex) */
+    OmniRawRing             m_rawRing;
+    OmniRawRing::Cursor     m_parserCursor;
+    /** m_parserCursor's position, for the threads that don't hold the mutex */
+    std::atomic<uint64_t>   m_parsedPosition;
+    /** set by the UI thread, read by the producer */
+    std::atomic<bool>       m_isParseDeferred;
+    /** lines scrolled off the terminal, optional */
+    std::unique_ptr<OmniScrollback> m_scrollback;
+    /** owned by the UI thread, orders the machines for memory eviction */
+    uint64_t                m_lastShownMs;
+    /** optional record of everything the pty printed */
+    std::unique_ptr<OmniTranscript> m_transcript;
+    /** hung session detection, owned by the UI thread */
+    bool                    m_isStalled;
+    uint64_t                m_stalledPosition;
+    OmniTimer               m_stallTimer;
+    uint64_t                m_inputPosition;
+    OmniTimer               m_probeTimer;
+    uint32_t                m_probedWriteBacklog;
 };
 
 
-}
+typedef std::shared_ptr<OmniMachine> MachinePtr;
 
+
+}
@@ -1,3 +1,4 @@
+#include <future>
 #include <fstream>
 #include <algorithm>
 #include "log.h"
@@ -9,6 +10,15 @@
 
 
 #define MACHINE_MAX 256
+/* output scanned for the summary of a machine that wasn't parsed */
+#define SUMMARY_TAIL_BYTES 1024
+/* how often the memory budget is checked */
+#define MEMORY_CHECK_INTERVAL_MS 1000
+/* once over budget, memory is freed down to this share of the budget, so
+ * that the machines don't lose scrollback at every check */
+#define MEMORY_LOW_WATER_PERCENT 90
+/* sessions of the same machine sharing a transcript directory */
+#define TRANSCRIPT_SESSION_MAX 64
 
 
 using namespace omnitty;
@@ -60,14 +70,59 @@ bool OmniMachineInfo::IsMatchFuzzySearch(const std::string &searchInfo) const
 
 OmniMachineManager::OmniMachineManager()
     : m_isMulticast(false), m_selectedMachine(0), m_scrollPos(0),
-      m_virtualTerminalRows(0), m_virtualTerminalCols(0)
+      m_virtualTerminalRows(0), m_virtualTerminalCols(0), m_isPublishNotified(false),
+      m_isInlineWorker(false), m_nextWorker(0)
 {
+
 }
 
 
-OmniMachineManager::~OmniMachineManager()
+bool OmniMachineManager::Init()
 {
+    if (!m_eventLoop.Init()) {
+        LOG4CPLUS_ERROR(omnitty::LOGGER_NAME, "cannot init the event loop");
+        return false;
+    }
+    /* SIGCHLD is blocked already, nothing else would ever reap the children */
+    if (!m_childReaper.Init()) {
+        LOG4CPLUS_ERROR(omnitty::LOGGER_NAME, "cannot init the child reaper");
+        return false;
+    }
+    m_eventLoop.AddFd(m_childReaper.GetFd(), OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+        int count = m_childReaper.Reap([this](pid_t pid, int) {
+            HandleDeath(pid);
+        });
+        LOG4CPLUS_DEBUG_FMT(omnitty::LOGGER_NAME, "reaped %d children", count);
+    });
+    if (!m_publishNotifier.Init()) {
+        LOG4CPLUS_ERROR(omnitty::LOGGER_NAME, "cannot init the publish notifier");
+        return false;
+    }
+    m_eventLoop.AddFd(m_publishNotifier.GetFd(), OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+        /* reset before consuming, a publication racing with us then
+         * notifies again instead of being lost */
+        m_isPublishNotified = false;
+        m_publishNotifier.Clear();
+    });
+    StartWorkers();
 
+    if (OmniConfig::GetInstance()->GetMemoryBudgetMb() > 0) {
+        OmniTimerWheel &timers = m_eventLoop.GetTimers();
+        m_memoryTimer.SetCallback([this, &timers]() {
+            BalanceMemory();
+            timers.Schedule(m_memoryTimer, MEMORY_CHECK_INTERVAL_MS);
+        });
+        timers.Schedule(m_memoryTimer, MEMORY_CHECK_INTERVAL_MS);
+    }
+    return true;
+}
+
+
+OmniMachineManager::~OmniMachineManager()
+{
+    for (auto &worker : m_workers) {
+        worker->Stop();
+    }
 }
 
 bool OmniMachineManager::LoadMachines(const std::string &fileName)
@@ -106,7 +161,14 @@ int OmniMachineManager::AddMachine(const std::string &machineName, const std::st
 {
     if (machineIp.empty() || m_machines.size() >= MACHINE_MAX) return 0;
     m_machines.push_back(std::make_shared<OmniMachine>(machineName, machineIp,
-        OmniConfig::GetInstance()->GetCommand(machineIp), m_virtualTerminalRows, m_virtualTerminalCols));
+        OmniConfig::GetInstance()->GetCommand(machineIp), m_virtualTerminalRows, m_virtualTerminalCols,
+        OmniConfig::GetInstance()->GetRawRingBytes(), OmniConfig::GetInstance()->GetScrollbackLines()));
+    MachinePtr &machine = m_machines.back();
+    if (machine->GetPid() > 0) m_machinesByPid[machine->GetPid()] = machine;
+    machine->SetIsParseDeferred(OmniConfig::GetInstance()->IsLazyParsing());
+    OpenTranscript(machine);
+    WatchMachine(machine);
+    WatchSession(machine);
     return static_cast<int>(m_machines.size() - 1);
 }
 
@@ -170,7 +232,7 @@ void OmniMachineManager::DeleteTaggedMachines()
     auto iter = m_machines.begin();
     while (iter != m_machines.end()) {
         if ((*iter)->IsTagged()) {
-            m_machines.erase(iter++);
+            iter = EraseMachine(iter);
             continue;
         }
         ++iter;
@@ -180,7 +242,12 @@ void OmniMachineManager::DeleteTaggedMachines()
 
 void OmniMachineManager::DeleteAllMachines()
 {
+    for (auto &machine : m_machines) {
+        UnwatchMachine(machine);
+    }
     m_machines.clear();
+    m_machinesByPid.clear();
+    m_visibleMachine.reset();
     m_selectedMachine = 0;
     m_scrollPos = 0;
 }
@@ -190,8 +257,8 @@ void OmniMachineManager::DeleteDeadMachines()
 {
     auto iter = m_machines.begin();
     while (iter != m_machines.end()) {
-        if ((*iter)->IsAlive()) {
-            m_machines.erase(iter++);
+        if (!(*iter)->IsAlive()) {
+            iter = EraseMachine(iter);
             continue;
         }
         ++iter;
@@ -202,15 +269,17 @@ void OmniMachineManager::DeleteDeadMachines()
 void OmniMachineManager::RenameMachine(const std::string &newName)
 {
     m_machines[m_selectedMachine]->SetMachineName(newName);
-    UpdateAllMachines();
 }
 
 
-void OmniMachineManager::UpdateAllMachines()
+int OmniMachineManager::WaitForEvents(int timeoutMs)
 {
-    for (auto &machine : m_machines) {
-        rote_vt_update(machine->GetVirtualTerminal());
-    }
+    /* don't sleep while some terminal still has output to drain */
+    bool isDraining = m_isInlineWorker && m_workers[0]->HasPendingReads();
+    int events = m_eventLoop.Wait(isDraining ? 0 : timeoutMs);
+    if (isDraining) m_workers[0]->RunOnce(0);
+    if (m_isInlineWorker && m_isPublishNotified.exchange(false)) events = std::max(events, 1);
+    return events;
 }
 
 
@@ -235,37 +304,41 @@ void OmniMachineManager::ResetSelectedMachine(int height)
             m_scrollPos = m_selectedMachine - height + 1;
         }
     }
+    ShowMachine(m_machines.empty() ? MachinePtr() : m_machines[m_selectedMachine]);
 }
 
 
 std::string OmniMachineManager::MakeVirtualTerminalSummary(uint32_t machineIndex, int summaryWidth)
 {
     if (machineIndex >= m_machines.size()) return std::string();
-    MachinePtr machine = m_machines[machineIndex];
-    RoteTerm *rt = machine->GetVirtualTerminal();
+    MachinePtr &machine = m_machines[machineIndex];
+    if (machine->HasDeferredOutput()) return MakeRawOutputSummary(machine->GetRawRing(), summaryWidth);
+    ScreenSnapshotPtr snapshot = machine->GetScreenSnapshot();
 
+    /* right aligned: the text up to the cursor, preceded by the rows above
+     * it without their trailing blanks (but one), row 0 left out */
     std::string summary(summaryWidth, '\0');
-    int r = rt->crow;
-    int c = rt->ccol;
-    for (int i = summaryWidth - 2; i >= 0; --i) {
-        if (r > 0) {
-            summary[i] = rt->cells[r][c].ch;
-            if ((static_cast<int>(summary[i]) >= 0 && static_cast<int>(summary[i]) < 32) ||
-                    static_cast<int>(summary[i]) == 127) {
-                summary[i] = 32;
-            }
-        } else {
-            summary[i] = 32;
+    int r = snapshot->m_cursorRow;
+    int c = std::min(snapshot->m_cursorCol, snapshot->m_cols - 1);
+    int i = summaryWidth - 1;
+    while (i > 0 && r > 0) {
+        const std::string &text = snapshot->GetRow(r).m_text;
+        int count = std::min(c + 1, i);
+        std::copy(text.begin() + (c + 1 - count), text.begin() + (c + 1), summary.begin() + (i - count));
+        i -= count;
+
+        if (--r > 0) {
+            size_t last = snapshot->GetRow(r).m_text.find_last_not_of(' ', snapshot->m_cols - 2);
+            c = (last == std::string::npos) ? 0 : static_cast<int>(last) + 1;
         }
+    }
+    std::fill(summary.begin(), summary.begin() + std::max(i, 0), ' ');
 
-        if (--c < 0) {
-            c = rt->cols - 1;
-            if (--r > 0) {
-                while (c > 0 && rt->cells[r][c-1].ch == 32) {
-                    --c;
-                }
-            }
-        }
+    /* a glyph (see rote.h) shows as '?', the right half of a wide one as blank */
+    for (int k = 0; k < summaryWidth - 1; ++k) {
+        unsigned char ch = static_cast<unsigned char>(summary[k]);
+        if (ch < 32 || ch == 127 || ch == ROTE_CELL_WIDE_TAIL) summary[k] = ' ';
+        else if (ch == ROTE_CELL_GLYPH) summary[k] = '?';
     }
     return summary;
 }
@@ -287,6 +360,27 @@ void OmniMachineManager::TagAll(bool ignoreDead)
 }
 
 
+void OmniMachineManager::SetVirtualTerminalSize(uint32_t virtualTerminalRows, uint32_t virtualTerminalCols)
+{
+    if (virtualTerminalRows == m_virtualTerminalRows && virtualTerminalCols == m_virtualTerminalCols) return;
+    m_virtualTerminalRows = virtualTerminalRows;
+    m_virtualTerminalCols = virtualTerminalCols;
+    if (m_machines.empty()) return;
+
+    LOG4CPLUS_INFO_FMT(omnitty::LOGGER_NAME, "resize %u terminals to %u x %u", GetMachineCount(),
+                       virtualTerminalCols, virtualTerminalRows);
+    std::vector<MachineList> batches(m_workers.size());
+    for (auto &machine : m_machines) {
+        batches[machine->GetWorkerId()].push_back(machine);
+    }
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (batches[i].empty()) continue;
+        m_workers[i]->ResizeMachines(batches[i], static_cast<int>(virtualTerminalRows),
+                                     static_cast<int>(virtualTerminalCols));
+    }
+}
+
+
 void OmniMachineManager::UnTagAll()
 {
     for (auto &machine : m_machines) {
@@ -295,6 +389,51 @@ void OmniMachineManager::UnTagAll()
 }
 
 
+void OmniMachineManager::TagSameScreen()
+{
+    if (m_selectedMachine < 0 || m_selectedMachine >= static_cast<int>(m_machines.size())) return;
+
+    UnTagAll();
+    for (const auto &group : GroupMachinesByScreen()) {
+        if (std::find(group.begin(), group.end(), static_cast<uint32_t>(m_selectedMachine)) == group.end()) continue;
+        for (uint32_t index : group) {
+            m_machines[index]->SetIsTagged(true);
+        }
+    }
+}
+
+
+std::vector<std::vector<uint32_t>> OmniMachineManager::GroupMachinesByScreen()
+{
+    CatchUpDeferredMachines();
+
+    std::vector<std::vector<uint32_t>> groups;
+    /* the snapshot of each group's first machine, and the groups by hash */
+    std::vector<ScreenSnapshotPtr> groupSnapshots;
+    std::unordered_multimap<uint64_t, size_t> groupsByHash;
+
+    for (uint32_t i = 0; i < m_machines.size(); ++i) {
+        ScreenSnapshotPtr snapshot = m_machines[i]->GetScreenSnapshot();
+
+        size_t group = groups.size();
+        auto range = groupsByHash.equal_range(snapshot->m_hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (groupSnapshots[it->second]->HasSameCells(*snapshot)) {
+                group = it->second;
+                break;
+            }
+        }
+        if (group == groups.size()) {
+            groups.emplace_back();
+            groupSnapshots.push_back(snapshot);
+            groupsByHash.emplace(snapshot->m_hash, group);
+        }
+        groups[group].push_back(i);
+    }
+    return groups;
+}
+
+
 void OmniMachineManager::PrevMachine()
 {
     --m_selectedMachine;
@@ -306,29 +445,42 @@ void OmniMachineManager::NextMachine()
     ++m_selectedMachine;
 }
 
-void OmniMachineManager::ForwardKeypress(int key)
+void OmniMachineManager::ForwardKeypresses(const std::vector<int> &keys)
 {
+    if (keys.empty()) return;
+    int count = static_cast<int>(keys.size());
+
     if (m_isMulticast) {
         std::for_each(m_machines.begin(), m_machines.end(), [&](std::shared_ptr<OmniMachine> &machine){
-            if (machine->IsTagged()) rote_vt_keypress(machine->GetVirtualTerminal(), key);
+            if (!machine->IsTagged()) return;
+            std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+            rote_vt_keypresses(machine->GetVirtualTerminal(), keys.data(), count);
+            WatchOutput(machine);
+            WatchInput(machine);
         });
         return;
     }
 
-    if (m_selectedMachine >= 0 && m_selectedMachine < static_cast<int>(m_machines.size()))
-        rote_vt_keypress(m_machines[m_selectedMachine]->GetVirtualTerminal(), key);
+    if (m_selectedMachine >= 0 && m_selectedMachine < static_cast<int>(m_machines.size())) {
+        MachinePtr &machine = m_machines[m_selectedMachine];
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        rote_vt_keypresses(machine->GetVirtualTerminal(), keys.data(), count);
+        WatchOutput(machine);
+        WatchInput(machine);
+    }
 }
 
 
 void OmniMachineManager::HandleDeath(pid_t pid)
 {
-    for (auto &machine : m_machines) {
-        if (machine->GetPid() == pid) {
-            machine->SetIsAlive(false);
-            rote_vt_forsake_child(machine->GetVirtualTerminal());
-            break;
-        }
-    }
+    auto iter = m_machinesByPid.find(pid);
+    if (iter == m_machinesByPid.end()) return;
+
+    MachinePtr machine = iter->second;
+    m_machinesByPid.erase(iter);
+    machine->SetIsAlive(false);
+    UnwatchSession(machine);
+    m_workers[machine->GetWorkerId()]->ForsakeMachine(machine);
 }
 
 void OmniMachineManager::SendCommand(int machineId, const std::string &cmd)
@@ -336,9 +488,11 @@ void OmniMachineManager::SendCommand(int machineId, const std::string &cmd)
     if (machineId >= static_cast<int>(m_machines.size())) return;
 
     MachinePtr &machine = m_machines[machineId];
-    for (auto ch : cmd) {
-        rote_vt_keypress(machine->GetVirtualTerminal(), ch);
-    }
+    std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+    std::vector<int> keys(cmd.begin(), cmd.end());
+    rote_vt_keypresses(machine->GetVirtualTerminal(), keys.data(), static_cast<int>(keys.size()));
+    WatchOutput(machine);
+    WatchInput(machine);
 }
 
 
@@ -346,5 +500,340 @@ void OmniMachineManager::DeleteMachineByIndex(int index)
 {
     if (index < 0 || index >= static_cast<int>(m_machines.size()))
         return;
-    m_machines.erase(m_machines.begin() + index);
+    EraseMachine(m_machines.begin() + index);
+}
+
+
+MachineList::iterator OmniMachineManager::EraseMachine(MachineList::iterator iter)
+{
+    auto pidIter = m_machinesByPid.find((*iter)->GetPid());
+    if (pidIter != m_machinesByPid.end() && pidIter->second == *iter) m_machinesByPid.erase(pidIter);
+    OmniRawRing &ring = (*iter)->GetRawRing();
+    LOG4CPLUS_DEBUG_FMT(omnitty::LOGGER_NAME, "delete machine %s, raw output: %llu bytes, %llu overrun",
+        (*iter)->GetMachineName().c_str(), static_cast<unsigned long long>(ring.GetHead()),
+        static_cast<unsigned long long>(ring.GetOverrunBytes()));
+    if (*iter == m_visibleMachine) m_visibleMachine.reset();
+    UnwatchMachine(*iter);
+    return m_machines.erase(iter);
+}
+
+
+void OmniMachineManager::StartWorkers()
+{
+    uint32_t workerThreads = OmniConfig::GetInstance()->GetWorkerThreads();
+    m_isInlineWorker = (workerThreads == 0);
+
+    auto onPublished = [this]() {
+        /* an inline worker publishes on this thread, WaitForEvents() sees the flag */
+        if (!m_isPublishNotified.exchange(true) && !m_isInlineWorker) m_publishNotifier.Notify();
+    };
+    for (uint32_t i = 0; i < std::max(workerThreads, 1u); ++i) {
+        std::unique_ptr<OmniTerminalWorker> worker(new OmniTerminalWorker(i, onPublished));
+        if (!worker->Init()) {
+            LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot init terminal worker %u", i);
+            continue;
+        }
+        if (!m_isInlineWorker && !worker->Start()) continue;
+        m_workers.push_back(std::move(worker));
+    }
+
+    if (m_workers.empty()) {
+        /* no thread could be started, drain the ptys on this thread */
+        LOG4CPLUS_WARN(omnitty::LOGGER_NAME, "no terminal worker thread, falling back to inline draining");
+        m_workers.emplace_back(new OmniTerminalWorker(0, onPublished));
+        m_workers[0]->Init();
+        m_isInlineWorker = true;
+    }
+
+    if (m_isInlineWorker) {
+        /* the worker's loop is nested in ours, its fd is readable whenever
+         * one of its ptys or tasks is */
+        m_eventLoop.AddFd(m_workers[0]->GetFd(), OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+            m_workers[0]->RunOnce(0);
+        });
+    }
+    LOG4CPLUS_INFO_FMT(omnitty::LOGGER_NAME, "terminal workers: %lu, inline: %d",
+        m_workers.size(), m_isInlineWorker ? 1 : 0);
+}
+
+
+void OmniMachineManager::OpenTranscript(const MachinePtr &machine)
+{
+    OmniConfig *config = OmniConfig::GetInstance();
+    if (config->GetTranscriptDirectory().empty()) return;
+
+    std::string fileName = machine->GetMachineName();
+    std::replace(fileName.begin(), fileName.end(), '/', '_');
+    std::string path = config->GetTranscriptDirectory() + "/" + fileName;
+    /* the same machine added twice, or by another omnitty, gets name-2.log and so on */
+    for (int session = 1; session <= TRANSCRIPT_SESSION_MAX; ++session) {
+        std::unique_ptr<OmniTranscript> transcript(new OmniTranscript(
+            session == 1 ? path + ".log" : path + "-" + std::to_string(session) + ".log",
+            config->GetTranscriptMaxBytes(), config->GetTranscriptRotations()));
+        if (transcript->Open()) {
+            machine->SetTranscript(std::move(transcript));
+            return;
+        }
+        if (!transcript->IsInUse()) return;
+    }
+    LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "no free transcript for %s", fileName.c_str());
+}
+
+
+void OmniMachineManager::ShowMachine(const MachinePtr &machine)
+{
+    if (machine == m_visibleMachine) return;
+
+    bool isLazyParsing = OmniConfig::GetInstance()->IsLazyParsing();
+    if (m_visibleMachine) {
+        m_visibleMachine->SetIsParseDeferred(isLazyParsing);
+        m_visibleMachine->SetLastShownMs(OmniTimerWheel::Now());
+    }
+    m_visibleMachine = machine;
+    if (!machine || !isLazyParsing) return;
+
+    machine->SetIsParseDeferred(false);
+    m_workers[machine->GetWorkerId()]->RevealMachine(machine);
+}
+
+
+OmniMemoryUsage OmniMachineManager::GetMemoryUsage() const
+{
+    OmniMemoryUsage usage;
+    for (const MachinePtr &machine : m_machines) {
+        usage += machine->GetMemoryUsage();
+    }
+    return usage;
+}
+
+
+void OmniMachineManager::BalanceMemory()
+{
+    size_t budgetBytes = static_cast<size_t>(OmniConfig::GetInstance()->GetMemoryBudgetMb()) * 1024 * 1024;
+    OmniMemoryUsage usage = GetMemoryUsage();
+    size_t usedBytes = usage.GetTotalBytes();
+    if (budgetBytes == 0 || usedBytes <= budgetBytes) return;
+
+    /* least recently shown first, the machine on screen counts as shown now */
+    MachineList machines(m_machines);
+    std::sort(machines.begin(), machines.end(), [this](const MachinePtr &lhs, const MachinePtr &rhs) {
+        if ((lhs == m_visibleMachine) != (rhs == m_visibleMachine)) return rhs == m_visibleMachine;
+        return lhs->GetLastShownMs() < rhs->GetLastShownMs();
+    });
+
+    size_t excessBytes = usedBytes - budgetBytes / 100 * MEMORY_LOW_WATER_PERCENT;
+    size_t freedBytes = 0;
+    int shrunkMachines = 0;
+    for (const MachinePtr &machine : machines) {
+        if (freedBytes >= excessBytes) break;
+        size_t bytes = machine->ShrinkScrollback(excessBytes - freedBytes);
+        if (bytes == 0) continue;
+        freedBytes += bytes;
+        ++shrunkMachines;
+        LOG4CPLUS_DEBUG_FMT(omnitty::LOGGER_NAME, "machine %s: freed %zu bytes of scrollback, %zu left",
+                            machine->GetMachineName().c_str(), bytes, machine->GetMemoryUsage().m_historyBytes);
+    }
+
+    LOG4CPLUS_INFO_FMT(omnitty::LOGGER_NAME,
+        "memory budget %zu KB exceeded: %zu KB used (cells %zu KB, scrollback %zu KB, raw output %zu KB), "
+        "freed %zu KB of scrollback on %d machines", budgetBytes / 1024, usedBytes / 1024,
+        usage.m_cellBytes / 1024, usage.m_historyBytes / 1024, usage.m_rawBytes / 1024,
+        freedBytes / 1024, shrunkMachines);
+    if (freedBytes < usedBytes - budgetBytes) {
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "memory budget %zu KB is too small for the terminals and raw "
+                           "output of %zu machines alone", budgetBytes / 1024, m_machines.size());
+    }
+}
+
+
+void OmniMachineManager::CatchUpDeferredMachines()
+{
+    std::vector<std::vector<MachinePtr>> batches(m_workers.size());
+    for (auto &machine : m_machines) {
+        if (machine->HasDeferredOutput()) batches[machine->GetWorkerId()].push_back(machine);
+    }
+
+    std::vector<std::future<void>> caughtUp;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (batches[i].empty()) continue;
+        auto done = std::make_shared<std::promise<void>>();
+        caughtUp.push_back(done->get_future());
+        m_workers[i]->CatchUpMachines(batches[i], [done]() { done->set_value(); });
+    }
+    for (auto &future : caughtUp) {
+        /* an inline worker only runs its tasks when we drive it */
+        while (m_isInlineWorker && future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            m_workers[0]->RunOnce(0);
+        }
+        future.wait();
+    }
+}
+
+
+std::string OmniMachineManager::MakeRawOutputSummary(OmniRawRing &ring, int summaryWidth)
+{
+    /* copied without the terminal mutex, the worker keeps reading meanwhile */
+    char tail[SUMMARY_TAIL_BYTES];
+    OmniRawRing::Cursor cursor;
+    uint64_t head = ring.GetHead();
+    cursor.m_position = head > SUMMARY_TAIL_BYTES ? head - SUMMARY_TAIL_BYTES : 0;
+    uint32_t length = ring.Read(cursor, tail, SUMMARY_TAIL_BYTES);
+
+    /* a rough terminal of two lines: text, autowrap, \r, \n, \b, \t and
+     * erase in line are applied, other escape sequences are skipped; the tail
+     * may start in the middle of one, that only garbles its first bytes */
+    size_t cols = std::max<size_t>(m_virtualTerminalCols, 1);
+    enum { TEXT, ESCAPE, CSI, STRING, STRING_ESCAPE } state = TEXT;
+    std::string previousLine, line;
+    size_t col = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+        char ch = tail[i];
+        switch (state) {
+        case ESCAPE:
+            state = (ch == '[') ? CSI : (ch == ']' || ch == 'P' || ch == '^' || ch == '_') ? STRING : TEXT;
+            continue;
+        case CSI:
+            if (ch >= 0x40 && ch <= 0x7e) {
+                if (ch == 'K' && col < line.size()) line.resize(col);
+                state = TEXT;
+            }
+            continue;
+        case STRING:
+            if (ch == '\a') state = TEXT;
+            else if (ch == '\033') state = STRING_ESCAPE;
+            continue;
+        case STRING_ESCAPE:
+            state = (ch == '\\') ? TEXT : STRING;
+            continue;
+        case TEXT:
+            break;
+        }
+
+        if (ch == '\033') {
+            state = ESCAPE;
+        } else if (ch == '\r') {
+            col = 0;
+        } else if (ch == '\n') {
+            previousLine.swap(line);
+            line.clear();
+            col = 0;
+        } else if (ch == '\b') {
+            if (col > 0) --col;
+        } else if (ch == '\t') {
+            col = std::min((col / 8 + 1) * 8, cols - 1);
+        } else if ((static_cast<int>(ch) < 0 || static_cast<int>(ch) >= 32) && static_cast<int>(ch) != 127) {
+            /* a UTF-8 character is a '?', its continuation bytes are skipped */
+            if ((ch & 0xC0) == 0x80) continue;
+            if (col >= cols) {
+                previousLine.swap(line);
+                line.clear();
+                col = 0;
+            }
+            if (col >= line.size()) line.resize(col + 1, ' ');
+            line[col++] = (static_cast<int>(ch) < 0) ? '?' : ch;
+        }
+    }
+
+    /* like the snapshot's summary: the previous line without its trailing
+     * spaces, then the current one up to the cell under the cursor */
+    previousLine.erase(previousLine.find_last_not_of(' ') + 1);
+    line.resize(col + 1, ' ');
+    std::string text = previousLine + line;
+
+    std::string summary(summaryWidth, '\0');
+    for (int i = summaryWidth - 2, j = static_cast<int>(text.size()) - 1; i >= 0; --i, --j) {
+        summary[i] = j >= 0 ? text[j] : ' ';
+    }
+    return summary;
+}
+
+
+void OmniMachineManager::WatchMachine(const MachinePtr &machine)
+{
+    m_workers[m_nextWorker]->AddMachine(machine);
+    m_nextWorker = (m_nextWorker + 1) % static_cast<uint32_t>(m_workers.size());
+}
+
+
+void OmniMachineManager::WatchOutput(const MachinePtr &machine)
+{
+    RoteTerm *rt = machine->GetVirtualTerminal();
+    if (rote_vt_get_pty_fd(rt) < 0) {
+        /* dead machine, the keys were echoed into its screen */
+        m_workers[machine->GetWorkerId()]->RefreshMachine(machine);
+        return;
+    }
+
+    int pending = rote_vt_pending_output(rt);
+    machine->SetWriteBacklog(static_cast<uint32_t>(pending));
+    if (pending > 0 && !machine->IsWritePending()) {
+        machine->SetIsWritePending(true);
+        m_workers[machine->GetWorkerId()]->FlushMachine(machine);
+    }
+}
+
+
+void OmniMachineManager::UnwatchMachine(const MachinePtr &machine)
+{
+    UnwatchSession(machine);
+    m_workers[machine->GetWorkerId()]->RemoveMachine(machine);
+}
+
+
+void OmniMachineManager::WatchSession(const MachinePtr &machine)
+{
+    OmniConfig *config = OmniConfig::GetInstance();
+    OmniTimerWheel &timers = m_eventLoop.GetTimers();
+    /* the timers are cancelled before the machine is released, and would
+     * keep it alive if they held a MachinePtr */
+    OmniMachine *session = machine.get();
+
+    session->GetStallTimer().SetCallback([session]() {
+        if (session->GetRawRing().GetHead() != session->GetInputPosition()) return;
+        session->MarkStalled();
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "machine %s doesn't answer, stalled",
+                           session->GetMachineName().c_str());
+    });
+    if (config->GetLoginTimeout() > 0) {
+        /* the first output answers the connection */
+        session->SetInputPosition(0);
+        timers.Schedule(session->GetStallTimer(), config->GetLoginTimeout() * 1000);
+    }
+
+    uint32_t probeMs = config->GetProbeInterval() * 1000;
+    if (probeMs == 0) return;
+    session->GetProbeTimer().SetCallback([session, probeMs, &timers]() {
+        /* the pty took none of the queued keystrokes since the last probe */
+        uint32_t backlog = session->GetWriteBacklog();
+        if (backlog > 0 && backlog == session->GetProbedWriteBacklog() && !session->IsStalled()) {
+            session->MarkStalled();
+            LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "machine %s doesn't take its input, stalled",
+                               session->GetMachineName().c_str());
+        }
+        session->SetProbedWriteBacklog(backlog);
+        timers.Schedule(session->GetProbeTimer(), probeMs);
+    });
+    timers.Schedule(session->GetProbeTimer(), probeMs);
+}
+
+
+void OmniMachineManager::UnwatchSession(const MachinePtr &machine)
+{
+    m_eventLoop.GetTimers().Cancel(machine->GetStallTimer());
+    m_eventLoop.GetTimers().Cancel(machine->GetProbeTimer());
+}
+
+
+void OmniMachineManager::WatchInput(const MachinePtr &machine)
+{
+    uint32_t stallMs = OmniConfig::GetInstance()->GetStallTimeout() * 1000;
+    if (stallMs == 0 || !machine->IsAlive()) return;
+
+    /* keys sent before, and still waiting for an answer, keep their deadline */
+    OmniTimer &timer = machine->GetStallTimer();
+    uint64_t position = machine->GetRawRing().GetHead();
+    if (timer.IsArmed() && position == machine->GetInputPosition()) return;
+
+    machine->SetInputPosition(position);
+    m_eventLoop.GetTimers().Schedule(timer, stallMs);
 }
@@ -2,10 +2,15 @@
 #include <set>
 #include <map>
 #include <list>
+#include <atomic>
 #include <memory>
+#include <unordered_map>
 #include <sys/types.h>
 #include <ncurses.h>
 #include "machine.h"
+#include "event_loop.h"
+#include "child_reaper.h"
+#include "terminal_worker.h"
 
 
 namespace omnitty {
@@ -50,7 +55,6 @@ inline bool operator<(const OmniMachineInfo &lhv, const OmniMachineInfo &rhv)
         (!(lhv.m_machineName < rhv.m_machineName) && lhv.m_machineIp < rhv.m_machineIp);
 }
 
-typedef std::shared_ptr<OmniMachine>                      MachinePtr;
 typedef std::vector<MachinePtr>                           MachineList;
 typedef std::map<MachineGroup, std::set<OmniMachineInfo>> MachineGroups;
 
@@ -80,6 +84,13 @@ public:
     ~OmniMachineManager();
 
 
+    /**
+     * @brief Creates the event loop, the child reaper and the terminal workers.
+     * @return false if the event loop or its notifier couldn't be created
+     */
+    bool Init();
+
+
     int GetSelectedMachine() const { return m_selectedMachine; }
 
 
@@ -92,10 +103,16 @@ public:
     MachinePtr GetMachine(uint32_t index) { return index > m_machines.size() ? nullptr : m_machines[index]; }
 
 
-    void SetVirtualTerminalSize(uint32_t virtualTerminalRows, uint32_t virtualTerminalCols) {
-        m_virtualTerminalRows = virtualTerminalRows;
-        m_virtualTerminalCols = virtualTerminalCols;
-    }
+    OmniEventLoop &GetEventLoop() { return m_eventLoop; }
+
+
+    /**
+     * @brief Sets the size of the machines' virtual terminals.
+     * @details The machines already there are resized live: each worker
+     *          gets its machines in one batch, see
+     *          OmniTerminalWorker::ResizeMachines().
+     */
+    void SetVirtualTerminalSize(uint32_t virtualTerminalRows, uint32_t virtualTerminalCols);
 
 
     bool LoadMachines(const std::string &fileName);
@@ -138,11 +155,9 @@ public:
     /**
      * @brief Deletes all dead machines, that is, all machines whose 'alive'.
      *        flag is false.
-     * @details A machine's 'alive' flag is dropped when you call HandleDeath(pid)
-     *          with a pid matching that machine's child ssh process.
-     *          Ordinarily the main program should monitor SIGCHLD signals and call
-     *          machmgr_handle_death appropriately when it detects the death of a
-     *          child process.
+     * @details A machine's 'alive' flag is dropped by HandleDeath(pid), which
+     *          runs from the event loop as soon as the machine's child ssh
+     *          process has been reaped.
      */
     void DeleteDeadMachines();
 
@@ -155,12 +170,26 @@ public:
     
     
     /**
-     * @brief Updates the virtual terminals of all machines.
-     * @details This function should be called regularly.
+     * @brief Waits until stdin or another watched fd is ready, or until a
+     *        terminal worker published new screens.
+     * @details The ptys are drained by OmniTerminalWorker with a deficit round
+     *          robin scheduler: each round a terminal may read up to its
+     *          deficit, which grows by the configured quantum, and the whole
+     *          tick is capped by the configured read budget. With
+     *          WorkerThreads set to 0 the single worker runs inside this call,
+     *          otherwise the workers run on their own threads and this call
+     *          only sees their publications.
+     * @param timeoutMs maximum time to block, -1 blocks until an event arrives
+     * @return the number of handled events, 0 on timeout or interruption
      */
-    void UpdateAllMachines();
+    int WaitForEvents(int timeoutMs);
 
 
+    /**
+     * @brief Clamps the selection and the scrolling to the list, and shows
+     *        the selected machine.
+     * @param height the list window height
+     */
     void ResetSelectedMachine(int height);
 
 
@@ -171,6 +200,13 @@ public:
      * @return summary
      */
     std::string MakeVirtualTerminalSummary(uint32_t machineIndex, int summaryWidth);
+
+
+    /**
+     * @brief GetMemoryUsage
+     * @return the memory held by all the machines together
+     */
+    OmniMemoryUsage GetMemoryUsage() const;
     
 
 public:
@@ -214,6 +250,26 @@ public:
     void UnTagAll();
 
 
+    /**
+     * @brief Tags the machines whose screen shows the same cells as the
+     *        selected machine's, and untags the others, e.g. to single out
+     *        the machines that diverged after a multicast command.
+     */
+    void TagSameScreen();
+
+
+    /**
+     * @brief Groups the machines whose screens show the same cells.
+     * @details Goes by the hashes the terminal workers keep for the published
+     *          screen snapshots: O(rows) per machine at most, the cells aren't
+     *          compared. The output deferred by hidden machines (see
+     *          OmniMachine::IsParseDeferred()) is parsed first, see
+     *          CatchUpDeferredMachines().
+     * @return the indexes of the machines of each group, in list order
+     */
+    std::vector<std::vector<uint32_t>> GroupMachinesByScreen();
+
+
     /**
      * @brief Moves the selection to the previous machine.
      * @details Makes the previous machine in the list the selected machine.
@@ -229,20 +285,23 @@ public:
 
 
     /**
-     * @brief Forwards the given keypress to the appropriate machines.
-     * @details If multicast mode is on, the keypress will be forwarded to all
-     *          tagged machines; otherwise, it will be directed only to the
-     *          currently selected machine.
-     * @param key the pressed key
+     * @brief Forwards the given keypresses to the appropriate machines.
+     * @details If multicast mode is on, the keypresses will be forwarded to
+     *          all tagged machines; otherwise, they will be directed only to
+     *          the currently selected machine. Each machine gets them in one
+     *          write.
+     * @param keys the pressed keys, in order
      */
-    void ForwardKeypress(int key);
+    void ForwardKeypresses(const std::vector<int> &keys);
 
 
     /**
      * @brief Handles the death of PID p.
      * @details This will check if that PID matches the PID of the child ssh
      *          process of any of the machines registered in the manager. If so,
-     *          it will mark that machine as dead.
+     *          it will mark that machine as dead. Called for every child
+     *          reaped on SIGCHLD, the lookup doesn't depend on the number of
+     *          machines.
      * @param pid the machine's pid
      */
     void HandleDeath(pid_t pid);
@@ -259,6 +318,104 @@ protected:
     void DeleteMachineByIndex(int index);
 
 
+    /**
+     * @brief Creates the terminal workers, see OmniConfig::GetWorkerThreads().
+     */
+    void StartWorkers();
+
+
+    /**
+     * @brief Stops watching the machine's pty and removes it from the list.
+     * @param iter the machine's position in the list
+     * @return the position following the erased machine
+     */
+    MachineList::iterator EraseMachine(MachineList::iterator iter);
+
+
+    /**
+     * @brief Gives the machine a session transcript in the configured
+     *        directory, if any.
+     */
+    void OpenTranscript(const MachinePtr &machine);
+
+
+    /**
+     * @brief Makes the machine the one on screen: with lazy parsing, the
+     *        previous one starts deferring its output and this one parses
+     *        what it deferred.
+     * @param machine the machine shown, null if none
+     */
+    void ShowMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Keeps the machines within the configured memory budget.
+     * @details Runs periodically. Once over budget, scrollback is dropped
+     *          from the machines least recently on screen until the total is
+     *          back under a low water mark, the machine on screen goes last.
+     *          The terminals and raw rings are never shrunk.
+     */
+    void BalanceMemory();
+
+
+    /**
+     * @brief Has the workers parse the output deferred by the machines and
+     *        publish their screens, and waits for them.
+     */
+    void CatchUpDeferredMachines();
+
+
+    /**
+     * @brief Summary of a machine whose output wasn't parsed yet, read from
+     *        the tail of its raw output: the text before the cursor on the
+     *        current line, after the previous line.
+     */
+    std::string MakeRawOutputSummary(OmniRawRing &ring, int summaryWidth);
+
+
+    /**
+     * @brief Hands the machine's pty to the next worker, round robin.
+     */
+    void WatchMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Stops watching the machine's pty, before it is closed, and its
+     *        session.
+     */
+    void UnwatchMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Arms the machine's login deadline and its periodic probe.
+     * @details A machine that doesn't answer in time is flagged as stalled
+     *          in the list, e.g. when its network path silently died, which
+     *          no SIGCHLD reports.
+     */
+    void WatchSession(const MachinePtr &machine);
+
+
+    /**
+     * @brief Cancels the timers of WatchSession() and WatchInput().
+     */
+    void UnwatchSession(const MachinePtr &machine);
+
+
+    /**
+     * @brief Called after sending keys to the machine: it has to print
+     *        something (at least their echo) within the stall timeout.
+     */
+    void WatchInput(const MachinePtr &machine);
+
+
+    /**
+     * @brief Called after writing to the machine's terminal, with its mutex
+     *        held: if the pty didn't take everything, the worker flushes the
+     *        rest when the pty becomes writable, the UI never blocks on it.
+     */
+    void WatchOutput(const MachinePtr &machine);
+
+
 protected:
     OmniMachineManager(const OmniMachineManager &) = delete;
     OmniMachineManager &operator=(const OmniMachineManager &) = delete;
@@ -274,7 +431,22 @@ private:
     uint32_t            m_virtualTerminalRows;
     uint32_t            m_virtualTerminalCols;
     MachineList         m_machines;
+    /* the selected machine, the only one parsed when lazy parsing is on */
+    MachinePtr          m_visibleMachine;
     MachineGroups       m_machineGroups;
+    OmniEventLoop       m_eventLoop;
+    /* machines by the pid of their child ssh process */
+    std::unordered_map<pid_t, MachinePtr> m_machinesByPid;
+    OmniChildReaper     m_childReaper;
+    /* made readable by the workers when they published new screens */
+    OmniEventNotifier   m_publishNotifier;
+    std::atomic<bool>   m_isPublishNotified;
+    std::vector<std::unique_ptr<OmniTerminalWorker>> m_workers;
+    /* whether m_workers[0] runs on this thread, inside WaitForEvents() */
+    bool                m_isInlineWorker;
+    uint32_t            m_nextWorker;
+    /* runs BalanceMemory() */
+    OmniTimer           m_memoryTimer;
 };
 
 
@@ -1,45 +1,28 @@
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <signal.h>
-#include <unistd.h>
 #include "log.h"
 #include "config.h"
+#include "child_reaper.h"
 #include "window_manager.h"
 
 
-static volatile int ZOMBIE_MACHINE_COUNT    = 0;
-void SigchldHandler(int)
-{
-    ZOMBIE_MACHINE_COUNT++;
-}
-
-
 int main(int, char **)
 {
+    /* before the logger starts its threads */
+    omnitty::OmniChildReaper::BlockSignal();
     omnitty::OmniConfig::GetInstance()->LoadConfig();
     omnitty::InitLogger();
 
     LOG4CPLUS_INFO(omnitty::LOGGER_NAME, "Omnitty start running.");
-    signal(SIGCHLD, SigchldHandler);
 
     omnitty::OmniWindowManager wndMgr;
-    wndMgr.Init();
+    if (!wndMgr.Init()) {
+        LOG4CPLUS_ERROR(omnitty::LOGGER_NAME, "Omnitty failed to start.");
+        return 1;
+    }
     wndMgr.LoadMachines();
     
-    pid_t chldpid;
-    int ch = 0;
     bool quit = false;
     while (!quit) {
-        if (ZOMBIE_MACHINE_COUNT) {
-            --ZOMBIE_MACHINE_COUNT;
-            chldpid = wait(NULL);
-            wndMgr.HandleDeath(chldpid);
-        }
-        wndMgr.UpdateAllMachines();
-
-        ch = getch();
-        if (ch < 0) continue;
-        wndMgr.Keypress(ch);
+        wndMgr.ProcessEvents();
     }
     
     omnitty::OmniConfig::GetInstance()->SaveConfig();
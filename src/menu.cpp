@@ -11,16 +11,30 @@
 using namespace omnitty;
 
 
-#define MENU_LINES 12
+static std::string FormatBytes(size_t bytes)
+{
+    char buf[16];
+    if (bytes < 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "%zuK", bytes / 1024);
+    } else {
+        snprintf(buf, sizeof(buf), "%.1fM", bytes / (1024.0 * 1024));
+    }
+    return std::string(buf);
+}
+
+
+#define MENU_LINES 14
 #define MENU_COLS  38
 
 
 static const std::string MENU_CONTENTS(
         "{[h]} online help\n"
         "{[r]} rename machine\n"
+        "{[m]} memory usage\n"
         "{[t]} tag all machines (live only)\n"
         "{[T]} tag all machines (live & dead)\n"
         "{[u]} untag all machines\n"
+        "{[s]} tag machines with this screen\n"
         "{[z]} delete dead machines\n"
         "{[d]} delete all TAGGED machines\n"
         "{[X]} delete all machines\n"
@@ -54,11 +68,12 @@ static const std::string HELP_CONTENTS(
         "      mode, the keys you type will be directed to the currently selected\n"
         "      machine, regardless of tags. When {multicast} is selected, the\n"
         "      keys will be sent to {all tagged machines}, allowing you to operate\n"
-        "      on several machines at once.\n");
+        "      on several machines at once.\n"
+        "{F8}: pages through what the machine scrolled away; {q} goes back.\n");
 
 
 OmniMenu::OmniMenu(MachineManagerPtr machineMgrPtr)
-    : m_machineMgr(machineMgrPtr)
+    : m_menuWnd(nullptr), m_machineMgr(machineMgrPtr)
 {
 
 }
@@ -72,6 +87,7 @@ OmniMenu::~OmniMenu()
 
 void OmniMenu::InitMenu(int rows, int cols)
 {
+    if (m_menuWnd) delwin(m_menuWnd);
     m_menuWnd = newwin(1, rows, cols, 0);
 }
 
@@ -123,6 +139,9 @@ void OmniMenu::ShowMenu()
         Prompt("Enter new machine name: ", 0x90, buf, 15);
         m_machineMgr->RenameMachine(buf);
         break;
+    case 'm':
+        ShowMemoryUsage();
+        break;
     case 'q': *buf = 0;
         if (Prompt("Really quit application [y/n]?", 0x90, buf, 2) && (*buf == 'y' || *buf == 'Y')) {
             OmniConfig::GetInstance()->SaveConfig();
@@ -139,6 +158,9 @@ void OmniMenu::ShowMenu()
     case 'u':
         m_machineMgr->UnTagAll();
         break;
+    case 's':
+        m_machineMgr->TagSameScreen();
+        break;
     case 'z':
         m_machineMgr->DeleteDeadMachines();
         break;
@@ -313,6 +335,24 @@ bool OmniMenu::Prompt(const char *prompt, unsigned char attr, char *buf[], int a
 }
 
 
+void OmniMenu::ShowMemoryUsage()
+{
+    std::string msg;
+    if (m_machineMgr->GetMachineCount() > 0) {
+        MachinePtr machine = m_machineMgr->GetMachine(m_machineMgr->GetSelectedMachine());
+        OmniMemoryUsage usage = machine->GetMemoryUsage();
+        msg = machine->GetMachineName() + ": screen " + FormatBytes(usage.m_cellBytes) + ", history " +
+              FormatBytes(usage.m_historyBytes) + ", raw " + FormatBytes(usage.m_rawBytes) + ".  ";
+    }
+
+    OmniMemoryUsage usage = m_machineMgr->GetMemoryUsage();
+    msg += std::to_string(m_machineMgr->GetMachineCount()) + " machines: " + FormatBytes(usage.GetTotalBytes());
+    uint32_t budgetMb = OmniConfig::GetInstance()->GetMemoryBudgetMb();
+    msg += budgetMb > 0 ? " of " + std::to_string(budgetMb) + "M" : ", no budget";
+    ShowMessageAndWait(msg.c_str(), 0x70);
+}
+
+
 void OmniMenu::ShowMessageAndWait(const char *msg, unsigned char attr)
 {
     ShowMessageNotWait(msg, attr);
@@ -84,6 +84,13 @@ protected:
     void ShowHelp();
 
 
+    /**
+     * @brief Shows the memory held by the selected machine and by all of
+     *        them in the minibuffer, against the configured budget.
+     */
+    void ShowMemoryUsage();
+
+
 private:
     WINDOW              *m_menuWnd;
     MachineManagerPtr   m_machineMgr;
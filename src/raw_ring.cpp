@@ -0,0 +1,97 @@
+#include <string.h>
+#include <algorithm>
+#include "raw_ring.h"
+
+
+using namespace omnitty;
+
+
+OmniRawRing::OmniRawRing(uint32_t capacity)
+    : m_mask(0), m_head(0), m_reserved(0), m_overrunBytes(0)
+{
+    uint32_t size = 1;
+    while (size < capacity && size < (1u << 31)) size <<= 1;
+    m_buffer.resize(size);
+    m_mask = size - 1;
+}
+
+
+char *OmniRawRing::Reserve(uint32_t maxBytes, uint32_t *length)
+{
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t offset = static_cast<uint32_t>(head & m_mask);
+    *length = std::min(maxBytes, GetCapacity() - offset);
+
+    /* announced before the oldest bytes get overwritten, see Read() */
+    m_reserved.store(head + *length, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return &m_buffer[offset];
+}
+
+
+void OmniRawRing::Commit(uint32_t length)
+{
+    m_head.store(m_head.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
+
+
+void OmniRawRing::Append(const char *data, uint32_t length)
+{
+    while (length > 0) {
+        uint32_t spanLength;
+        char *span = Reserve(length, &spanLength);
+        memcpy(span, data, spanLength);
+        Commit(spanLength);
+        data += spanLength;
+        length -= spanLength;
+    }
+}
+
+
+void OmniRawRing::Consume(Cursor &cursor, const SpanCallback &callback)
+{
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    SkipOverwritten(cursor, head);
+    while (cursor.m_position < head) {
+        uint32_t offset = static_cast<uint32_t>(cursor.m_position & m_mask);
+        uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(head - cursor.m_position, GetCapacity() - offset));
+        callback(&m_buffer[offset], length);
+        cursor.m_position += length;
+    }
+}
+
+
+uint32_t OmniRawRing::Read(Cursor &cursor, char *buf, uint32_t length)
+{
+    for (;;) {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        SkipOverwritten(cursor, m_reserved.load(std::memory_order_acquire));
+
+        uint32_t copied = static_cast<uint32_t>(std::min<uint64_t>(length, head - cursor.m_position));
+        uint32_t offset = static_cast<uint32_t>(cursor.m_position & m_mask);
+        uint32_t first = std::min(copied, GetCapacity() - offset);
+        memcpy(buf, &m_buffer[offset], first);
+        memcpy(buf + first, &m_buffer[0], copied - first);
+
+        /* the copy is valid only if the producer didn't start overwriting
+         * it in the meantime, otherwise skip to what's left and retry */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (SkipOverwritten(cursor, m_reserved.load(std::memory_order_relaxed))) continue;
+
+        cursor.m_position += copied;
+        return copied;
+    }
+}
+
+
+bool OmniRawRing::SkipOverwritten(Cursor &cursor, uint64_t reserved)
+{
+    uint64_t oldest = reserved > GetCapacity() ? reserved - GetCapacity() : 0;
+    if (cursor.m_position >= oldest) return false;
+
+    uint64_t lost = oldest - cursor.m_position;
+    cursor.m_position = oldest;
+    cursor.m_overrunBytes += lost;
+    m_overrunBytes.fetch_add(lost, std::memory_order_relaxed);
+    return true;
+}
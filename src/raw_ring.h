@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Ring of the raw bytes a machine's pty printed, written by one
+ *        producer and read by any number of consumers.
+ * @details Bytes are numbered by their position in the stream since the
+ *          machine started. The producer (the worker draining the pty) never
+ *          waits for a consumer: it overwrites the oldest bytes, and each
+ *          consumer reads at its own pace through a Cursor, from any thread
+ *          and without locking. A consumer that fell more than the capacity
+ *          behind skips what was overwritten, the skipped bytes are counted
+ *          as overruns in its cursor and in the ring.
+ *
+ *          Reads are validated like a seqlock: the producer announces the
+ *          bytes it's about to overwrite before touching them, a reader
+ *          checks the announcement after copying and drops what may have
+ *          been overwritten meanwhile.
+ */
+class OmniRawRing
+{
+public:
+    /**
+     * @brief Read position of a consumer.
+     */
+    struct Cursor {
+        Cursor() : m_position(0), m_overrunBytes(0) {}
+
+        /* position of the next byte to read */
+        uint64_t    m_position;
+        /* bytes this consumer lost to the producer */
+        uint64_t    m_overrunBytes;
+    };
+
+
+    typedef std::function<void(const char *data, uint32_t length)> SpanCallback;
+
+
+    /**
+     * @param capacity size of the ring, rounded up to a power of 2
+     */
+    explicit OmniRawRing(uint32_t capacity);
+
+
+    uint32_t GetCapacity() const { return m_mask + 1; }
+
+
+    /**
+     * @brief GetHead
+     * @return the number of bytes ever written, the position of the next one
+     */
+    uint64_t GetHead() const { return m_head.load(std::memory_order_acquire); }
+
+
+    /**
+     * @brief GetDepth
+     * @return bytes written but not read yet through the cursor
+     */
+    uint64_t GetDepth(const Cursor &cursor) const { return GetHead() - cursor.m_position; }
+
+
+    /**
+     * @brief GetOverrunBytes
+     * @return bytes lost by all the consumers together
+     */
+    uint64_t GetOverrunBytes() const { return m_overrunBytes.load(std::memory_order_relaxed); }
+
+
+    /**
+     * @brief Producer only: returns where the next bytes go, up to maxBytes
+     *        of contiguous space in *length. Commit() what was filled in.
+     */
+    char *Reserve(uint32_t maxBytes, uint32_t *length);
+
+
+    /**
+     * @brief Producer only: publishes the first length reserved bytes.
+     */
+    void Commit(uint32_t length);
+
+
+    /**
+     * @brief Producer only: copies the bytes into the ring.
+     */
+    void Append(const char *data, uint32_t length);
+
+
+    /**
+     * @brief Producer thread only: hands the bytes between the cursor and
+     *        the head to the callback in place, in at most two spans, and
+     *        moves the cursor to the head.
+     * @details Nothing can overwrite them meanwhile, as the producer is busy
+     *          calling this.
+     */
+    void Consume(Cursor &cursor, const SpanCallback &callback);
+
+
+    /**
+     * @brief Copies up to length bytes from the cursor's position and moves
+     *        the cursor past them. Safe from any thread.
+     * @return the number of bytes copied, 0 if the cursor is at the head
+     */
+    uint32_t Read(Cursor &cursor, char *buf, uint32_t length);
+
+
+protected:
+    OmniRawRing(const OmniRawRing &) = delete;
+    OmniRawRing &operator=(const OmniRawRing &) = delete;
+
+
+private:
+    /**
+     * @brief Moves a cursor the producer overtook to the oldest byte still
+     *        in the ring.
+     * @return whether the cursor was moved
+     */
+    bool SkipOverwritten(Cursor &cursor, uint64_t reserved);
+
+
+private:
+    std::vector<char>       m_buffer;
+    uint32_t                m_mask;
+    /* end of the published bytes */
+    std::atomic<uint64_t>   m_head;
+    /* end of the bytes the producer may be writing, >= m_head */
+    std::atomic<uint64_t>   m_reserved;
+    std::atomic<uint64_t>   m_overrunBytes;
+};
+
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <rote/rote.h>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief A copy of a terminal row.
+ * @details Like RoteRow, the text and the attributes of the cells are kept
+ *          in two planes: the text is a plain string that can be searched
+ *          or hashed without touching the attributes. Only rows holding
+ *          non-ASCII characters (ROTE_CELL_GLYPH cells) copy the glyph
+ *          plane too, the numbers being those of the terminal's glyphs.
+ *          Likewise, only rows with extended colors copy the xattr plane.
+ */
+struct ScreenRow
+{
+    ScreenRow() = default;
+
+
+    ScreenRow(const char *text, const unsigned char *attrs, const unsigned short *glyphs,
+              const unsigned short *xattrs, size_t length)
+        : m_text(text, length), m_attrs(attrs, attrs + length) {
+        if (glyphs && memchr(text, ROTE_CELL_GLYPH, length)) m_glyphs.assign(glyphs, glyphs + length);
+        if (xattrs && std::any_of(xattrs, xattrs + length, [](unsigned short x) { return x != 0; })) {
+            m_xattrs.assign(xattrs, xattrs + length);
+        }
+    }
+
+
+    ScreenRow(size_t length, char ch, unsigned char attr)
+        : m_text(length, ch), m_attrs(length, attr) {}
+
+
+    size_t GetLength() const { return m_text.size(); }
+
+
+    /** the glyph number of a ROTE_CELL_GLYPH cell */
+    uint16_t GetGlyph(size_t col) const { return col < m_glyphs.size() ? m_glyphs[col] : 0; }
+
+
+    /** the extended attribute number of a cell, 0 for none */
+    uint16_t GetXAttr(size_t col) const { return col < m_xattrs.size() ? m_xattrs[col] : 0; }
+
+
+    std::string                 m_text;
+    std::vector<unsigned char>  m_attrs;
+    /** empty if the row has no glyphs */
+    std::vector<uint16_t>       m_glyphs;
+    /** empty if the row has no extended colors */
+    std::vector<uint16_t>       m_xattrs;
+    /** hash of the cells, set for the rows of a snapshot, see
+     *  OmniScreenSnapshot::m_hash */
+    uint64_t                    m_hash = 0;
+};
+
+
+typedef std::shared_ptr<const ScreenRow>    ScreenRowPtr;
+
+
+/**
+ * @brief An immutable copy of a virtual terminal's screen.
+ * @details Snapshots are published by the thread that parses the terminal
+ *          and only read by the UI thread. Rows that didn't change are shared
+ *          with the previous snapshot, so a snapshot costs one pointer per row
+ *          plus a copy of the dirty rows, and comparing row pointers tells
+ *          which rows changed since any older snapshot.
+ */
+struct OmniScreenSnapshot
+{
+    int                         m_rows;
+    int                         m_cols;
+    int                         m_cursorRow;
+    int                         m_cursorCol;
+    /** increases by one with every snapshot published for the terminal */
+    uint64_t                    m_sequence;
+    /** lines the terminal had scrolled away, the number its first row gets
+     *  once it's in the scrollback */
+    uint64_t                    m_historyLines;
+    std::vector<ScreenRowPtr>   m_lines;
+    /** the columns of each row that changed since the previous snapshot,
+     *  for the rows not shared with it */
+    std::vector<RoteSpan>       m_damage;
+    /** hash of the rows' hashes. Glyphs and extended colors are hashed by
+     *  value, so screens of any terminals showing the same cells have the
+     *  same hash, the cursor aside. Only the rows copied for the snapshot
+     *  are hashed, the shared ones keep theirs. */
+    uint64_t                    m_hash;
+
+
+    const ScreenRow &GetRow(int row) const { return *m_lines[row]; }
+
+
+    /**
+     * @brief IsRowDirty
+     * @param row the row to check
+     * @param since an older snapshot of the same terminal, or nullptr
+     * @return whether the row changed after the older snapshot was taken
+     */
+    bool IsRowDirty(int row, const OmniScreenSnapshot *since) const {
+        return since == nullptr || since->m_rows != m_rows || since->m_lines[row] != m_lines[row];
+    }
+
+
+    /**
+     * @brief GetDamage
+     * @param row a row that IsRowDirty() since the older snapshot
+     * @param since an older snapshot of the same terminal, or nullptr
+     * @return the columns to draw over the older snapshot: those that
+     *         changed if it's the previous one, the whole row otherwise
+     */
+    RoteSpan GetDamage(int row, const OmniScreenSnapshot *since) const {
+        if (since != nullptr && since->m_rows == m_rows && since->m_cols == m_cols &&
+            since->m_sequence + 1 == m_sequence) return m_damage[row];
+        return RoteSpan{0, m_cols - 1};
+    }
+
+
+    /**
+     * @brief HasSameCells
+     * @param other a snapshot of any terminal
+     * @return whether both show the same cells, going by the hashes of
+     *         their rows: O(rows), the cells aren't compared
+     */
+    bool HasSameCells(const OmniScreenSnapshot &other) const {
+        if (m_hash != other.m_hash || m_rows != other.m_rows || m_cols != other.m_cols) return false;
+        for (int r = 0; r < m_rows; ++r) {
+            if (m_lines[r] != other.m_lines[r] && m_lines[r]->m_hash != other.m_lines[r]->m_hash) return false;
+        }
+        return true;
+    }
+};
+
+
+typedef std::shared_ptr<const OmniScreenSnapshot> ScreenSnapshotPtr;
+
+
+}
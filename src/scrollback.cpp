@@ -0,0 +1,376 @@
+#include <string.h>
+#include <algorithm>
+#include "scrollback.h"
+
+
+/* lines packed together */
+#define CHUNK_LINES 64
+/* what trailing cells are cut from a line */
+#define BLANK_CH 0x20
+#define BLANK_ATTR 0x70
+
+/* LZ77 tokens: a byte below 0x80 is followed by that many literals plus
+ * one, otherwise it's a match of its low 7 bits plus LZ_MIN_MATCH bytes,
+ * followed by the match's 16 bits offset back, little endian */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+
+
+using namespace omnitty;
+
+
+static void PutVarint(std::vector<uint8_t> &data, uint32_t value)
+{
+    while (value >= 0x80) {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+
+static uint32_t GetVarint(const uint8_t *&p, const uint8_t *end)
+{
+    uint32_t value = 0;
+    for (int shift = 0; p < end && shift < 32; shift += 7) {
+        uint8_t byte = *p++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) break;
+    }
+    return value;
+}
+
+
+static void LzPutLiterals(const uint8_t *literals, size_t length, std::vector<uint8_t> &data)
+{
+    while (length > 0) {
+        size_t run = std::min<size_t>(length, LZ_MAX_LITERALS);
+        data.push_back(static_cast<uint8_t>(run - 1));
+        data.insert(data.end(), literals, literals + run);
+        literals += run;
+        length -= run;
+    }
+}
+
+
+static void LzCompress(const uint8_t *src, size_t length, std::vector<uint8_t> &data)
+{
+    /* last position + 1 of each hashed 4 bytes, 0 for none */
+    std::vector<uint32_t> table(1 << LZ_HASH_BITS, 0);
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= length) {
+        uint32_t word;
+        memcpy(&word, src + i, sizeof(word));
+        uint32_t hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(i + 1);
+
+        if (candidate == 0 || i + 1 - candidate > LZ_MAX_OFFSET ||
+            memcmp(src + candidate - 1, src + i, LZ_MIN_MATCH) != 0) {
+            ++i;
+            continue;
+        }
+
+        /* the match may overlap what it repeats, e.g. a run of dashes */
+        size_t from = candidate - 1;
+        size_t matchLength = LZ_MIN_MATCH;
+        while (i + matchLength < length && matchLength < LZ_MAX_MATCH && src[from + matchLength] == src[i + matchLength]) {
+            ++matchLength;
+        }
+        LzPutLiterals(src + literalStart, i - literalStart, data);
+        size_t offset = i - from;
+        data.push_back(static_cast<uint8_t>(0x80 | (matchLength - LZ_MIN_MATCH)));
+        data.push_back(static_cast<uint8_t>(offset & 0xFF));
+        data.push_back(static_cast<uint8_t>(offset >> 8));
+        i += matchLength;
+        literalStart = i;
+    }
+    LzPutLiterals(src + literalStart, length - literalStart, data);
+}
+
+
+static void LzDecompress(const uint8_t *&p, const uint8_t *end, size_t length, std::vector<uint8_t> &text)
+{
+    while (text.size() < length && p < end) {
+        uint8_t token = *p++;
+        if (token < 0x80) {
+            size_t run = std::min<size_t>(token + 1, end - p);
+            text.insert(text.end(), p, p + run);
+            p += run;
+            continue;
+        }
+
+        if (end - p < 2) break;
+        size_t matchLength = (token & 0x7F) + LZ_MIN_MATCH;
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        if (offset == 0 || offset > text.size()) break;
+        size_t from = text.size() - offset;
+        for (size_t k = 0; k < matchLength; ++k) text.push_back(text[from + k]);
+    }
+}
+
+
+OmniScrollback::OmniScrollback(uint32_t maxLines)
+    : m_maxLines(maxLines), m_openFirstLine(0), m_openBytes(0), m_packedBytes(0), m_cachedFirstLine(0)
+{
+    m_openLines.reserve(CHUNK_LINES);
+}
+
+
+void OmniScrollback::Append(const RoteRow *row, int cols)
+{
+    int length = cols;
+    while (length > 0 && row->text[length - 1] == BLANK_CH && row->attr[length - 1] == BLANK_ATTR &&
+           (!row->xattr || row->xattr[length - 1] == 0)) {
+        --length;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_openLines.emplace_back(row->text, row->attr, row->glyph, row->xattr, length);
+    const ScreenRow &line = m_openLines.back();
+    m_openBytes += sizeof(ScreenRow) + length * 2 + (line.m_glyphs.size() + line.m_xattrs.size()) * sizeof(uint16_t);
+    if (m_openLines.size() >= CHUNK_LINES) Seal();
+}
+
+
+uint64_t OmniScrollback::GetFirstLine() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_chunks.empty() ? m_openFirstLine : m_chunks.front().m_firstLine;
+}
+
+
+uint64_t OmniScrollback::GetEndLine() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_openFirstLine + m_openLines.size();
+}
+
+
+void OmniScrollback::GetLines(uint64_t first, uint32_t count, int cols, std::vector<ScreenRow> &rows) const
+{
+    rows.assign(count, ScreenRow(cols, BLANK_CH, BLANK_ATTR));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t line = first + i;
+        const ScreenRow *source = nullptr;
+        if (line >= m_openFirstLine) {
+            if (line - m_openFirstLine < m_openLines.size()) source = &m_openLines[line - m_openFirstLine];
+        } else if (Unpack(line)) {
+            source = &m_cachedLines[line - m_cachedFirstLine];
+        }
+        if (source) {
+            size_t length = std::min<size_t>(source->GetLength(), cols);
+            std::copy(source->m_text.begin(), source->m_text.begin() + length, rows[i].m_text.begin());
+            std::copy(source->m_attrs.begin(), source->m_attrs.begin() + length, rows[i].m_attrs.begin());
+            if (!source->m_glyphs.empty()) {
+                rows[i].m_glyphs.assign(cols, 0);
+                std::copy(source->m_glyphs.begin(), source->m_glyphs.begin() + length, rows[i].m_glyphs.begin());
+            }
+            if (!source->m_xattrs.empty()) {
+                rows[i].m_xattrs.assign(cols, 0);
+                std::copy(source->m_xattrs.begin(), source->m_xattrs.begin() + length, rows[i].m_xattrs.begin());
+            }
+        }
+    }
+}
+
+
+size_t OmniScrollback::GetMemoryBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_openBytes + m_packedBytes;
+}
+
+
+size_t OmniScrollback::Shrink(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t usedBytes = m_openBytes + m_packedBytes;
+    if (!m_openLines.empty()) Seal();
+    usedBytes = std::max(usedBytes, m_openBytes + m_packedBytes);
+    while (!m_chunks.empty() && usedBytes - (m_openBytes + m_packedBytes) < bytes) {
+        m_packedBytes -= sizeof(Chunk) + m_chunks.front().m_data.capacity();
+        m_chunks.pop_front();
+    }
+
+    /* the cache would outlive the chunk it was unpacked from */
+    std::vector<ScreenRow>().swap(m_cachedLines);
+    return usedBytes - (m_openBytes + m_packedBytes);
+}
+
+
+void OmniScrollback::Seal()
+{
+    Chunk chunk;
+    chunk.m_firstLine = m_openFirstLine;
+    chunk.m_lineCount = static_cast<uint32_t>(m_openLines.size());
+    Pack(m_openLines, chunk.m_data);
+    chunk.m_data.shrink_to_fit();
+    m_packedBytes += sizeof(Chunk) + chunk.m_data.capacity();
+    m_chunks.push_back(std::move(chunk));
+
+    m_openFirstLine += m_openLines.size();
+    m_openLines.clear();
+    m_openBytes = 0;
+
+    /* keep at least m_maxLines */
+    while (!m_chunks.empty() &&
+           m_openFirstLine - (m_chunks.front().m_firstLine + m_chunks.front().m_lineCount) >= m_maxLines) {
+        m_packedBytes -= sizeof(Chunk) + m_chunks.front().m_data.capacity();
+        m_chunks.pop_front();
+    }
+}
+
+
+bool OmniScrollback::Unpack(uint64_t line) const
+{
+    if (m_chunks.empty() || line < m_chunks.front().m_firstLine) return false;
+    if (line >= m_cachedFirstLine && line - m_cachedFirstLine < m_cachedLines.size()) return true;
+
+    auto iter = std::upper_bound(m_chunks.begin(), m_chunks.end(), line, [](uint64_t l, const Chunk &chunk) {
+        return l < chunk.m_firstLine;
+    });
+    const Chunk &chunk = *(iter - 1);
+    Unpack(chunk.m_data, chunk.m_lineCount, m_cachedLines);
+    m_cachedFirstLine = chunk.m_firstLine;
+    return line - m_cachedFirstLine < m_cachedLines.size();
+}
+
+
+void OmniScrollback::Pack(const std::vector<ScreenRow> &lines, std::vector<uint8_t> &data)
+{
+    for (const ScreenRow &line : lines) PutVarint(data, static_cast<uint32_t>(line.GetLength()));
+
+    /* attributes: (count, attr) runs over all the lines */
+    std::string text;
+    uint32_t runLength = 0;
+    unsigned char runAttr = 0;
+    for (const ScreenRow &line : lines) {
+        text += line.m_text;
+        for (unsigned char attr : line.m_attrs) {
+            if (runLength > 0 && attr == runAttr) {
+                ++runLength;
+                continue;
+            }
+            if (runLength > 0) {
+                PutVarint(data, runLength);
+                data.push_back(runAttr);
+            }
+            runLength = 1;
+            runAttr = attr;
+        }
+    }
+    if (runLength > 0) {
+        PutVarint(data, runLength);
+        data.push_back(runAttr);
+    }
+
+    LzCompress(reinterpret_cast<const uint8_t *>(text.data()), text.size(), data);
+
+    /* glyph numbers of the glyph cells, in order */
+    for (const ScreenRow &line : lines) {
+        for (size_t i = 0; i < line.m_glyphs.size(); ++i) {
+            if (static_cast<unsigned char>(line.m_text[i]) == ROTE_CELL_GLYPH) PutVarint(data, line.m_glyphs[i]);
+        }
+    }
+
+    /* extended attributes: (count, number) runs over all the lines, like
+     * the attributes, 0 for the lines without */
+    runLength = 0;
+    uint32_t runXAttr = 0;
+    for (const ScreenRow &line : lines) {
+        for (size_t i = 0; i < line.GetLength(); ++i) {
+            uint32_t xattr = line.GetXAttr(i);
+            if (runLength > 0 && xattr == runXAttr) {
+                ++runLength;
+                continue;
+            }
+            if (runLength > 0) {
+                PutVarint(data, runLength);
+                PutVarint(data, runXAttr);
+            }
+            runLength = 1;
+            runXAttr = xattr;
+        }
+    }
+    if (runLength > 0) {
+        PutVarint(data, runLength);
+        PutVarint(data, runXAttr);
+    }
+}
+
+
+void OmniScrollback::Unpack(const std::vector<uint8_t> &data, uint32_t lineCount, std::vector<ScreenRow> &lines)
+{
+    const uint8_t *p = data.data();
+    const uint8_t *end = p + data.size();
+
+    lines.resize(lineCount);
+    size_t cellCount = 0;
+    for (ScreenRow &line : lines) {
+        size_t length = GetVarint(p, end);
+        line.m_text.resize(length);
+        line.m_attrs.resize(length);
+        cellCount += length;
+    }
+
+    std::vector<uint8_t> attrs;
+    attrs.reserve(cellCount);
+    while (attrs.size() < cellCount && p < end) {
+        uint32_t runLength = GetVarint(p, end);
+        if (p == end) break;
+        attrs.insert(attrs.end(), std::min<size_t>(runLength, cellCount - attrs.size()), *p++);
+    }
+    attrs.resize(cellCount, BLANK_ATTR);
+
+    std::vector<uint8_t> text;
+    text.reserve(cellCount);
+    LzDecompress(p, end, cellCount, text);
+    text.resize(cellCount, BLANK_CH);
+
+    size_t i = 0;
+    for (ScreenRow &line : lines) {
+        std::copy(text.begin() + i, text.begin() + i + line.GetLength(), line.m_text.begin());
+        std::copy(attrs.begin() + i, attrs.begin() + i + line.GetLength(), line.m_attrs.begin());
+        i += line.GetLength();
+
+        if (line.m_text.find(static_cast<char>(ROTE_CELL_GLYPH)) == std::string::npos) {
+            line.m_glyphs.clear();
+            continue;
+        }
+        line.m_glyphs.assign(line.GetLength(), 0);
+        for (size_t col = 0; col < line.GetLength(); ++col) {
+            if (static_cast<unsigned char>(line.m_text[col]) == ROTE_CELL_GLYPH) {
+                line.m_glyphs[col] = static_cast<uint16_t>(GetVarint(p, end));
+            }
+        }
+    }
+
+    std::vector<uint16_t> xattrs;
+    xattrs.reserve(cellCount);
+    while (xattrs.size() < cellCount && p < end) {
+        uint32_t runLength = GetVarint(p, end);
+        if (p == end) break;
+        xattrs.insert(xattrs.end(), std::min<size_t>(runLength, cellCount - xattrs.size()),
+                      static_cast<uint16_t>(GetVarint(p, end)));
+    }
+    xattrs.resize(cellCount, 0);
+
+    i = 0;
+    for (ScreenRow &line : lines) {
+        auto first = xattrs.begin() + i;
+        i += line.GetLength();
+        if (std::all_of(first, xattrs.begin() + i, [](uint16_t x) { return x == 0; })) {
+            line.m_xattrs.clear();
+        } else {
+            line.m_xattrs.assign(first, xattrs.begin() + i);
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <rote/rote.h>
+#include "screen_snapshot.h"
+
+
+namespace omnitty {
+
+
+/**
+ * @brief The lines a machine's terminal scrolled off the top of its screen,
+ *        kept compressed.
+ * @details Lines are numbered from the first the terminal ever scrolled
+ *          away, the oldest are dropped past the line limit. New lines wait
+ *          in an open chunk; once it's full its cells are packed: trailing
+ *          blanks are cut, the attributes are run-length encoded, the
+ *          text goes through a small LZ77 coder, the glyph numbers of
+ *          the non-ASCII cells follow as varints and the extended attribute
+ *          numbers are run-length encoded last. Reading a line unpacks its
+ *          whole chunk, the last unpacked chunk is cached for the lines
+ *          around it.
+ *
+ *          Lines are appended by the thread parsing the terminal and read
+ *          from the UI thread, the scrollback has a lock of its own.
+ */
+class OmniScrollback
+{
+public:
+    /**
+     * @param maxLines lines kept, give or take a chunk
+     */
+    explicit OmniScrollback(uint32_t maxLines);
+
+
+    /**
+     * @brief Appends a terminal row of cols cells.
+     */
+    void Append(const RoteRow *row, int cols);
+
+
+    /**
+     * @brief GetFirstLine
+     * @return the number of the oldest line kept
+     */
+    uint64_t GetFirstLine() const;
+
+
+    /**
+     * @brief GetEndLine
+     * @return the number of the next line to be appended, i.e. the number
+     *         of lines ever appended
+     */
+    uint64_t GetEndLine() const;
+
+
+    /**
+     * @brief Copies count lines from the first one into rows, each padded
+     *        with blanks or cut to cols cells.
+     * @details Lines that were dropped, or not appended yet, come out blank.
+     */
+    void GetLines(uint64_t first, uint32_t count, int cols, std::vector<ScreenRow> &rows) const;
+
+
+    /**
+     * @brief GetMemoryBytes
+     * @return the memory held by the lines, packed and open
+     */
+    size_t GetMemoryBytes() const;
+
+
+    /**
+     * @brief Gives memory back: packs the open lines as they are, then drops
+     *        the oldest chunks until the given bytes were freed.
+     * @return the bytes freed, less than asked once everything is dropped
+     */
+    size_t Shrink(size_t bytes);
+
+
+protected:
+    OmniScrollback(const OmniScrollback &) = delete;
+    OmniScrollback &operator=(const OmniScrollback &) = delete;
+
+
+private:
+    /**
+     * @brief A run of packed lines.
+     */
+    struct Chunk {
+        uint64_t                m_firstLine;
+        uint32_t                m_lineCount;
+        std::vector<uint8_t>    m_data;
+    };
+
+
+    /**
+     * @brief Packs the open lines into a chunk, dropping the oldest chunks
+     *        past the line limit.
+     */
+    void Seal();
+
+
+    /**
+     * @brief Unpacks the chunk holding the line into m_cachedLines, if it
+     *        isn't there already.
+     * @return whether the line is in a chunk
+     */
+    bool Unpack(uint64_t line) const;
+
+
+    static void Pack(const std::vector<ScreenRow> &lines, std::vector<uint8_t> &data);
+
+
+    static void Unpack(const std::vector<uint8_t> &data, uint32_t lineCount, std::vector<ScreenRow> &lines);
+
+
+private:
+    mutable std::mutex              m_mutex;
+    uint32_t                        m_maxLines;
+    std::deque<Chunk>               m_chunks;
+    /* first line of the open chunk, which is right after the last chunk */
+    uint64_t                        m_openFirstLine;
+    std::vector<ScreenRow>          m_openLines;
+    size_t                          m_openBytes;
+    size_t                          m_packedBytes;
+    /* the last chunk unpacked, by its first line */
+    mutable uint64_t                m_cachedFirstLine;
+    mutable std::vector<ScreenRow>  m_cachedLines;
+};
+
+
+}
@@ -0,0 +1,323 @@
+#include <signal.h>
+#include <pthread.h>
+#include <algorithm>
+#include <system_error>
+#include "log.h"
+#include "config.h"
+#include "terminal_worker.h"
+
+
+/* a machine left behind by the tick budget never accumulates more than
+ * this many quanta, so it can't monopolize the following ticks */
+#define READ_DEFICIT_MAX_QUANTA 4
+
+
+using namespace omnitty;
+
+
+OmniTerminalWorker::OmniTerminalWorker(uint32_t workerId, const std::function<void()> &onPublished)
+    : m_workerId(workerId), m_onPublished(onPublished), m_isRunning(false)
+{
+}
+
+
+OmniTerminalWorker::~OmniTerminalWorker()
+{
+    Stop();
+}
+
+
+bool OmniTerminalWorker::Init()
+{
+    if (!m_eventLoop.Init() || !m_taskNotifier.Init()) return false;
+
+    auto onReadable = [this](const MachinePtr &machine) { PumpMachine(machine); };
+    auto onChanged = [this](const MachinePtr &machine) { QueuePublish(machine); };
+    const std::string &backendName = OmniConfig::GetInstance()->GetIoBackend();
+    m_ioBackend = OmniIoBackend::Create(backendName);
+    if (!m_ioBackend || !m_ioBackend->Init(m_eventLoop, onReadable, onChanged)) {
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "io backend %s unavailable, falling back to poll",
+                           backendName.c_str());
+        m_ioBackend.reset(new OmniPollBackend());
+        if (!m_ioBackend->Init(m_eventLoop, onReadable, onChanged)) return false;
+    }
+    LOG4CPLUS_DEBUG_FMT(omnitty::LOGGER_NAME, "terminal worker %u uses the %s io backend",
+                        m_workerId, m_ioBackend->GetName());
+
+    return m_eventLoop.AddFd(m_taskNotifier.GetFd(), OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+        m_taskNotifier.Clear();
+        RunTasks();
+    });
+}
+
+
+bool OmniTerminalWorker::Start()
+{
+    /* signals are handled by the UI thread, keep them away from the worker */
+    sigset_t allSignals, oldSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    m_isRunning = true;
+    try {
+        m_thread = std::thread(&OmniTerminalWorker::Run, this);
+    } catch (const std::system_error &e) {
+        LOG4CPLUS_ERROR_FMT(omnitty::LOGGER_NAME, "cannot start terminal worker %u: %s", m_workerId, e.what());
+        m_isRunning = false;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+    return m_isRunning;
+}
+
+
+void OmniTerminalWorker::Stop()
+{
+    if (!m_thread.joinable()) return;
+    m_isRunning = false;
+    m_taskNotifier.Notify();
+    m_thread.join();
+}
+
+
+void OmniTerminalWorker::Post(const Task &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_tasks.push_back(task);
+    }
+    m_taskNotifier.Notify();
+}
+
+
+void OmniTerminalWorker::AddMachine(const MachinePtr &machine)
+{
+    machine->SetWorkerId(m_workerId);
+    Post([this, machine]() {
+        m_ioBackend->AddMachine(machine);
+    });
+}
+
+
+void OmniTerminalWorker::RemoveMachine(const MachinePtr &machine)
+{
+    Post([this, machine]() {
+        UnwatchMachine(machine);
+    });
+}
+
+
+void OmniTerminalWorker::ForsakeMachine(const MachinePtr &machine)
+{
+    Post([this, machine]() {
+        /* the last words of the child, e.g. "Connection closed", bounded in
+         * case a leftover grandchild keeps the pty flooding; the backend may
+         * still hold some of them */
+        int budget = static_cast<int>(OmniConfig::GetInstance()->GetReadBudget());
+        bool isDrained;
+        do {
+            isDrained = m_ioBackend->Drain(machine);
+            std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+            int bytesRead;
+            while (budget > 0 && (bytesRead = m_ioBackend->Read(machine, budget)) > 0) {
+                budget -= bytesRead;
+            }
+        } while (isDrained && budget > 0);
+
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        UnwatchMachine(machine);
+        /* nothing comes after these, a hidden machine's screen is final now */
+        machine->ParseRawOutput();
+        rote_vt_forsake_child(machine->GetVirtualTerminal());
+        machine->SetIsWritePending(false);
+        machine->SetWriteBacklog(0);
+
+        QueuePublish(machine);
+    });
+}
+
+
+void OmniTerminalWorker::FlushMachine(const MachinePtr &machine)
+{
+    Post([this, machine]() {
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        /* the pty may have been forsaken or flushed in the meantime */
+        if (rote_vt_get_pty_fd(machine->GetVirtualTerminal()) < 0 || !machine->IsWritePending()) return;
+        m_ioBackend->Flush(machine);
+    });
+}
+
+
+void OmniTerminalWorker::RefreshMachine(const MachinePtr &machine)
+{
+    Post([this, machine]() {
+        QueuePublish(machine);
+    });
+}
+
+
+void OmniTerminalWorker::RevealMachine(const MachinePtr &machine)
+{
+    Post([this, machine]() {
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        machine->ParseRawOutput();
+        QueuePublish(machine);
+    });
+}
+
+
+void OmniTerminalWorker::CatchUpMachines(const std::vector<MachinePtr> &machines, const Task &onDone)
+{
+    Post([this, machines, onDone]() {
+        bool isPublished = false;
+        for (auto &machine : machines) {
+            std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+            machine->ParseRawOutput();
+            isPublished = machine->PublishScreenSnapshot() || isPublished;
+        }
+        if (isPublished && m_onPublished) m_onPublished();
+        onDone();
+    });
+}
+
+
+void OmniTerminalWorker::ResizeMachines(const std::vector<MachinePtr> &machines, int rows, int cols)
+{
+    Post([this, machines, rows, cols]() {
+        for (auto &machine : machines) {
+            std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+            /* the deferred output was written for the old size, parsed
+             * at it the screen ends up as with eager parsing */
+            machine->ParseRawOutput();
+            if (!rote_vt_resize(machine->GetVirtualTerminal(), rows, cols)) {
+                LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "cannot resize the terminal of %s to %d x %d",
+                                   machine->GetMachineName().c_str(), cols, rows);
+                continue;
+            }
+            QueuePublish(machine);
+        }
+    });
+}
+
+
+void OmniTerminalWorker::RunOnce(int timeoutMs)
+{
+    /* don't sleep while some terminal still has output to drain */
+    m_eventLoop.Wait(m_readQueue.empty() ? timeoutMs : 0);
+    ScheduleReads();
+    PublishSnapshots();
+    m_ioBackend->Submit();
+}
+
+
+void OmniTerminalWorker::Run()
+{
+    while (m_isRunning) {
+        RunOnce(-1);
+    }
+}
+
+
+void OmniTerminalWorker::RunTasks()
+{
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        tasks.swap(m_tasks);
+    }
+    for (auto &task : tasks) {
+        task();
+    }
+}
+
+
+void OmniTerminalWorker::UnwatchMachine(const MachinePtr &machine)
+{
+    m_ioBackend->RemoveMachine(machine);
+
+    /* lazily dropped from m_readQueue by ScheduleReads() */
+    machine->SetIsReadPending(false);
+    machine->SetReadDeficit(0);
+    machine->SetReadBacklog(0);
+}
+
+
+void OmniTerminalWorker::PumpMachine(const MachinePtr &machine)
+{
+    if (!machine->IsReadPending()) {
+        machine->SetIsReadPending(true);
+        m_readQueue.push_back(machine);
+    }
+}
+
+
+void OmniTerminalWorker::QueuePublish(const MachinePtr &machine)
+{
+    if (!machine->IsPublishPending()) {
+        machine->SetIsPublishPending(true);
+        m_publishQueue.push_back(machine);
+    }
+}
+
+
+void OmniTerminalWorker::ScheduleReads()
+{
+    uint32_t budget = OmniConfig::GetInstance()->GetReadBudget();
+    uint32_t quantum = OmniConfig::GetInstance()->GetReadQuantum();
+
+    while (!m_readQueue.empty() && budget > 0) {
+        MachinePtr machine = m_readQueue.front();
+        m_readQueue.pop_front();
+        if (!machine->IsReadPending()) continue;
+
+        uint32_t deficit = std::min(machine->GetReadDeficit() + quantum, quantum * READ_DEFICIT_MAX_QUANTA);
+        uint32_t want = std::min(deficit, budget);
+
+        int bytesRead, backlog;
+        {
+            std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+            bytesRead = m_ioBackend->Read(machine, static_cast<int>(want));
+            backlog = bytesRead < 0 ? 0 : m_ioBackend->GetPendingInput(machine);
+        }
+        if (bytesRead < 0) {
+            /* the slave side is gone (the child is exiting): the pty would
+             * stay readable forever, so stop watching it until the death
+             * is handled */
+            UnwatchMachine(machine);
+            continue;
+        }
+
+        if (bytesRead > 0) QueuePublish(machine);
+
+        budget -= bytesRead;
+        deficit -= bytesRead;
+
+        if (static_cast<uint32_t>(bytesRead) == want || backlog > 0) {
+            /* not drained yet, keep the unspent deficit for the next round */
+            machine->SetReadDeficit(deficit);
+            machine->SetReadBacklog(backlog > 0 ? static_cast<uint32_t>(backlog) : 0);
+            m_readQueue.push_back(machine);
+        } else {
+            machine->SetReadDeficit(0);
+            machine->SetReadBacklog(0);
+            machine->SetIsReadPending(false);
+        }
+    }
+}
+
+
+void OmniTerminalWorker::PublishSnapshots()
+{
+    if (m_publishQueue.empty()) return;
+
+    bool isPublished = false;
+    for (auto &machine : m_publishQueue) {
+        std::lock_guard<std::mutex> lock(machine->GetTerminalMutex());
+        /* deferred output changes the summary of the machine, not its screen */
+        isPublished = machine->PublishScreenSnapshot() || machine->HasDeferredOutput() || isPublished;
+        machine->SetIsPublishPending(false);
+    }
+    m_publishQueue.clear();
+
+    if (isPublished && m_onPublished) m_onPublished();
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "machine.h"
+#include "io_backend.h"
+#include "event_loop.h"
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Drains the ptys of a share of the machines and parses their output.
+ * @details Each worker owns an event loop watching its machines' ptys, reads
+ *          them with the deficit round robin scheduler and, at the end of
+ *          every tick, publishes a screen snapshot of each terminal that
+ *          changed. The UI thread only draws snapshots, so a flooding
+ *          terminal never stalls the keyboard or the other terminals.
+ *
+ *          The worker either runs its own thread (Start()), or is driven by
+ *          the caller through RunOnce() when its GetFd() becomes readable.
+ *          Everything that touches the watched machines is posted to the
+ *          worker with Post() and runs on the worker's side.
+ *
+ *          The pty reads and writes go through the worker's I/O backend,
+ *          picked by the IoBackend setting.
+ */
+class OmniTerminalWorker
+{
+public:
+    typedef std::function<void()> Task;
+
+
+    /**
+     * @param workerId index of the worker, stored in the machines it owns
+     * @param onPublished called from the worker after a tick published
+     *        at least one snapshot
+     */
+    OmniTerminalWorker(uint32_t workerId, const std::function<void()> &onPublished);
+
+
+    /**
+     * @brief Stops the thread, if any.
+     */
+    ~OmniTerminalWorker();
+
+
+    bool Init();
+
+
+    /**
+     * @brief Runs the worker's loop on a thread of its own.
+     */
+    bool Start();
+
+
+    /**
+     * @brief Stops and joins the worker's thread.
+     */
+    void Stop();
+
+
+    /**
+     * @brief Runs the task on the worker's side. Safe to call from any thread.
+     */
+    void Post(const Task &task);
+
+
+    /**
+     * @brief Starts watching the machine's pty.
+     */
+    void AddMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Stops watching the machine's pty and drops the worker's
+     *        references to it.
+     */
+    void RemoveMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Reads what the dead child left in the pty, then closes it.
+     */
+    void ForsakeMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Has the I/O backend send the keystrokes queued in the machine's
+     *        terminal.
+     * @details Called with the terminal mutex held, after a write left
+     *          output queued and IsWritePending() was set.
+     */
+    void FlushMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Publishes the machine's screen at the end of the next tick,
+     *        e.g. after keys were injected into a terminal without a pty.
+     */
+    void RefreshMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Parses the output the machine deferred while off screen and
+     *        publishes its screen, called once it's shown.
+     */
+    void RevealMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief Parses the output the machines deferred and publishes their
+     *        screens at once, then calls onDone from the worker.
+     * @details For callers that need the screens up to date right away,
+     *          e.g. to compare them.
+     */
+    void CatchUpMachines(const std::vector<MachinePtr> &machines, const Task &onDone);
+
+
+    /**
+     * @brief Resizes the terminals of the machines, all in one task, and
+     *        publishes their screens.
+     * @details rote hands the new size to each pty, whose child gets a
+     *          SIGWINCH, the ssh sessions stay as they are.
+     */
+    void ResizeMachines(const std::vector<MachinePtr> &machines, int rows, int cols);
+
+
+    /**
+     * @brief Handles ready ptys and posted tasks, then reads the queued
+     *        terminals within the tick's budget and publishes their snapshots.
+     * @param timeoutMs maximum time to block, ignored while reads are pending
+     */
+    void RunOnce(int timeoutMs);
+
+
+    /**
+     * @brief HasPendingReads
+     * @return whether some terminal was left with output by the tick budget
+     */
+    bool HasPendingReads() const { return !m_readQueue.empty(); }
+
+
+    /**
+     * @brief GetFd
+     * @return a descriptor that is readable when RunOnce() has work to do
+     */
+    int GetFd() const { return m_eventLoop.GetFd(); }
+
+
+protected:
+    OmniTerminalWorker(const OmniTerminalWorker &) = delete;
+    OmniTerminalWorker &operator=(const OmniTerminalWorker &) = delete;
+
+
+private:
+    void Run();
+
+
+    void RunTasks();
+
+
+    void UnwatchMachine(const MachinePtr &machine);
+
+
+    /**
+     * @brief I/O backend callback for a ready pty, queues it for reading.
+     */
+    void PumpMachine(const MachinePtr &machine);
+
+
+    void QueuePublish(const MachinePtr &machine);
+
+
+    /**
+     * @brief Runs deficit round robin over the queued machines until the
+     *        tick's read budget is spent or every machine is drained.
+     */
+    void ScheduleReads();
+
+
+    void PublishSnapshots();
+
+
+private:
+    uint32_t                m_workerId;
+    std::function<void()>   m_onPublished;
+    OmniEventLoop           m_eventLoop;
+    std::unique_ptr<OmniIoBackend> m_ioBackend;
+    OmniEventNotifier       m_taskNotifier;
+    std::mutex              m_taskMutex;
+    std::vector<Task>       m_tasks;
+    /* machines with pending pty output, in round robin order */
+    std::deque<MachinePtr>  m_readQueue;
+    /* machines whose terminal changed during the current tick */
+    std::vector<MachinePtr> m_publishQueue;
+    std::atomic<bool>       m_isRunning;
+    std::thread             m_thread;
+};
+
+
+}
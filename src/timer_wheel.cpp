@@ -0,0 +1,147 @@
+#include <chrono>
+#include <climits>
+#include <algorithm>
+#include "timer_wheel.h"
+
+
+using namespace omnitty;
+
+
+OmniTimer::OmniTimer()
+    : m_wheel(nullptr), m_expiryTick(0), m_pprev(nullptr), m_next(nullptr)
+{
+}
+
+
+OmniTimer::~OmniTimer()
+{
+    if (m_wheel) m_wheel->Cancel(*this);
+}
+
+
+OmniTimerWheel::OmniTimerWheel(uint32_t tickMs)
+    : m_tickMs(std::max(tickMs, 1u)), m_startMs(Now()), m_currentTick(0), m_timerCount(0), m_slots{}
+{
+}
+
+
+OmniTimerWheel::~OmniTimerWheel()
+{
+    for (auto &level : m_slots) {
+        for (OmniTimer *&head : level) {
+            while (head) Unlink(*head);
+        }
+    }
+}
+
+
+void OmniTimerWheel::Schedule(OmniTimer &timer, uint32_t delayMs)
+{
+    if (timer.m_wheel) timer.m_wheel->Cancel(timer);
+
+    /* counted from now, the wheel may lag behind until its next Advance() */
+    uint64_t ticks = std::max<uint64_t>((delayMs + m_tickMs - 1) / m_tickMs, 1);
+    uint64_t expiry = std::max(GetTickAt(Now()) + ticks, m_currentTick + 1);
+    uint64_t maxExpiry = m_currentTick + (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+    timer.m_expiryTick = std::min(expiry, maxExpiry);
+    timer.m_wheel = this;
+    ++m_timerCount;
+    Link(timer);
+}
+
+
+void OmniTimerWheel::Cancel(OmniTimer &timer)
+{
+    if (timer.m_wheel == this) Unlink(timer);
+}
+
+
+int OmniTimerWheel::Advance()
+{
+    uint64_t target = GetTickAt(Now());
+    if (m_timerCount == 0) {
+        m_currentTick = std::max(m_currentTick, target);
+        return 0;
+    }
+
+    int expired = 0;
+    while (m_currentTick < target) {
+        ++m_currentTick;
+        /* a level wrapped around: its next slot moves down */
+        for (int level = 1; level < LEVELS; ++level) {
+            if (m_currentTick & ((1ull << (SLOT_BITS * level)) - 1)) break;
+            Cascade(level, static_cast<uint32_t>(m_currentTick >> (SLOT_BITS * level)) & SLOT_MASK);
+        }
+
+        OmniTimer *&head = m_slots[0][m_currentTick & SLOT_MASK];
+        while (head) {
+            OmniTimer &timer = *head;
+            Unlink(timer);
+            ++expired;
+            /* through a copy, the callback may replace itself */
+            OmniTimer::Callback callback = timer.m_callback;
+            if (callback) callback();
+        }
+    }
+    return expired;
+}
+
+
+int OmniTimerWheel::GetTimeoutMs() const
+{
+    if (m_timerCount == 0) return -1;
+
+    /* the first tick with timers to run, or where the first level wraps
+     * around and has to be refilled from the next one */
+    uint64_t tick = m_currentTick + 1;
+    while ((tick & SLOT_MASK) != 0 && !m_slots[0][tick & SLOT_MASK]) ++tick;
+
+    uint64_t dueMs = m_startMs + tick * m_tickMs;
+    uint64_t nowMs = Now();
+    return dueMs > nowMs ? static_cast<int>(std::min<uint64_t>(dueMs - nowMs, INT_MAX)) : 0;
+}
+
+
+uint64_t OmniTimerWheel::Now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+void OmniTimerWheel::Link(OmniTimer &timer)
+{
+    uint64_t delta = timer.m_expiryTick - m_currentTick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1)))) ++level;
+
+    OmniTimer *&head = m_slots[level][(timer.m_expiryTick >> (SLOT_BITS * level)) & SLOT_MASK];
+    timer.m_next = head;
+    if (head) head->m_pprev = &timer.m_next;
+    head = &timer;
+    timer.m_pprev = &head;
+}
+
+
+void OmniTimerWheel::Unlink(OmniTimer &timer)
+{
+    *timer.m_pprev = timer.m_next;
+    if (timer.m_next) timer.m_next->m_pprev = timer.m_pprev;
+    timer.m_pprev = nullptr;
+    timer.m_next = nullptr;
+    timer.m_wheel = nullptr;
+    --m_timerCount;
+}
+
+
+void OmniTimerWheel::Cascade(int level, uint32_t slot)
+{
+    OmniTimer *timer = m_slots[level][slot];
+    m_slots[level][slot] = nullptr;
+    while (timer) {
+        OmniTimer *next = timer->m_next;
+        Link(*timer);
+        timer = next;
+    }
+}
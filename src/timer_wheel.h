@@ -0,0 +1,171 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+
+namespace omnitty {
+
+
+class OmniTimerWheel;
+
+
+/**
+ * @brief A timer armed on an OmniTimerWheel.
+ * @details Owned by whoever arms it, the wheel only links it into its slots,
+ *          so arming and cancelling never allocate. The timer must be
+ *          cancelled, or destroyed, on the thread running the wheel.
+ */
+class OmniTimer
+{
+public:
+    typedef std::function<void()> Callback;
+
+
+    OmniTimer();
+
+
+    /**
+     * @brief Cancels the timer if it's armed.
+     */
+    ~OmniTimer();
+
+
+    /**
+     * @brief SetCallback
+     * @param callback invoked by OmniTimerWheel::Advance() once the timer
+     *        expires, it may arm the timer again
+     */
+    void SetCallback(const Callback &callback) { m_callback = callback; }
+
+
+    bool IsArmed() const { return m_wheel != nullptr; }
+
+
+protected:
+    OmniTimer(const OmniTimer &) = delete;
+    OmniTimer &operator=(const OmniTimer &) = delete;
+
+
+private:
+    friend class OmniTimerWheel;
+
+    Callback            m_callback;
+    /* the wheel the timer is armed on, null when idle */
+    OmniTimerWheel      *m_wheel;
+    uint64_t            m_expiryTick;
+    /* the pointer to this timer in its slot's list */
+    OmniTimer           **m_pprev;
+    OmniTimer           *m_next;
+};
+
+
+/**
+ * @brief Hierarchical timer wheel: arming, cancelling and expiring a timer
+ *        are O(1), whatever the number of timers.
+ * @details Time is counted in ticks. The first level has one slot per tick
+ *          for the next 64 ticks, each following level has slots 64 times
+ *          as wide. A timer is linked into the slot of the level its expiry
+ *          falls in, and moved down to a finer level when the level below
+ *          wraps around, so every timer is touched at most once per level.
+ *          Expiries beyond the coarsest level are clamped to it.
+ */
+class OmniTimerWheel
+{
+public:
+    /**
+     * @param tickMs resolution of the wheel
+     */
+    explicit OmniTimerWheel(uint32_t tickMs);
+
+
+    /**
+     * @brief Leaves the timers still armed idle.
+     */
+    ~OmniTimerWheel();
+
+
+    /**
+     * @brief Arms the timer, or re-arms it if it's already armed.
+     * @param timer the timer, which must stay alive until it expires or is
+     *        cancelled
+     * @param delayMs delay before expiry, rounded up to the next tick
+     */
+    void Schedule(OmniTimer &timer, uint32_t delayMs);
+
+
+    /**
+     * @brief Disarms the timer, nothing happens if it's idle.
+     */
+    void Cancel(OmniTimer &timer);
+
+
+    /**
+     * @brief Moves the wheel to the current time and runs the callbacks of
+     *        the expired timers.
+     * @return the number of expired timers
+     */
+    int Advance();
+
+
+    /**
+     * @brief GetTimeoutMs
+     * @return how long a loop may sleep before the next call to Advance()
+     *         has something to do, -1 if no timer is armed
+     */
+    int GetTimeoutMs() const;
+
+
+    size_t GetTimerCount() const { return m_timerCount; }
+
+
+    /**
+     * @brief Now
+     * @return milliseconds on the monotonic clock
+     */
+    static uint64_t Now();
+
+
+protected:
+    OmniTimerWheel(const OmniTimerWheel &) = delete;
+    OmniTimerWheel &operator=(const OmniTimerWheel &) = delete;
+
+
+private:
+    enum {
+        LEVELS      = 4,
+        SLOT_BITS   = 6,
+        SLOTS       = 1 << SLOT_BITS,
+        SLOT_MASK   = SLOTS - 1,
+    };
+
+
+    uint64_t GetTickAt(uint64_t nowMs) const { return (nowMs - m_startMs) / m_tickMs; }
+
+
+    /**
+     * @brief Links the timer into the slot its expiry falls in.
+     */
+    void Link(OmniTimer &timer);
+
+
+    void Unlink(OmniTimer &timer);
+
+
+    /**
+     * @brief Moves the timers of a slot to the finer levels.
+     */
+    void Cascade(int level, uint32_t slot);
+
+
+private:
+    uint32_t        m_tickMs;
+    uint64_t        m_startMs;
+    /* every timer expiring at or before this tick has run */
+    uint64_t        m_currentTick;
+    size_t          m_timerCount;
+    OmniTimer       *m_slots[LEVELS][SLOTS];
+};
+
+
+}
@@ -0,0 +1,182 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "transcript.h"
+
+
+using namespace omnitty;
+
+
+OmniTranscript::OmniTranscript(const std::string &path, uint32_t maxBytes, uint32_t rotations)
+    : m_path(path), m_maxBytes(maxBytes), m_rotations(rotations), m_fd(-1), m_fileBytes(0),
+      m_pipe{-1, -1}, m_teePipe{-1, -1}, m_isSpliceSupported(false), m_isInUse(false)
+{
+}
+
+
+OmniTranscript::~OmniTranscript()
+{
+    Close();
+}
+
+
+bool OmniTranscript::Open()
+{
+    if (!OpenFile(false)) return false;
+
+#ifdef __linux__
+    m_isSpliceSupported = pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) == 0 &&
+                          pipe2(m_teePipe, O_NONBLOCK | O_CLOEXEC) == 0;
+#endif
+    /* a file left over above the limit by a previous session */
+    Account(0);
+    return IsOpen();
+}
+
+
+int OmniTranscript::Read(int ptyFd, char *buf, int len)
+{
+#ifdef __linux__
+    if (m_isSpliceSupported) {
+        ssize_t moved = splice(ptyFd, NULL, m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved < 0 && errno == EINVAL) {
+            LOG4CPLUS_INFO_FMT(omnitty::LOGGER_NAME, "transcript %s: pty can't be spliced, copying",
+                               m_path.c_str());
+            m_isSpliceSupported = false;
+            return Read(ptyFd, buf, len);
+        }
+        if (moved <= 0) return static_cast<int>(moved);
+
+        /* the tee pipe is always empty here, it takes all of them */
+        ssize_t teed = tee(m_pipe[0], m_teePipe[1], moved, SPLICE_F_NONBLOCK);
+
+        /* the caller's bytes first, a failing file closes the pipes */
+        ssize_t bytesRead = read(m_pipe[0], buf, moved);
+        bool isRecorded = teed > 0 && SpliceToFile(static_cast<int>(teed));
+        if (!isRecorded) {
+            LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "transcript %s failed, closing it", m_path.c_str());
+            Close();
+        } else if (bytesRead > teed) {
+            Write(buf + teed, static_cast<int>(bytesRead - teed));
+        }
+        return static_cast<int>(bytesRead);
+    }
+#endif
+
+    ssize_t bytesRead = read(ptyFd, buf, len);
+    if (bytesRead > 0) Write(buf, static_cast<int>(bytesRead));
+    return static_cast<int>(bytesRead);
+}
+
+
+void OmniTranscript::Write(const char *data, int len)
+{
+    int written = 0;
+    while (IsOpen() && written < len) {
+        ssize_t ret = write(m_fd, data + written, len - written);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "transcript %s failed, errno: %d, closing it",
+                               m_path.c_str(), errno);
+            Close();
+            return;
+        }
+        written += static_cast<int>(ret);
+    }
+    Account(written);
+}
+
+
+bool OmniTranscript::OpenFile(bool isTruncated)
+{
+    m_isInUse = false;
+    for (;;) {
+        /* truncated only once it's ours, the file may be another writer's */
+        m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+        if (m_fd < 0) {
+            LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "cannot open transcript %s, errno: %d", m_path.c_str(), errno);
+            return false;
+        }
+        if (flock(m_fd, LOCK_EX | LOCK_NB) != 0 && errno == EWOULDBLOCK) {
+            m_isInUse = true;
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        /* the file may have been rotated away between open() and flock() */
+        struct stat opened, named;
+        if (fstat(m_fd, &opened) != 0 || stat(m_path.c_str(), &named) != 0 ||
+            (opened.st_dev == named.st_dev && opened.st_ino == named.st_ino)) {
+            break;
+        }
+        close(m_fd);
+    }
+    if (isTruncated && ftruncate(m_fd, 0) != 0) {
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "cannot truncate transcript %s, errno: %d", m_path.c_str(), errno);
+    }
+    /* not O_APPEND: older kernels refuse to splice into such files */
+    off_t size = lseek(m_fd, 0, SEEK_END);
+    m_fileBytes = size > 0 ? static_cast<uint64_t>(size) : 0;
+    return true;
+}
+
+
+void OmniTranscript::Close()
+{
+    for (int *fd : {&m_fd, &m_pipe[0], &m_pipe[1], &m_teePipe[0], &m_teePipe[1]}) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+    }
+    m_isSpliceSupported = false;
+}
+
+
+bool OmniTranscript::SpliceToFile(int len)
+{
+#ifdef __linux__
+    int moved = 0;
+    while (moved < len) {
+        ssize_t ret = splice(m_teePipe[0], NULL, m_fd, NULL, len - moved, SPLICE_F_MOVE);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        moved += static_cast<int>(ret);
+    }
+    Account(moved);
+    return IsOpen();
+#else
+    (void)len;
+    return false;
+#endif
+}
+
+
+void OmniTranscript::Account(int len)
+{
+    m_fileBytes += static_cast<uint64_t>(len);
+    if (IsOpen() && m_maxBytes > 0 && m_fileBytes >= m_maxBytes) Rotate();
+}
+
+
+void OmniTranscript::Rotate()
+{
+    if (m_rotations == 0) {
+        if (ftruncate(m_fd, 0) != 0 || lseek(m_fd, 0, SEEK_SET) != 0) Close();
+        m_fileBytes = 0;
+        return;
+    }
+
+    /* the old file stays locked until the new one is, no other writer slips in */
+    int oldFd = m_fd;
+    m_fd = -1;
+    for (uint32_t i = m_rotations - 1; i > 0; --i) {
+        rename((m_path + "." + std::to_string(i)).c_str(), (m_path + "." + std::to_string(i + 1)).c_str());
+    }
+    rename(m_path.c_str(), (m_path + ".1").c_str());
+    bool isOpened = OpenFile(true);
+    close(oldFd);
+    if (!isOpened) Close();
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+
+
+namespace omnitty {
+
+
+/**
+ * @brief Session transcript of a machine: every byte its pty printed, in a
+ *        file rotated by size.
+ * @details On Linux Read() moves the pty's output with splice() into a pipe,
+ *          duplicates it with tee() into a second pipe and splices that one
+ *          into the file, so the transcript costs no copy through user space:
+ *          the caller reads the first pipe exactly like it would have read
+ *          the pty. Elsewhere, or if the pty can't be spliced, the bytes are
+ *          read and then written to the file.
+ *
+ *          Once the file reaches the size limit it's renamed to path.1
+ *          (path.1 to path.2 and so on, the oldest is dropped) and a new one
+ *          is started, so a transcript never takes more than
+ *          maxBytes * (rotations + 1) bytes, plus a read's worth per file.
+ *
+ *          The file is locked with flock() while it's written, so a second
+ *          writer of the same path, in this process or another, is refused.
+ *
+ *          Only the worker draining the machine uses it.
+ */
+class OmniTranscript
+{
+public:
+    /**
+     * @param path the transcript file, appended to if it exists
+     * @param maxBytes size above which the file is rotated
+     * @param rotations number of rotated files kept
+     */
+    OmniTranscript(const std::string &path, uint32_t maxBytes, uint32_t rotations);
+
+
+    ~OmniTranscript();
+
+
+    bool Open();
+
+
+    /**
+     * @brief IsOpen
+     * @return false if the transcript failed and was closed
+     */
+    bool IsOpen() const { return m_fd >= 0; }
+
+
+    /**
+     * @brief IsInUse
+     * @return true if Open() failed because another writer holds the file
+     */
+    bool IsInUse() const { return m_isInUse; }
+
+
+    /**
+     * @brief Reads up to len bytes of the pty into buf, recording them.
+     * @return like read(), errno is set when -1 is returned
+     */
+    int Read(int ptyFd, char *buf, int len);
+
+
+    /**
+     * @brief Records bytes the caller already read from the pty.
+     */
+    void Write(const char *data, int len);
+
+
+    const std::string &GetPath() const { return m_path; }
+
+
+protected:
+    OmniTranscript(const OmniTranscript &) = delete;
+    OmniTranscript &operator=(const OmniTranscript &) = delete;
+
+
+private:
+    bool OpenFile(bool isTruncated);
+
+
+    void Close();
+
+
+    /**
+     * @brief Moves the bytes tee'd into m_teePipe to the file.
+     */
+    bool SpliceToFile(int len);
+
+
+    /**
+     * @brief Counts bytes added to the file, rotates it past the limit.
+     */
+    void Account(int len);
+
+
+    void Rotate();
+
+
+private:
+    std::string     m_path;
+    uint32_t        m_maxBytes;
+    uint32_t        m_rotations;
+    int             m_fd;
+    uint64_t        m_fileBytes;
+    /* pty -> m_pipe -> caller, and its copy m_teePipe -> file */
+    int             m_pipe[2];
+    int             m_teePipe[2];
+    bool            m_isSpliceSupported;
+    bool            m_isInUse;
+};
+
+
+}
@@ -1,4 +1,10 @@
+#include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sys/ioctl.h>
+#include <algorithm>
 #include "log.h"
 #include "utils.h"
 #include "config.h"
@@ -13,6 +19,13 @@ using namespace omnitty;
 #define MIN_REQUIRED_WIDTH 80
 #define MIN_REQUIRED_HEIGHT 25
 
+/* getch() timeout used by the menus and prompts, which poll the keyboard */
+#define INPUT_TIMEOUT_MS 200
+/* upper bound of a blocking wait */
+#define EVENT_WAIT_TIMEOUT_MS 1000
+/* period of the frame timing logs */
+#define FRAME_STATS_INTERVAL_MS 60000
+
 static const std::string OMNITTY_VERSION("0.4.0");
 static const std::string SPLASH_LINE_1("OmNiTTY Agora v" + OMNITTY_VERSION);
 static const std::string SPLASH_LINE_2("Copyright (c) 2017 AgoraLab");
@@ -23,10 +36,42 @@ static const std::string REMINDER_LINE(
     "  \003F4\007:tag"
     "  \002F5\007:add"
     "  \001F6\007:del"
-    "  \005F7\007:mcast");
+    "  \005F7\007:mcast"
+    "  \004F8\007:hist");
+
+/* notifier of the only window manager, used by the signal handler */
+static OmniEventNotifier *SIGWINCH_NOTIFIER = nullptr;
+
+
+/* may run on any thread, the resize itself is left to the event loop */
+static void SigwinchHandler(int)
+{
+    int savedErrno = errno;
+    if (SIGWINCH_NOTIFIER) SIGWINCH_NOTIFIER->Notify();
+    errno = savedErrno;
+}
+
+
+/* formats a pty backlog for the machine list, e.g. "+512", "+16K" */
+static std::string FormatBacklog(uint32_t backlog)
+{
+    if (backlog == 0) return std::string();
+
+    char buf[16];
+    if (backlog < 1024) {
+        snprintf(buf, sizeof(buf), "+%u", backlog);
+    } else if (backlog < 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "+%uK", backlog / 1024);
+    } else {
+        snprintf(buf, sizeof(buf), "+%uM", backlog / (1024 * 1024));
+    }
+    return std::string(buf);
+}
+
 
 OmniWindowManager::OmniWindowManager()
-    : m_machineMgr(std::make_shared<OmniMachineManager>()), m_menu(m_machineMgr),
+    : m_listWnd(nullptr), m_virtualTerminalWnd(nullptr), m_summaryWnd(nullptr), m_screenWidth(0), m_screenHeight(0),
+      m_machineMgr(std::make_shared<OmniMachineManager>()), m_menu(m_machineMgr),
       m_keypressFuncPtrs{
         {KEY_F(1), &OmniWindowManager::ShowMenu},
         {KEY_F(2), &OmniWindowManager::PrevMachine},
@@ -35,7 +80,11 @@ OmniWindowManager::OmniWindowManager()
         {KEY_F(5), &OmniWindowManager::AddMachine},
         {KEY_F(6), &OmniWindowManager::DeleteMachine},
         {KEY_F(7), &OmniWindowManager::ToggleMulticast},
-    }
+        {KEY_F(8), &OmniWindowManager::ToggleHistory},
+        {KEY_RESIZE, &OmniWindowManager::ResizeWindows},
+    },
+      m_frameScheduler(OmniConfig::GetInstance()->GetMaxFps()), m_isCastLabelDirty(true),
+      m_isHistoryShown(false), m_historyTop(0), m_isHistoryDirty(false)
 {
     m_listWndWidth = omnitty::OmniConfig::GetInstance()->GetListWndWidth();
     m_summaryWndWidth = omnitty::OmniConfig::GetInstance()->GetSummaryWndWidth();
@@ -45,19 +94,39 @@ OmniWindowManager::OmniWindowManager()
 
 OmniWindowManager::~OmniWindowManager()
 {
-
+    if (SIGWINCH_NOTIFIER == &m_resizeNotifier) {
+        signal(SIGWINCH, SIG_DFL);
+        SIGWINCH_NOTIFIER = nullptr;
+    }
+    LogFrameStats();
 }
 
 
-void OmniWindowManager::Init()
+bool OmniWindowManager::Init()
 {
+    if (!m_machineMgr->Init()) return false;
+
+    /* curses only draws UTF-8 glyphs in a UTF-8 locale */
+    setlocale(LC_ALL, "");
+
+    /* installed before initscr(), which then leaves SIGWINCH to us: the
+     * curses handler would only be heard at the next key */
+    if (m_resizeNotifier.Init()) {
+        SIGWINCH_NOTIFIER = &m_resizeNotifier;
+        struct sigaction action;
+        action.sa_handler = SigwinchHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &action, NULL);
+    }
     initscr();
     start_color();
     noecho();
     keypad(stdscr, TRUE);
-    timeout(200);
+    timeout(INPUT_TIMEOUT_MS);
     raw();
     CurutilColorpairInit();
+    m_colorPairs.Init();
     clear();
 
     /* register some alternate escape sequences for the function keys,
@@ -102,6 +171,27 @@ void OmniWindowManager::Init()
     wrefresh(stdscr);
 
     DrawWindows();
+
+    m_machineMgr->GetEventLoop().AddFd(STDIN_FILENO, OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+        HandleInput();
+    });
+    if (SIGWINCH_NOTIFIER) {
+        m_machineMgr->GetEventLoop().AddFd(m_resizeNotifier.GetFd(), OmniEventLoop::EVENT_READ, [this](int, uint32_t) {
+            m_resizeNotifier.Clear();
+            struct winsize ws;
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0) return;
+            resizeterm(ws.ws_row, ws.ws_col);
+            ResizeWindows();
+        });
+    }
+
+    OmniTimerWheel &timers = m_machineMgr->GetEventLoop().GetTimers();
+    m_frameStatsTimer.SetCallback([this, &timers]() {
+        LogFrameStats();
+        timers.Schedule(m_frameStatsTimer, FRAME_STATS_INTERVAL_MS);
+    });
+    timers.Schedule(m_frameStatsTimer, FRAME_STATS_INTERVAL_MS);
+    return true;
 }
 
 void OmniWindowManager::LoadMachines()
@@ -113,27 +203,18 @@ void OmniWindowManager::LoadMachines()
 }
 
 
-void OmniWindowManager::UpdateAllMachines()
+void OmniWindowManager::ProcessEvents()
 {
-    m_machineMgr->UpdateAllMachines();
-    Redraw(false);
-}
-
-
-void OmniWindowManager::HandleDeath(pid_t pid)
-{
-    m_machineMgr->HandleDeath(pid);
-}
-
-
-void OmniWindowManager::Keypress(int key)
-{
-    auto iter = m_keypressFuncPtrs.find(key);
-    if (iter == m_keypressFuncPtrs.end()) {
-        ForwardKeypress(key);
-        return;
+    /* a pending frame is drawn when due, whatever else happens meanwhile
+     * is coalesced into it */
+    int timeoutMs = m_frameScheduler.IsPending() ? m_frameScheduler.GetDelayMs() : EVENT_WAIT_TIMEOUT_MS;
+    if (m_machineMgr->WaitForEvents(timeoutMs) > 0) {
+        m_frameScheduler.Invalidate();
+    }
+    if (m_frameScheduler.GetDelayMs() == 0) {
+        m_frameScheduler.BeginFrame();
+        m_frameScheduler.EndFrame(Redraw(false));
     }
-    (this->*(iter->second))();
 }
 
 
@@ -160,8 +241,13 @@ void OmniWindowManager::DrawWindows()
 
     int vtrows = totalHeight - 3;
     int vtcols = totalWidth - C;
+    m_screenWidth = totalWidth;
+    m_screenHeight = totalHeight;
 
-    /* actually create the windows */
+    /* actually create the windows, anew after a resize */
+    if (m_listWnd) delwin(m_listWnd);
+    if (m_summaryWnd) delwin(m_summaryWnd);
+    if (m_virtualTerminalWnd) delwin(m_virtualTerminalWnd);
     m_listWnd = newwin(totalHeight - 3, A - 0, 1, 0);
     m_summaryWnd = (B - A >= 3) ? newwin(totalHeight-3, B - A, 1, A) : nullptr;
     m_virtualTerminalWnd = newwin(totalHeight-3, vtcols, 1, C);
@@ -226,102 +312,353 @@ void OmniWindowManager::DrawWindows()
 }
 
 
-void OmniWindowManager::DrawMachineList()
+void OmniWindowManager::ResizeWindows()
+{
+    int totalWidth, totalHeight;
+    getmaxyx(stdscr, totalHeight, totalWidth);
+    if (totalWidth == m_screenWidth && totalHeight == m_screenHeight) return;
+    if (totalHeight < MIN_REQUIRED_HEIGHT || totalWidth < MIN_REQUIRED_WIDTH) {
+        LOG4CPLUS_WARN_FMT(omnitty::LOGGER_NAME, "window resized to %d x %d, below %d x %d, layout kept",
+                           totalWidth, totalHeight, MIN_REQUIRED_WIDTH, MIN_REQUIRED_HEIGHT);
+        return;
+    }
+
+    werase(stdscr);
+    DrawWindows();
+    SelectMachine();
+    Redraw(true);
+}
+
+
+bool OmniWindowManager::DrawMachineList()
 {
     int w, h;
-    werase(m_listWnd);
     getmaxyx(m_listWnd, h, w);
     int scrollPos = m_machineMgr->GetScrollPos();
     uint32_t machineCount = m_machineMgr->GetMachineCount();
+
+    std::vector<OmniListRow> rows;
     for (uint32_t i = scrollPos; i < static_cast<uint32_t>(scrollPos + h) && i < machineCount; ++i) {
         MachinePtr machine = m_machineMgr->GetMachine(i);
+        OmniListRow row;
         /* decide color */
-        unsigned char attr = machine->IsAlive() ? 0x70 : 0x80;
+        row.m_attr = machine->IsAlive() ? 0x70 : 0x80;
         if (i == static_cast<uint32_t>(m_machineMgr->GetSelectedMachine())) {
             /* red background */
-            attr &= 0xF0;
-            attr |= 0x01;
+            row.m_attr &= 0xF0;
+            row.m_attr |= 0x01;
         }
-        if (machine->IsTagged()) {
+        row.m_isTagged = machine->IsTagged();
+        if (row.m_isTagged) {
             /* green foreground */
-            attr &= 0x0F;
-            attr |= machine->IsAlive() ? 0xA0 : 0x20;
+            row.m_attr &= 0x0F;
+            row.m_attr |= machine->IsAlive() ? 0xA0 : 0x20;
         }
+        row.m_name = machine->GetMachineName();
+        row.m_backlog = FormatBacklog(machine->GetReadBacklog());
+        row.m_isBackpressured = machine->GetWriteBacklog() >= OmniConfig::GetInstance()->GetOutputHighWaterMark();
+        row.m_isStalled = machine->IsAlive() && machine->IsStalled();
+        rows.push_back(std::move(row));
+    }
+    if (rows == m_drawnList) return false;
 
+    werase(m_listWnd);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const OmniListRow &row = rows[i];
+        unsigned char attr = row.m_attr;
         CurutilAttrset(m_listWnd, attr);
-        wmove(m_listWnd, i - scrollPos, 0);
-        waddch(m_listWnd, machine->IsTagged() ? '*' : ' ');
+        wmove(m_listWnd, static_cast<int>(i), 0);
+        waddch(m_listWnd, row.m_isTagged ? '*' : ' ');
 
         /* now we have to print the first w-2 characters of machine[i].name,
          * padding with spaces at the end if necessary to complete w-2
          * characters. We say w-2 because one character of the width was
          * used up when printing '*' and another one must be left blank
          * at the end */
-        const char *p = machine->GetMachineName().c_str();
-        int j = w - 2;
-        while (j--) {
+        const char *p = row.m_name.c_str();
+        int j = w - 2 - static_cast<int>(row.m_backlog.size()) - (row.m_isBackpressured ? 1 : 0) -
+                (row.m_isStalled ? 1 : 0);
+        while (j-- > 0) {
             waddch(m_listWnd, *p ? *p : ' ');
             if (*p) p++;
         }
+
+        /* alive as far as ssh knows, but silent when it should have answered */
+        if (row.m_isStalled) {
+            CurutilAttrset(m_listWnd, (attr & 0x0F) | 0xD0);
+            waddch(m_listWnd, '?');
+        }
+
+        /* keystrokes piling up, the host doesn't read its input */
+        if (row.m_isBackpressured) {
+            CurutilAttrset(m_listWnd, (attr & 0x0F) | 0x90);
+            waddch(m_listWnd, '!');
+        }
+
+        /* output still waiting in the pty, the host is flooding faster than
+         * its share of the read budget */
+        if (!row.m_backlog.empty()) {
+            CurutilAttrset(m_listWnd, (attr & 0x0F) | 0xB0);
+            waddstr(m_listWnd, row.m_backlog.c_str());
+        }
     }
+    m_drawnList.swap(rows);
+    return true;
 }
 
 
-void OmniWindowManager::DrawSummary()
+bool OmniWindowManager::DrawSummary()
 {
     int sumheight, sumwidth;
-    werase(m_summaryWnd);
-    wmove(m_summaryWnd, 0, 0);
     getmaxyx(m_summaryWnd, sumheight, sumwidth);
 
     uint32_t scrollPos = static_cast<uint32_t>(m_machineMgr->GetScrollPos());
     uint32_t machineCount = m_machineMgr->GetMachineCount();
+    std::vector<SummaryState> states;
+    for (uint32_t i = scrollPos; i < scrollPos + sumheight && i < machineCount; ++i) {
+        MachinePtr machine = m_machineMgr->GetMachine(i);
+        uint64_t deferredHead = machine->HasDeferredOutput() ? machine->GetRawRing().GetHead() : 0;
+        states.emplace_back(machine->GetScreenSnapshot(), deferredHead);
+    }
+    if (states == m_drawnSummary) return false;
+    m_drawnSummary.swap(states);
+
+    werase(m_summaryWnd);
+    wmove(m_summaryWnd, 0, 0);
     for (uint32_t i = scrollPos; i < scrollPos + sumheight && i < machineCount; ++i) {
         CurutilAttrset(m_summaryWnd, 0x80);
         wmove(m_summaryWnd, i - scrollPos, 0);
         std::string summary(m_machineMgr->MakeVirtualTerminalSummary(i, sumwidth));
         waddstr(m_summaryWnd, summary.c_str());
     }
+    return true;
 }
 
 
-void OmniWindowManager::DrawVirtualTerminal()
+bool OmniWindowManager::DrawVirtualTerminal()
 {
-    werase(m_virtualTerminalWnd);
+    MachinePtr machine;
+    ScreenSnapshotPtr snapshot;
     int selectedMachine = m_machineMgr->GetSelectedMachine();
     if (selectedMachine >= 0 && selectedMachine < static_cast<int>(m_machineMgr->GetMachineCount())) {
-        MachinePtr machine = m_machineMgr->GetMachine(selectedMachine);
-        rote_vt_draw(machine->GetVirtualTerminal(), m_virtualTerminalWnd, 0, 0, NULL);
+        machine = m_machineMgr->GetMachine(selectedMachine);
+        snapshot = machine->GetScreenSnapshot();
+    }
+    if (m_isHistoryShown && (!snapshot || machine != m_historyMachine)) LeaveHistory();
+    if (m_isHistoryShown) return DrawHistory(machine, snapshot);
+    if (machine == m_drawnMachine && snapshot == m_drawnSnapshot) return false;
+
+    /* the same terminal as last time only needs the cells that changed */
+    const OmniScreenSnapshot *drawn = (machine == m_drawnMachine) ? m_drawnSnapshot.get() : nullptr;
+    if (!drawn) werase(m_virtualTerminalWnd);
+    m_drawnMachine = machine;
+    m_drawnSnapshot = snapshot;
+
+    if (snapshot) {
+        for (int r = 0; r < snapshot->m_rows; ++r) {
+            if (snapshot->IsRowDirty(r, drawn)) {
+                RoteSpan damage = snapshot->GetDamage(r, drawn);
+                DrawTerminalRow(r, snapshot->GetRow(r), damage.first, damage.last, machine->GetVirtualTerminal());
+            }
+        }
+        wmove(m_virtualTerminalWnd, snapshot->m_cursorRow, snapshot->m_cursorCol);
     }
+    return true;
 }
 
 
-void OmniWindowManager::Redraw(bool forceFullRedraw)
+bool OmniWindowManager::DrawHistory(const MachinePtr &machine, const ScreenSnapshotPtr &snapshot)
+{
+    if (!m_isHistoryDirty && snapshot == m_drawnSnapshot) return false;
+    m_drawnMachine = machine;
+    m_drawnSnapshot = snapshot;
+    m_isHistoryDirty = false;
+
+    /* the view may have been dropped from the scrollback meanwhile */
+    const OmniScrollback *scrollback = machine->GetScrollback();
+    uint64_t firstLine = scrollback->GetFirstLine();
+    uint64_t liveTop = snapshot->m_historyLines;
+    m_historyTop = std::min(std::max(m_historyTop, firstLine), liveTop);
+
+    /* lines from the scrollback first, then the screen's rows */
+    uint32_t historyRows = static_cast<uint32_t>(std::min<uint64_t>(snapshot->m_rows, liveTop - m_historyTop));
+    std::vector<ScreenRow> lines;
+    scrollback->GetLines(m_historyTop, historyRows, snapshot->m_cols, lines);
+    for (int r = 0; r < snapshot->m_rows; ++r) {
+        const ScreenRow &line = static_cast<uint32_t>(r) < historyRows ? lines[r] : snapshot->GetRow(r - historyRows);
+        DrawTerminalRow(r, line, 0, snapshot->m_cols - 1, machine->GetVirtualTerminal());
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "[-%llu/%llu  PgUp PgDn q]", static_cast<unsigned long long>(liveTop - m_historyTop),
+             static_cast<unsigned long long>(liveTop - firstLine));
+    int labelCol = std::max(0, snapshot->m_cols - static_cast<int>(strlen(label)));
+    CurutilAttrset(m_virtualTerminalWnd, 0xF4);
+    mvwaddnstr(m_virtualTerminalWnd, 0, labelCol, label, snapshot->m_cols);
+    wmove(m_virtualTerminalWnd, snapshot->m_rows - 1, 0);
+    return true;
+}
+
+
+/* Decodes the glyph's UTF-8, which rote wrote and is well formed, into at
+ * most count wide characters and a terminating 0 */
+static void DecodeGlyph(const char *utf8, wchar_t *wcs, size_t count)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(utf8);
+    size_t n = 0;
+    while (*p && n < count) {
+        int extra = (*p >= 0xF0) ? 3 : (*p >= 0xE0) ? 2 : (*p >= 0xC0) ? 1 : 0;
+        uint32_t cp = *p++ & (0x7F >> extra);
+        for (; extra > 0 && (*p & 0xC0) == 0x80; --extra) cp = (cp << 6) | (*p++ & 0x3F);
+        wcs[n++] = static_cast<wchar_t>(cp);
+    }
+    wcs[n] = L'\0';
+}
+
+
+static void AddGlyph(WINDOW *wnd, const RoteGlyph *glyph)
+{
+    wchar_t wcs[CCHARW_MAX + 1];
+    cchar_t cch;
+    DecodeGlyph(glyph->utf8, wcs, CCHARW_MAX);
+    /* curses takes a character and its combining marks, the characters
+     * that a joiner adds are left out */
+    if (setcchar(&cch, wcs, A_NORMAL, 0, nullptr) != OK) {
+        wcs[1] = L'\0';
+        setcchar(&cch, wcs, A_NORMAL, 0, nullptr);
+    }
+    wadd_wch(wnd, &cch);
+}
+
+
+void OmniWindowManager::DrawTerminalRow(int row, const ScreenRow &line, int firstCol, int lastCol,
+                                        RoteTerm *virtualTerminal)
+{
+    /* a snapshot from before a resize may not fit in the window yet */
+    if (row >= getmaxy(m_virtualTerminalWnd)) return;
+    lastCol = std::min(lastCol, getmaxx(m_virtualTerminalWnd) - 1);
+
+    /* a wide glyph is drawn from its first column */
+    if (firstCol > 0 && static_cast<unsigned char>(line.m_text[firstCol]) == ROTE_CELL_WIDE_TAIL) --firstCol;
+    wmove(m_virtualTerminalWnd, row, firstCol);
+    int drawnAttr = -1;
+    uint16_t drawnXAttr = 0;
+    for (int c = firstCol; c <= lastCol; ++c) {
+        unsigned char ch = static_cast<unsigned char>(line.m_text[c]);
+        /* curses may not agree with rote on the width of a glyph, the
+         * cursor is put back on the cell when they differ */
+        bool isOnCell = getcury(m_virtualTerminalWnd) == row && getcurx(m_virtualTerminalWnd) == c;
+        if (ch == ROTE_CELL_WIDE_TAIL) {
+            if (!isOnCell) continue;
+            ch = ' ';
+        }
+        if (!isOnCell) wmove(m_virtualTerminalWnd, row, c);
+
+        uint16_t xattr = line.GetXAttr(c);
+        if (line.m_attrs[c] != drawnAttr || xattr != drawnXAttr) {
+            drawnAttr = line.m_attrs[c];
+            drawnXAttr = xattr;
+            m_colorPairs.Attrset(m_virtualTerminalWnd, line.m_attrs[c],
+                                 xattr ? rote_vt_get_xattr(virtualTerminal, xattr) : nullptr);
+        }
+        if (ch == ROTE_CELL_GLYPH) {
+            AddGlyph(m_virtualTerminalWnd, rote_vt_get_glyph(virtualTerminal, line.GetGlyph(c)));
+        } else {
+            waddch(m_virtualTerminalWnd, ch >= 32 ? ch : ' ');
+        }
+    }
+}
+
+
+bool OmniWindowManager::Redraw(bool forceFullRedraw)
 {
     if (forceFullRedraw) {
         touchwin(stdscr);
         wrefresh(stdscr);
+        /* forget what the windows show, they're all drawn again */
+        m_drawnList.clear();
+        m_drawnSummary.clear();
+        m_drawnMachine.reset();
+        m_drawnSnapshot.reset();
+        m_isCastLabelDirty = true;
     }
 
+    /* the windows are sent to the terminal together, by doupdate() */
+    bool isDrawn = false;
+
     /* draw machine list */
-    DrawMachineList();
-    if (forceFullRedraw) touchwin(m_listWnd);
-    wrefresh(m_listWnd);
+    if (DrawMachineList() || forceFullRedraw) {
+        if (forceFullRedraw) touchwin(m_listWnd);
+        wnoutrefresh(m_listWnd);
+        isDrawn = true;
+    }
 
     /* draw summary window, if there is one */
-    if (m_summaryWnd) {
-        DrawSummary();
+    if (m_summaryWnd && (DrawSummary() || forceFullRedraw)) {
         if (forceFullRedraw) touchwin(m_summaryWnd);
-        wrefresh(m_summaryWnd);
+        wnoutrefresh(m_summaryWnd);
+        isDrawn = true;
     }
 
-    /* draw vt window */
-    DrawVirtualTerminal();
-    if (forceFullRedraw) touchwin(m_virtualTerminalWnd);
-    wrefresh(m_virtualTerminalWnd);
+    /* draw vt window, refreshed last for the cursor to end up there */
+    if (DrawVirtualTerminal() || isDrawn || forceFullRedraw) {
+        if (forceFullRedraw) touchwin(m_virtualTerminalWnd);
+        wnoutrefresh(m_virtualTerminalWnd);
+        isDrawn = true;
+    }
 
-    /* draw the 'multicast/singlecast' label */
-    m_menu.UpdateCastLabel();
+    /* draw the 'multicast/singlecast' label, its refresh updates the rest */
+    if (m_isCastLabelDirty) {
+        m_menu.UpdateCastLabel();
+        m_isCastLabelDirty = false;
+        return true;
+    }
+    if (isDrawn) doupdate();
+    return isDrawn;
+}
+
+
+void OmniWindowManager::LogFrameStats()
+{
+    const OmniFrameStats &stats = m_frameScheduler.GetStats();
+    uint64_t averageUs = stats.m_drawnFrames > 0 ? stats.m_totalFrameUs / stats.m_drawnFrames : 0;
+    LOG4CPLUS_DEBUG_FMT(omnitty::LOGGER_NAME,
+        "frames: %llu drawn, %llu unchanged, %llu changes; frame time: last %llu us, avg %llu us, max %llu us",
+        static_cast<unsigned long long>(stats.m_drawnFrames), static_cast<unsigned long long>(stats.m_skippedFrames),
+        static_cast<unsigned long long>(stats.m_invalidations), static_cast<unsigned long long>(stats.m_lastFrameUs),
+        static_cast<unsigned long long>(averageUs), static_cast<unsigned long long>(stats.m_maxFrameUs));
+}
+
+
+void OmniWindowManager::HandleInput()
+{
+    /* ncurses may have buffered several keys from one read(), so drain
+     * everything instead of waiting for stdin to become readable again:
+     * a paste is written to each terminal at once and redrawn once.
+     * A command may open a menu, which relies on the regular timeout */
+    for (;;) {
+        timeout(0);
+        int ch = getch();
+        timeout(INPUT_TIMEOUT_MS);
+        if (ch < 0) break;
+
+        auto iter = m_keypressFuncPtrs.find(ch);
+        if (iter == m_keypressFuncPtrs.end()) {
+            /* the history view takes the keys for itself */
+            if (m_isHistoryShown) {
+                ScrollHistory(ch);
+            } else {
+                m_pendingKeys.push_back(ch);
+            }
+            continue;
+        }
+        /* the keys typed before a command go to the machines selected before it */
+        ForwardPendingKeys();
+        (this->*(iter->second))();
+        /* the command may have changed the mode, or left a message over the label */
+        m_isCastLabelDirty = true;
+    }
+    ForwardPendingKeys();
 }
 
 
@@ -440,9 +777,70 @@ void OmniWindowManager::ToggleMulticast()
 }
 
 
-void OmniWindowManager::ForwardKeypress(int key)
+void OmniWindowManager::ToggleHistory()
+{
+    if (m_isHistoryShown) {
+        LeaveHistory();
+        return;
+    }
+
+    int selectedMachine = m_machineMgr->GetSelectedMachine();
+    if (selectedMachine < 0 || selectedMachine >= static_cast<int>(m_machineMgr->GetMachineCount())) return;
+    MachinePtr machine = m_machineMgr->GetMachine(selectedMachine);
+    ScreenSnapshotPtr snapshot = machine->GetScreenSnapshot();
+    if (!machine->GetScrollback() || !snapshot) {
+        m_menu.ShowMessageAndWait("No scrollback is kept, see ScrollbackLines in the config.", 0xF1);
+        return;
+    }
+
+    /* starts at the bottom, on the live screen */
+    m_isHistoryShown = true;
+    m_historyMachine = machine;
+    m_historyTop = snapshot->m_historyLines;
+    m_isHistoryDirty = true;
+}
+
+
+void OmniWindowManager::ScrollHistory(int ch)
+{
+    ScreenSnapshotPtr snapshot = m_historyMachine->GetScreenSnapshot();
+    int64_t page = snapshot->m_rows;
+    int64_t top = static_cast<int64_t>(m_historyTop);
+    int64_t firstLine = static_cast<int64_t>(m_historyMachine->GetScrollback()->GetFirstLine());
+    int64_t liveTop = static_cast<int64_t>(snapshot->m_historyLines);
+
+    switch (ch) {
+    case KEY_UP:    top -= 1; break;
+    case KEY_DOWN:  top += 1; break;
+    case KEY_PPAGE: top -= page; break;
+    case KEY_NPAGE: top += page; break;
+    case KEY_HOME:  top = firstLine; break;
+    case KEY_END:   top = liveTop; break;
+    case 'q': case 27:
+        LeaveHistory();
+        return;
+    default:
+        return;
+    }
+    m_historyTop = static_cast<uint64_t>(std::min(std::max(top, firstLine), liveTop));
+    m_isHistoryDirty = true;
+}
+
+
+void OmniWindowManager::LeaveHistory()
+{
+    m_isHistoryShown = false;
+    m_historyMachine.reset();
+    /* the live screen is drawn again from scratch */
+    m_drawnMachine.reset();
+    m_drawnSnapshot.reset();
+}
+
+
+void OmniWindowManager::ForwardPendingKeys()
 {
-    m_machineMgr->ForwardKeypress(key);
+    m_machineMgr->ForwardKeypresses(m_pendingKeys);
+    m_pendingKeys.clear();
 }
 
 
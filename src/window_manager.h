@@ -1,7 +1,13 @@
 #pragma once
 #include <map>
 #include <string>
+#include <vector>
 #include "menu.h"
+#include "machine.h"
+#include "timer_wheel.h"
+#include "event_loop.h"
+#include "frame_scheduler.h"
+#include "color_pair_cache.h"
 
 
 namespace omnitty {
@@ -11,6 +17,28 @@ class OmniWindowManager
 {
     typedef void (OmniWindowManager::*KeypressFuncPtr)();
 
+    /**
+     * @brief What a row of the machine list shows.
+     */
+    struct OmniListRow {
+        std::string     m_name;
+        unsigned char   m_attr;
+        bool            m_isTagged;
+        bool            m_isStalled;
+        bool            m_isBackpressured;
+        std::string     m_backlog;
+
+        bool operator==(const OmniListRow &row) const {
+            return m_name == row.m_name && m_attr == row.m_attr && m_isTagged == row.m_isTagged &&
+                   m_isStalled == row.m_isStalled && m_isBackpressured == row.m_isBackpressured &&
+                   m_backlog == row.m_backlog;
+        }
+    };
+
+    /* a summary row: the snapshot it was made of, and the end of the raw
+     * output when it was made of the deferred output instead */
+    typedef std::pair<ScreenSnapshotPtr, uint64_t> SummaryState;
+
 public:
     OmniWindowManager();
 
@@ -30,33 +58,25 @@ public:
 public:
     /**
      * @brief Init the window manager.
+     * @return false if the machine manager couldn't be initialized
      */
-    void Init();
+    bool Init();
 
 
     void LoadMachines();
 
 
     /**
-     * @brief Updates the virtual terminals of all machines.
-     * @details This function should be called regularly.
+     * @brief Runs one iteration of the event loop.
+     * @details Blocks until a pty, the keyboard or a child's exit is ready,
+     *          pumps the ready terminals, handles the pending keys and reaps
+     *          the dead children. The windows that changed are redrawn once
+     *          the frame scheduler says so.
      */
-    void UpdateAllMachines();
+    void ProcessEvents();
 
-    /**
-     * @brief Handles the death of PID p.
-     * @details This will check if that PID matches the PID of the child ssh
-     *          process of any of the machines registered in the manager. If so,
-     *          it will mark that machine as dead.
-     * @param pid the pid of the machine
-     */
-    void HandleDeath(pid_t pid);
 
-    /**
-     * @brief Keypress, handle F1 - F7 and send others to terminal.
-     * @param key the pressed key.
-     */
-    void Keypress(int key);
+    const OmniFrameStats &GetFrameStats() const { return m_frameScheduler.GetStats(); }
 
 private:
     /**
@@ -69,13 +89,26 @@ private:
      *          0       A        BC                             termcols-1
      *
      *          A = list_win_chars + 2
+     *
+     *          Called again after a resize, the windows are made anew and the
+     *          machines' terminals take the new size.
      */
     void DrawWindows();
 
     /**
-     * @brief Draws the machine list onto the list window.
+     * @brief Rebuilds the layout if the screen size changed, on SIGWINCH.
+     * @details The ssh sessions are kept, only their terminals are resized,
+     *          see OmniMachineManager::SetVirtualTerminalSize(). A screen
+     *          below the minimum size keeps the previous layout.
      */
-    void DrawMachineList();
+    void ResizeWindows();
+
+    /**
+     * @brief Draws the machine list onto the list window, if it changed
+     *        since it was last drawn.
+     * @return whether it was drawn
+     */
+    bool DrawMachineList();
 
     /**
      * @brief Draws the summary area in the passed window.
@@ -98,22 +131,57 @@ private:
      *           | mach 3   | summary for machine 3    |
      *           | ...      | ...                      |
      *           +----------+--------------------------+
+     *
+     *          Nothing is drawn if no summary changed since the last time.
+     * @return whether it was drawn
      */
-    void DrawSummary();
+    bool DrawSummary();
 
     /**
      * @brief Draws the virtual terminal for the currently selected machine in
      *        the given window.
      * @details Assumes the dimensions of the given window match the vtrows,
-     *          vtcols arguments passed to constructor.
+     *          vtcols arguments passed to constructor. Only the rows that
+     *          changed since the terminal was last drawn are drawn.
+     * @return whether anything was drawn
      */
-    void DrawVirtualTerminal();
+    bool DrawVirtualTerminal();
 
     /**
-     * @brief Redraw
-     * @param forceFullRedraw whether to force full redraw
+     * @brief Draws the history view of the machine in the terminal window:
+     *        its scrollback from m_historyTop, down to its screen.
+     * @return whether anything was drawn
      */
-    void Redraw(bool forceFullRedraw);
+    bool DrawHistory(const MachinePtr &machine, const ScreenSnapshotPtr &snapshot);
+
+    /**
+     * @brief Draws columns firstCol..lastCol of a row of the terminal, or of
+     *        its scrollback. The attributes are only set where they change
+     *        along the row.
+     * @param virtualTerminal the terminal whose glyphs and extended
+     *        attributes the row's are
+     */
+    void DrawTerminalRow(int row, const ScreenRow &line, int firstCol, int lastCol, RoteTerm *virtualTerminal);
+
+    /**
+     * @brief Redraws the windows that changed.
+     * @param forceFullRedraw whether to redraw everything, e.g. after a menu
+     *        covered the windows
+     * @return whether anything was drawn
+     */
+    bool Redraw(bool forceFullRedraw);
+
+    /**
+     * @brief Logs the frame timing, see OmniConfig::GetMaxFps().
+     */
+    void LogFrameStats();
+
+    /**
+     * @brief Handles all the keys pending on stdin: F1 - F8 run their
+     *        command, the keys in between are sent to the terminals in one
+     *        batch, or scroll the history view when it's shown.
+     */
+    void HandleInput();
 
 private:
     /**
@@ -159,13 +227,31 @@ private:
     void ToggleMulticast();
 
     /**
-     * @brief Forwards the given keypress to the appropriate machines.
-     * @details If multicast mode is on, the keypress will be forwarded to all
-     *          tagged machines; otherwise, it will be directed only to the
-     *          currently selected machine.
-     * @param key the pressed key
+     * @brief Shows or leaves the history view of the selected machine, for
+     *        F8 keypress.
+     * @details The view pages through the lines the machine scrolled away,
+     *          see OmniScrollback. It's left when another machine is
+     *          selected.
+     */
+    void ToggleHistory();
+
+    /**
+     * @brief Moves the history view: up/down arrows by a line, PgUp/PgDn
+     *        by a page, Home/End to the oldest line or the screen. q or Esc
+     *        leaves it.
+     */
+    void ScrollHistory(int ch);
+
+    void LeaveHistory();
+
+    /**
+     * @brief Forwards the keys collected by HandleInput() to the appropriate
+     *        machines.
+     * @details If multicast mode is on, the keypresses will be forwarded to
+     *          all tagged machines; otherwise, they will be directed only to
+     *          the currently selected machine.
      */
-    void ForwardKeypress(int key);
+    void ForwardPendingKeys();
 
     void SelectMachine();
 
@@ -176,9 +262,31 @@ private:
     WINDOW                          *m_listWnd;
     WINDOW                          *m_virtualTerminalWnd;
     WINDOW                          *m_summaryWnd;
+    /* the screen size the windows were laid out for */
+    int                             m_screenWidth;
+    int                             m_screenHeight;
+    /* made readable by SIGWINCH */
+    OmniEventNotifier               m_resizeNotifier;
     MachineManagerPtr               m_machineMgr;
     OmniMenu                        m_menu;
     std::map<int, KeypressFuncPtr>  m_keypressFuncPtrs;
+    /* keys read but not forwarded yet */
+    std::vector<int>                m_pendingKeys;
+    OmniFrameScheduler              m_frameScheduler;
+    OmniTimer                       m_frameStatsTimer;
+    OmniColorPairCache              m_colorPairs;
+    /* what the windows show, each one is redrawn only when it changes */
+    std::vector<OmniListRow>        m_drawnList;
+    std::vector<SummaryState>       m_drawnSummary;
+    MachinePtr                      m_drawnMachine;
+    ScreenSnapshotPtr               m_drawnSnapshot;
+    bool                            m_isCastLabelDirty;
+    /* history view, see ToggleHistory(); the top line is in the
+     * scrollback's numbering */
+    bool                            m_isHistoryShown;
+    MachinePtr                      m_historyMachine;
+    uint64_t                        m_historyTop;
+    bool                            m_isHistoryDirty;
 };
 
 